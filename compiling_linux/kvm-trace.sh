@@ -0,0 +1,96 @@
+#!/bin/bash
+# This script records the KVM exit tracepoints in ftrace's binary ring-buffer
+# format, for programs/host/kvm-trace. Run it on the host while the guest
+# runs a benchmark:
+#
+#   sudo ./kvm-trace.sh [-o dir] [-s seconds] [-p pid] [command...]
+#
+# Without a command it records for SECONDS (default 10). The output
+# directory holds the event formats, the page header, the trace clock and
+# one cpuN.raw file per CPU (raw trace_pipe_raw pages).
+set -euo pipefail
+
+OUT_DIR="${OUT_DIR:-kvm-trace}"
+SECONDS_TO_RECORD="${SECONDS_TO_RECORD:-10}"
+# Per-CPU ring buffer size; the buffers are drained after recording, so
+# they must hold the whole capture (or events are overwritten)
+BUFFER_KB="${BUFFER_KB:-65536}"
+PID=""
+
+while getopts "o:s:p:" opt; do
+    case "$opt" in
+        o) OUT_DIR="$OPTARG" ;;
+        s) SECONDS_TO_RECORD="$OPTARG" ;;
+        p) PID="$OPTARG" ;;
+        *) echo "Usage: $0 [-o dir] [-s seconds] [-p pid] [command...]"; exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+EVENTS=(kvm_exit kvm_entry kvm_userspace_exit kvm_pio)
+
+# --- Locate tracefs -----------------------------------------------------------
+TRACEFS=/sys/kernel/tracing
+if [ ! -e "$TRACEFS/trace" ]; then
+    mount -t tracefs nodev "$TRACEFS" 2>/dev/null || TRACEFS=/sys/kernel/debug/tracing
+fi
+if [ ! -d "$TRACEFS/events/kvm" ]; then
+    echo "No KVM tracepoints in $TRACEFS (is kvm loaded?)"
+    exit 1
+fi
+
+# --- Save the metadata the parser needs ---------------------------------------
+mkdir -p "$OUT_DIR"
+rm -f "$OUT_DIR"/cpu*.raw
+cp "$TRACEFS/events/header_page" "$OUT_DIR/header_page"
+for e in "${EVENTS[@]}"; do
+    cp "$TRACEFS/events/kvm/$e/format" "$OUT_DIR/$e.format"
+done
+
+# --- Configure ----------------------------------------------------------------
+# TSC clock: latencies come out in cycles like the rest of the benchmarks
+PREV_CLOCK=$(sed -e 's/.*\[\(.*\)\].*/\1/' "$TRACEFS/trace_clock")
+if grep -qw x86-tsc "$TRACEFS/trace_clock"; then
+    echo x86-tsc > "$TRACEFS/trace_clock"
+fi
+sed -e 's/.*\[\(.*\)\].*/\1/' "$TRACEFS/trace_clock" > "$OUT_DIR/trace_clock"
+
+cleanup() {
+    echo 0 > "$TRACEFS/tracing_on"
+    for e in "${EVENTS[@]}"; do
+        echo 0 > "$TRACEFS/events/kvm/$e/enable"
+    done
+    echo > "$TRACEFS/set_event_pid"
+    echo "$PREV_CLOCK" > "$TRACEFS/trace_clock"
+}
+trap cleanup EXIT
+
+echo 0 > "$TRACEFS/tracing_on"
+echo "$BUFFER_KB" > "$TRACEFS/buffer_size_kb"
+echo > "$TRACEFS/trace"                             # clears all CPU buffers
+if [ -n "$PID" ]; then
+    echo "$PID" > "$TRACEFS/set_event_pid"
+fi
+for e in "${EVENTS[@]}"; do
+    echo 1 > "$TRACEFS/events/kvm/$e/enable"
+done
+
+# --- Record -------------------------------------------------------------------
+echo "Recording ${EVENTS[*]} into $OUT_DIR (clock $(cat "$OUT_DIR/trace_clock"))"
+echo 1 > "$TRACEFS/tracing_on"
+if [ $# -gt 0 ]; then
+    "$@" || true
+else
+    sleep "$SECONDS_TO_RECORD"
+fi
+echo 0 > "$TRACEFS/tracing_on"
+
+# --- Drain --------------------------------------------------------------------
+# Non-blocking reads return the buffered pages, including the partial
+# last one, and stop with EAGAIN once the buffer is empty
+for dir in "$TRACEFS"/per_cpu/cpu*; do
+    cpu=$(basename "$dir")
+    dd if="$dir/trace_pipe_raw" of="$OUT_DIR/$cpu.raw" bs=1M iflag=nonblock status=none 2>/dev/null || true
+    grep -H overrun "$dir/stats" | sed -e "s|.*per_cpu/||" | grep -v ' 0$' || true
+done
+du -sh "$OUT_DIR"
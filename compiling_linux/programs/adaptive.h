@@ -0,0 +1,121 @@
+#ifndef ADAPTIVE_H
+#define ADAPTIVE_H
+
+/* Convergence-driven sample counts.
+ *
+ * Instead of a fixed N, a series is sampled in chunks until the
+ * confidence intervals of its median and of a tail percentile are both
+ * narrower than a target width (relative to the estimate), or until its
+ * time budget or buffer is used up. Cheap, stable series stop after a few
+ * thousand samples; noisy ones keep going.
+ *
+ * Usage, with loop() appending n samples to stats:
+ *
+ *     adaptive_run_t run;
+ *     size_t n;
+ *     adaptive_begin(&run);
+ *     while ((n = adaptive_next(&cfg, &stats, &run)) > 0)
+ *         loop(n);
+ *     adaptive_print(&run, &cfg, label);
+ *
+ * The intervals are distribution-free (stats_percentile_ci). Chunks grow
+ * with the sample count, so the checks add a constant factor, not a
+ * quadratic cost.
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include "stats.h"
+
+#define ADAPTIVE_Z            1.96      /* 95% confidence */
+#define ADAPTIVE_MIN_SAMPLES  10000
+#define ADAPTIVE_DEFAULT_TAIL 99.0
+
+typedef struct {
+    double tail;                /* tail percentile, e.g. 99 */
+    double width;               /* target CI width as a fraction of the estimate */
+    double budget;              /* seconds per series */
+    size_t min_samples;         /* before the first convergence check */
+} adaptive_t;
+
+typedef struct {
+    double start;
+    size_t samples;
+    double seconds;
+    int converged;              /* 1: CIs narrow enough, 0: budget or buffer ran out */
+    double median, median_lo, median_hi;
+    double tail, tail_lo, tail_hi;
+} adaptive_run_t;
+
+static inline double adaptive_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static inline void adaptive_init(adaptive_t *a, double width, double budget)
+{
+    a->tail = ADAPTIVE_DEFAULT_TAIL;
+    a->width = width;
+    a->budget = budget;
+    a->min_samples = ADAPTIVE_MIN_SAMPLES;
+}
+
+static inline void adaptive_begin(adaptive_run_t *run)
+{
+    memset(run, 0, sizeof(*run));
+    run->start = adaptive_now();
+}
+
+static inline int adaptive_narrow(double lo, double hi, double est, double width)
+{
+    return hi - lo <= width * (est > 1.0 ? est : 1.0);
+}
+
+/* Number of samples to take next, 0 once the series is done */
+static inline size_t adaptive_next(const adaptive_t *a, stats_t *stats, adaptive_run_t *run)
+{
+    size_t room = stats->capacity - stats->count;
+
+    run->samples = stats->count;
+    run->seconds = adaptive_now() - run->start;
+    if (stats->count >= a->min_samples) {
+        stats_percentile_ci(stats, 50.0, ADAPTIVE_Z, &run->median_lo, &run->median_hi);
+        stats_percentile_ci(stats, a->tail, ADAPTIVE_Z, &run->tail_lo, &run->tail_hi);
+        double p[2], pcts[2] = { 50.0, a->tail };
+        stats_percentiles(stats, pcts, p, 2);
+        run->median = p[0];
+        run->tail = p[1];
+        if (adaptive_narrow(run->median_lo, run->median_hi, run->median, a->width) &&
+            adaptive_narrow(run->tail_lo, run->tail_hi, run->tail, a->width)) {
+            run->converged = 1;
+            return 0;
+        }
+    }
+    if (run->seconds >= a->budget || room == 0)
+        return 0;
+
+    /* Grow by a quarter each time, at least up to the first check */
+    size_t n = stats->count < a->min_samples ? a->min_samples - stats->count : stats->count / 4;
+    return n < room ? n : room;
+}
+
+static inline void adaptive_print(const adaptive_run_t *run, const adaptive_t *a, const char *label)
+{
+    printf("=== Convergence: %s ===\n", label);
+    printf("Samples needed: %zu in %.2f s, %s\n", run->samples, run->seconds,
+           run->converged ? "converged" :
+           run->seconds >= a->budget ? "NOT converged (time budget)" : "NOT converged (sample cap)");
+    if (run->samples >= a->min_samples) {
+        printf("Median %.1f [%.1f, %.1f], p%g %.1f [%.1f, %.1f] (95%% CI, target width %.1f%%)\n",
+               run->median, run->median_lo, run->median_hi, a->tail,
+               run->tail, run->tail_lo, run->tail_hi, 100.0 * a->width);
+        if (stats_tsc_hz > 0.0)
+            printf("Median %.1f ns, p%g %.1f ns\n", stats_cycles_to_ns(run->median),
+                   a->tail, stats_cycles_to_ns(run->tail));
+    }
+    printf("====================================\n\n");
+}
+
+#endif /* ADAPTIVE_H */
@@ -0,0 +1,161 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+/* Prefaulted memory for sample storage (user space).
+ *
+ * A buffer from malloc is only backed by memory when it is first written,
+ * so the first store to every page of a sample buffer takes a page fault
+ * inside the measured loop, and in a guest possibly an EPT violation exit
+ * as well. Those land exactly in the tail being measured.
+ *
+ * An arena is one mapping, created with MAP_POPULATE so every page is
+ * allocated up front, and mlock'ed so it stays resident. Hugetlb pages
+ * (2 MB or 1 GB, from the pool in /sys/kernel/mm/hugepages) also cut the
+ * TLB misses of a large buffer; without free pages in the pool the arena
+ * falls back to normal pages. Series take their regions with arena_alloc.
+ *
+ * faults_read() samples the thread's page fault counters (getrusage) so
+ * a harness can report the faults taken while a series ran and show the
+ * run was fault-free.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+#define ARENA_ALIGN 64
+#define ARENA_2MB   (2ul << 20)
+#define ARENA_1GB   (1ul << 30)
+
+typedef struct {
+    uint8_t *base;
+    size_t size;
+    size_t used;
+    size_t page;        /* size of the pages backing the arena */
+    int hugetlb;
+    int locked;
+} arena_t;
+
+typedef struct {
+    long minflt;
+    long majflt;
+} faults_t;
+
+static inline size_t arena_round(size_t n, size_t align)
+{
+    return (n + align - 1) / align * align;
+}
+
+/* Bytes to reserve for count regions of bytes each */
+static inline size_t arena_bytes(size_t count, size_t bytes)
+{
+    return count * arena_round(bytes, ARENA_ALIGN);
+}
+
+/* Map, populate and lock bytes of memory
+ * huge: 0 for normal pages, ARENA_2MB or ARENA_1GB for hugetlb pages
+ * Returns 0, or -1 if even the normal-page mapping fails.
+ */
+static inline int arena_init(arena_t *a, size_t bytes, size_t huge)
+{
+    void *m = MAP_FAILED;
+
+    memset(a, 0, sizeof(*a));
+    if (bytes == 0) bytes = ARENA_ALIGN;
+    if (huge) {
+        a->size = arena_round(bytes, huge);
+        m = mmap(NULL, a->size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE | MAP_HUGETLB |
+                 (huge == ARENA_1GB ? MAP_HUGE_1GB : MAP_HUGE_2MB), -1, 0);
+        if (m == MAP_FAILED)
+            fprintf(stderr, "No %lu MB hugetlb pages for %zu MB (%s), using normal pages\n",
+                    huge >> 20, a->size >> 20, strerror(errno));
+        else
+            a->page = huge, a->hugetlb = 1;
+    }
+    if (m == MAP_FAILED) {
+        a->page = sysconf(_SC_PAGESIZE);
+        a->size = arena_round(bytes, a->page);
+        m = mmap(NULL, a->size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+        if (m == MAP_FAILED) return -1;
+    }
+    a->base = m;
+    a->locked = mlock(a->base, a->size) == 0;
+    return 0;
+}
+
+/* Carve an ARENA_ALIGN aligned region; NULL when the arena is full */
+static inline void *arena_alloc(arena_t *a, size_t bytes)
+{
+    size_t len = arena_round(bytes, ARENA_ALIGN);
+    if (!a->base || len > a->size - a->used) return NULL;
+    void *p = a->base + a->used;
+    a->used += len;
+    return p;
+}
+
+/* Hand out the whole arena again; contents are kept, not cleared */
+static inline void arena_reset(arena_t *a)
+{
+    a->used = 0;
+}
+
+static inline void arena_print(const arena_t *a)
+{
+    printf("Sample arena: %.1f MB in %s pages, prefaulted, %s\n\n", a->size / 1048576.0,
+           a->hugetlb ? (a->page == ARENA_1GB ? "1 GB hugetlb" : "2 MB hugetlb") : "4 KB",
+           a->locked ? "locked" : "NOT locked (mlock failed, raise RLIMIT_MEMLOCK)");
+}
+
+static inline void faults_read(faults_t *f)
+{
+    struct rusage ru;
+#ifdef RUSAGE_THREAD
+    getrusage(RUSAGE_THREAD, &ru);
+#else
+    getrusage(RUSAGE_SELF, &ru);
+#endif
+    f->minflt = ru.ru_minflt;
+    f->majflt = ru.ru_majflt;
+}
+
+/* acc += now - since */
+static inline void faults_add_since(faults_t *acc, const faults_t *since)
+{
+    faults_t now;
+    faults_read(&now);
+    acc->minflt += now.minflt - since->minflt;
+    acc->majflt += now.majflt - since->majflt;
+}
+
+static inline void faults_print(const faults_t *f, const char *label)
+{
+    printf("Page faults during %s: %ld minor, %ld major%s\n\n", label, f->minflt, f->majflt,
+           f->minflt || f->majflt ? "" : " (fault-free)");
+}
+
+/* -M argument: "2M" or "1G" */
+static inline int arena_parse_huge(const char *s, size_t *huge)
+{
+    if (strcmp(s, "2M") == 0 || strcmp(s, "2m") == 0) *huge = ARENA_2MB;
+    else if (strcmp(s, "1G") == 0 || strcmp(s, "1g") == 0) *huge = ARENA_1GB;
+    else return -1;
+    return 0;
+}
+
+#endif /* ARENA_H */
@@ -0,0 +1,219 @@
+#ifndef COLD_H
+#define COLD_H
+
+/* Cold-state measurements: disturb cache and TLB state before every
+ * timed exit, outside the timed region (EXIT_COLD_LOOP in exits.h).
+ *
+ * Back-to-back loops keep KVM's exit handler, the VMCS and the VMM's
+ * dispatch code hot in every cache level, which a vCPU coming back from
+ * real guest work does not see. The disturbances:
+ *
+ *   COLD_SWEEP        write one byte per line of a buffer; larger than the
+ *                     LLC it also evicts the host's lines, since the caches
+ *                     are physically tagged and shared with the host
+ *   COLD_FLUSH_CODE   CLFLUSH the lines around the timed exit instruction
+ *   COLD_FLUSH_STACK  CLFLUSH the lines of the current stack frame
+ *   COLD_WBINVD       WBINVD (kernel only). KVM intercepts it and only
+ *                     really flushes for VMs with non-coherent DMA, so on
+ *                     most hosts it is an extra exit and nothing more
+ *   COLD_TLB          kernel: flush the guest TLB (__flush_tlb_all);
+ *                     user space: touch one line in each of
+ *                     COLD_TLB_PAGES 4K pages, more than the STLB holds
+ *
+ * Every disturbance runs before every sample, so cold series are slow:
+ * a 16 MB sweep takes about a millisecond. Use a smaller N.
+ */
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <asm/special_insns.h>
+#include <asm/tlbflush.h>
+#else
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "stats.h"
+#endif
+
+#define COLD_SWEEP        0x01
+#define COLD_FLUSH_CODE   0x02
+#define COLD_FLUSH_STACK  0x04
+#define COLD_WBINVD       0x08
+#define COLD_TLB          0x10
+#define COLD_ALL_FLAGS    0x1f
+
+#define COLD_LINE          64
+#define COLD_DEFAULT_SWEEP (16u << 20)
+#define COLD_MAX_SWEEP     (1ul << 30)
+#define COLD_TLB_PAGES     4096
+#define COLD_FLUSH_BEFORE  128      /* code lines flushed around the exit */
+#define COLD_FLUSH_AFTER   256
+#define COLD_FLUSH_STACK_BYTES 256
+
+typedef struct {
+    unsigned int flags;
+    size_t sweep_bytes;
+    volatile uint8_t *sweep;    /* sweep_bytes, COLD_SWEEP */
+    volatile uint8_t *pages;    /* COLD_TLB_PAGES pages, COLD_TLB in user space */
+} cold_t;
+
+static inline void cold_clflush_range(const volatile void *p, size_t len)
+{
+    uintptr_t a = (uintptr_t)p & ~(uintptr_t)(COLD_LINE - 1);
+    for (; a < (uintptr_t)p + len; a += COLD_LINE)
+        asm volatile("clflush (%0)" :: "r"(a) : "memory");
+}
+
+/* Always inlined, so "code" is the loop that contains the timed exit */
+static inline __attribute__((always_inline)) void cold_disturb(const cold_t *c)
+{
+    unsigned int f = c->flags;
+
+    if (f & COLD_SWEEP)
+        for (size_t i = 0; i < c->sweep_bytes; i += COLD_LINE)
+            c->sweep[i]++;
+    if (f & COLD_FLUSH_CODE) {
+        const uint8_t *ip;
+        asm volatile("lea 0(%%rip), %0" : "=r"(ip));
+        cold_clflush_range(ip - COLD_FLUSH_BEFORE, COLD_FLUSH_BEFORE + COLD_FLUSH_AFTER);
+    }
+    if (f & COLD_FLUSH_STACK) {
+        const uint8_t *sp;
+        asm volatile("mov %%rsp, %0" : "=r"(sp));
+        cold_clflush_range(sp, COLD_FLUSH_STACK_BYTES);
+    }
+#ifdef __KERNEL__
+    if (f & COLD_WBINVD)
+        wbinvd();
+    if (f & COLD_TLB) {
+        preempt_disable();
+        __flush_tlb_all();
+        preempt_enable();
+    }
+#else
+    if (f & COLD_TLB)
+        for (size_t i = 0; i < COLD_TLB_PAGES; i++)
+            c->pages[i * 4096]++;
+#endif
+    // CLFLUSH is only ordered by fences; finish it before t0 is taken
+    asm volatile("mfence" ::: "memory");
+}
+
+#ifndef __KERNEL__
+
+/* Parse "sweep[=size],code,stack,tlb" (size in bytes, K or M suffix)
+ * Returns 0, or -1 on an unknown item or an empty list.
+ */
+static inline int cold_parse(const char *spec, unsigned int *flags, size_t *sweep_bytes)
+{
+    *flags = 0;
+    *sweep_bytes = COLD_DEFAULT_SWEEP;
+    while (*spec) {
+        size_t len = strcspn(spec, ",");
+        if (strncmp(spec, "sweep", 5) == 0 && (len == 5 || spec[5] == '=')) {
+            *flags |= COLD_SWEEP;
+            if (len > 5) {
+                char *end;
+                unsigned long v = strtoul(spec + 6, &end, 10);
+                if (*end == 'K' || *end == 'k') v <<= 10, end++;
+                else if (*end == 'M' || *end == 'm') v <<= 20, end++;
+                if (end != spec + len || v == 0 || v > COLD_MAX_SWEEP) {
+                    fprintf(stderr, "Bad sweep size '%.*s'\n", (int)len, spec);
+                    return -1;
+                }
+                *sweep_bytes = v;
+            }
+        } else if (len == 4 && strncmp(spec, "code", 4) == 0) {
+            *flags |= COLD_FLUSH_CODE;
+        } else if (len == 5 && strncmp(spec, "stack", 5) == 0) {
+            *flags |= COLD_FLUSH_STACK;
+        } else if (len == 6 && strncmp(spec, "wbinvd", 6) == 0) {
+            *flags |= COLD_WBINVD;
+        } else if (len == 3 && strncmp(spec, "tlb", 3) == 0) {
+            *flags |= COLD_TLB;
+        } else {
+            fprintf(stderr, "Unknown cold option '%.*s'\n", (int)len, spec);
+            return -1;
+        }
+        spec += len;
+        if (*spec == ',') spec++;
+    }
+    return *flags ? 0 : -1;
+}
+
+/* Allocate the user-space buffers (WBINVD needs CPL 0) */
+static inline int cold_init(cold_t *c, unsigned int flags, size_t sweep_bytes)
+{
+    memset(c, 0, sizeof(*c));
+    if (flags & COLD_WBINVD) {
+        fprintf(stderr, "wbinvd needs CPL 0, use kernel-space-microbench\n");
+        return -1;
+    }
+    c->flags = flags;
+    c->sweep_bytes = sweep_bytes;
+    if (flags & COLD_SWEEP) {
+        c->sweep = mmap(NULL, sweep_bytes, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+        if (c->sweep == MAP_FAILED) return -1;
+    }
+    if (flags & COLD_TLB) {
+        size_t len = (size_t)COLD_TLB_PAGES * 4096;
+        c->pages = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (c->pages == MAP_FAILED) return -1;
+        // Huge pages would cover the whole range with a few TLB entries
+        madvise((void *)c->pages, len, MADV_NOHUGEPAGE);
+        memset((void *)c->pages, 0, len);
+    }
+    return 0;
+}
+
+static inline void cold_describe(unsigned int flags, size_t sweep_bytes, char *buf, size_t len)
+{
+    snprintf(buf, len, "%s%s%s%s%s",
+             flags & COLD_SWEEP ? "sweep " : "",
+             flags & COLD_FLUSH_CODE ? "clflush-code " : "",
+             flags & COLD_FLUSH_STACK ? "clflush-stack " : "",
+             flags & COLD_WBINVD ? "wbinvd " : "",
+             flags & COLD_TLB ? "tlb " : "");
+    size_t n = strlen(buf);
+    if (flags & COLD_SWEEP)
+        snprintf(buf + n, len - n, "(sweep %zu KB)", sweep_bytes >> 10);
+    else if (n > 0)
+        buf[n - 1] = '\0';
+}
+
+/* Warm and cold distributions of the same entry side by side */
+static inline void cold_print_compare(stats_t *warm, stats_t *cold, const char *label,
+                                      const char *how)
+{
+    static const double pcts[] = { 1.0, 50.0, 90.0, 99.0, 99.9 };
+    static const char *names[] = { "1st", "Median", "90th", "99th", "99.9th" };
+    double w[5], c[5];
+
+    if (warm->count == 0 || cold->count == 0) return;
+    stats_percentiles(warm, pcts, w, 5);
+    stats_percentiles(cold, pcts, c, 5);
+
+    printf("=== Warm vs cold: %s ===\n", label);
+    printf("Cold: %s\n", how);
+    printf("%-8s %12s %12s %12s %7s%s\n", "", "warm", "cold", "cold-warm", "ratio",
+           stats_tsc_hz > 0.0 ? "   cold-warm ns" : "");
+    for (int i = 0; i < 5; i++) {
+        printf("%-8s %12.1f %12.1f %12.1f %6.2fx", names[i], w[i], c[i], c[i] - w[i],
+               w[i] > 0.0 ? c[i] / w[i] : 0.0);
+        if (stats_tsc_hz > 0.0) printf(" %15.1f", stats_cycles_to_ns(c[i] - w[i]));
+        printf("\n");
+    }
+    printf("%-8s %12.1f %12.1f %12.1f %6.2fx", "Mean", stats_mean(warm), stats_mean(cold),
+           stats_mean(cold) - stats_mean(warm), stats_mean(cold) / stats_mean(warm));
+    if (stats_tsc_hz > 0.0)
+        printf(" %15.1f", stats_cycles_to_ns(stats_mean(cold) - stats_mean(warm)));
+    printf("\n====================================\n\n");
+}
+
+#endif /* !__KERNEL__ */
+
+#endif /* COLD_H */
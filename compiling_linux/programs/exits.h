@@ -0,0 +1,281 @@
+#ifndef EXITS_H
+#define EXITS_H
+
+/* Catalog of exit-causing operations, shared by the user-space harnesses
+ * and the kernel modules.
+ *
+ * EXIT_CATALOG is an X-macro; every consumer expands it into its own
+ * specialised loops (see EXIT_TIMED_LOOP), so each operation is inlined
+ * into its own timed loop and nothing is dispatched per sample.
+ *
+ *   X(name, label, path, priv, flags, setup, body)
+ *     name   identifier; EXIT_<name> is the catalog id
+ *     label  short label; reports print "<label>(<context>, <path>)"
+ *     path   where the exit is expected to be handled: "fast" (KVM,
+ *            in kernel), "medium" (KVM hypercall handling), "slow" (VMM
+ *            in user space), "idle" (halts until the next interrupt)
+ *     priv   lowest privilege the operation can run at
+ *     flags  EXIT_F_* requirements of the body
+ *     setup  expression evaluated once per loop, outside the timed region;
+ *            the body sees its value as `arg`
+ *     body   the operation itself
+ *
+ * Adding an entry here makes it available everywhere; kernel-only
+ * entries are rejected by the user-space harness.
+ */
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/ioctl.h>
+#else
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <linux/ioctl.h>
+#endif
+#include "timing.h"
+
+/* Privilege needed by an entry */
+#define EXIT_USER    0  /* any ring */
+#define EXIT_IOPORT  1  /* user space after ioperm(), or kernel */
+#define EXIT_KERNEL  2  /* CPL 0 only */
+
+/* Body requirements */
+#define EXIT_F_IRQS_OFF 0x1 /* only valid with interrupts disabled */
+#define EXIT_F_IRQS_ON  0x2 /* needs an interrupt to complete (HLT) */
+
+/* KVM hypercall numbers (include/uapi/linux/kvm_para.h) */
+#define HYPERCALL_VAPIC_POLL_IRQ  1
+#define HYPERCALL_SCHED_YIELD     11
+
+static inline void exit_cpuid(uint32_t leaf, uint32_t subleaf) {
+    uint32_t a = leaf, b, c = subleaf, d;
+    asm volatile("cpuid" : "+a"(a), "=b"(b), "+c"(c), "=d"(d));
+}
+
+static inline uint64_t exit_rdmsr(uint32_t msr) {
+    uint32_t a, d;
+    asm volatile("rdmsr" : "=a"(a), "=d"(d) : "c"(msr));
+    return ((uint64_t)d<<32) | a;
+}
+
+static inline void exit_wrmsr(uint32_t msr, uint64_t v) {
+    asm volatile("wrmsr" :: "c"(msr), "a"((uint32_t)v), "d"((uint32_t)(v >> 32)) : "memory");
+}
+
+static inline void exit_outb(uint16_t port, uint8_t v) {
+    asm volatile("outb %b0, %w1" :: "a"(v), "Nd"(port) : "memory");
+}
+
+static inline uint8_t exit_inb(uint16_t port) {
+    uint8_t v;
+    asm volatile("inb %w1, %b0" : "=a"(v) : "Nd"(port) : "memory");
+    return v;
+}
+
+/* KVM ABI: nr in RAX, arguments in RBX, RCX, RDX, RSI; result in RAX */
+static inline long exit_hypercall(unsigned long nr, unsigned long a0, unsigned long a1) {
+    asm volatile("vmcall" : "+a"(nr) : "b"(a0), "c"(a1) : "memory");
+    return (long)nr;
+}
+
+static inline uint64_t exit_xgetbv(uint32_t index) {
+    uint32_t a, d;
+    asm volatile("xgetbv" : "=a"(a), "=d"(d) : "c"(index));
+    return ((uint64_t)d<<32) | a;
+}
+
+static inline void exit_xsetbv(uint32_t index, uint64_t v) {
+    asm volatile("xsetbv" :: "c"(index), "a"((uint32_t)v), "d"((uint32_t)(v >> 32)) : "memory");
+}
+
+static inline void exit_hlt(void) {
+    asm volatile("hlt" ::: "memory");
+}
+
+/* Writes restore the value read in setup, so they change no state:
+ * TSC_DEADLINE keeps the pending timer armed (hence IRQs off, so the tick
+ * cannot re-arm it mid-loop) and XCR0 keeps the enabled feature set.
+ */
+#define EXIT_CATALOG(X)                                                                 \
+    X(NOP,               "Empty",                 "none",   EXIT_USER,   0,              \
+      0, (void)0)                                                                       \
+    X(CPUID_0,           "CPUID",                 "fast",   EXIT_USER,   0,              \
+      0, exit_cpuid(0x0, 0))                                                            \
+    X(CPUID_1,           "CPUID 0x1",             "fast",   EXIT_USER,   0,              \
+      0, exit_cpuid(0x1, 0))                                                            \
+    X(CPUID_7,           "CPUID 0x7",             "fast",   EXIT_USER,   0,              \
+      0, exit_cpuid(0x7, 0))                                                            \
+    X(CPUID_KVM,         "CPUID 0x40000000",      "fast",   EXIT_USER,   0,              \
+      0, exit_cpuid(0x40000000, 0))                                                     \
+    X(RDMSR_APIC_BASE,   "RDMSR 0x1B",            "fast",   EXIT_KERNEL, 0,              \
+      0, exit_rdmsr(0x1b))                                                              \
+    X(RDMSR_MISC_ENABLE, "RDMSR 0x1A0",           "fast",   EXIT_KERNEL, 0,              \
+      0, exit_rdmsr(0x1a0))                                                             \
+    X(WRMSR_TSC_DEADLINE,"WRMSR 0x6E0",           "fast",   EXIT_KERNEL, EXIT_F_IRQS_OFF, \
+      exit_rdmsr(0x6e0), exit_wrmsr(0x6e0, arg))                                        \
+    X(XSETBV,            "XSETBV",                "fast",   EXIT_KERNEL, 0,              \
+      exit_xgetbv(0), exit_xsetbv(0, arg))                                              \
+    X(HC_INVALID,        "VMCALL",                "medium", EXIT_KERNEL, 0,              \
+      0, exit_hypercall(~0UL, 0, 0))                                                    \
+    X(HC_VAPIC_POLL_IRQ, "VMCALL VAPIC_POLL_IRQ", "medium", EXIT_KERNEL, 0,              \
+      0, exit_hypercall(HYPERCALL_VAPIC_POLL_IRQ, 0, 0))                                  \
+    X(HC_SCHED_YIELD,    "VMCALL SCHED_YIELD",    "medium", EXIT_KERNEL, 0,              \
+      0, exit_hypercall(HYPERCALL_SCHED_YIELD, 0xffffffff, 0))                            \
+    X(OUT_E9,            "OUT 0xE9",              "slow",   EXIT_IOPORT, 0,              \
+      0, exit_outb(0xe9, 'T'))                                                          \
+    X(IN_E9,             "IN 0xE9",               "slow",   EXIT_IOPORT, 0,              \
+      0, exit_inb(0xe9))                                                                \
+    X(OUT_80,            "OUT 0x80",              "slow",   EXIT_IOPORT, 0,              \
+      0, exit_outb(0x80, 0))                                                            \
+    X(HLT,               "HLT",                   "idle",   EXIT_KERNEL, EXIT_F_IRQS_ON,  \
+      0, exit_hlt())
+
+enum exit_id {
+#define EXIT_ENUM(name, ...) EXIT_##name,
+    EXIT_CATALOG(EXIT_ENUM)
+#undef EXIT_ENUM
+    EXIT_COUNT
+};
+
+/* Highest port an EXIT_IOPORT entry uses, for ioperm() */
+#define EXIT_IOPORT_MAX 0xe9
+
+/* Runs n samples of one catalog entry with the ioctl modules: the
+ * module executes the operation, arg is the sample count where the
+ * module loops itself. The legacy numbers 1-4 stay as they are.
+ */
+#define EXIT_IOCTL_BASE 0x40
+#define EXIT_IOCTL(id)  _IOW('v', EXIT_IOCTL_BASE + (id), unsigned long)
+#define EXIT_IOCTL_ID(cmd) ((int)_IOC_NR(cmd) - EXIT_IOCTL_BASE)
+
+typedef struct {
+    const char *name;
+    const char *label;
+    const char *path;
+    int priv;
+    int flags;
+} exit_desc_t;
+
+static const exit_desc_t exit_catalog[EXIT_COUNT] = {
+#define EXIT_DESC(name, label, path, priv, flags, setup, body) \
+    { #name, label, path, priv, flags },
+    EXIT_CATALOG(EXIT_DESC)
+#undef EXIT_DESC
+};
+
+/* Map an ioctl command to a catalog id, -1 if it is not EXIT_IOCTL(id) */
+static inline int exit_ioctl_id(unsigned int cmd) {
+    int id = EXIT_IOCTL_ID(cmd);
+    return (id >= 0 && id < EXIT_COUNT && cmd == EXIT_IOCTL(id)) ? id : -1;
+}
+
+/* Timed loop over one entry: n samples, record(delta) for each.
+ * setup runs once before the loop; the loop variables are local so the
+ * macro can be used inside any consumer's generated function.
+ */
+#define EXIT_TIMED_LOOP(n, setup, body, record) \
+    EXIT_COLD_LOOP(n, setup, body, record, (void)0)
+
+/* The same with disturb (e.g. cold_disturb, cold.h) run before every
+ * sample, outside the timed region.
+ */
+#define EXIT_COLD_LOOP(n, setup, body, record, disturb) do {        \
+        uint64_t arg = (setup);                                     \
+        (void)arg;                                                  \
+        for (size_t i_ = 0; i_ < (size_t)(n); i_++) {               \
+            disturb;                                                \
+            uint64_t t0_ = rdtsc_serialized_start();                \
+            body;                                                   \
+            uint64_t t1_ = rdtsc_serialized_end();                  \
+            record(t1_ - t0_);                                      \
+        }                                                           \
+    } while (0)
+
+/* The same with the start TSC of each sample: record(start, delta), for
+ * the timeline (timeline.h)
+ */
+#define EXIT_STAMPED_LOOP(n, setup, body, record) do {              \
+        uint64_t arg = (setup);                                     \
+        (void)arg;                                                  \
+        for (size_t i_ = 0; i_ < (size_t)(n); i_++) {               \
+            uint64_t t0_ = rdtsc_serialized_start();                \
+            body;                                                   \
+            uint64_t t1_ = rdtsc_serialized_end();                  \
+            record(t0_, t1_ - t0_);                                 \
+        }                                                           \
+    } while (0)
+
+/* Open-loop (paced) loop over one entry (load.h): sample i is due at
+ * due + i * interval cycles. The loop spins until the due time and
+ * records the time from the due time, not from the actual start, to the
+ * end of the operation: when exits overrun their slots the following ones
+ * start late and the queueing delay is counted, instead of being hidden
+ * by issuing fewer exits (coordinated omission). due is an lvalue holding
+ * the first due time, advanced past the last sample on return, so a run
+ * can be split into several calls.
+ */
+#define EXIT_PACED_LOOP(n, setup, body, record, interval, due) do { \
+        uint64_t arg = (setup);                                     \
+        (void)arg;                                                  \
+        for (size_t i_ = 0; i_ < (size_t)(n); i_++) {               \
+            while (timing_tsc_start() < (due))                      \
+                asm volatile("pause");                              \
+            body;                                                   \
+            uint64_t t1_ = timing_tsc_end();                        \
+            record(t1_ - (due));                                    \
+            (due) += (interval);                                    \
+        }                                                           \
+    } while (0)
+
+/* Back to back without per-sample timing, for the maximum exit rate */
+#define EXIT_RATE_LOOP(n, setup, body) do {                         \
+        uint64_t arg = (setup);                                     \
+        (void)arg;                                                  \
+        for (size_t i_ = 0; i_ < (size_t)(n); i_++) {               \
+            body;                                                   \
+        }                                                           \
+    } while (0)
+
+#ifndef __KERNEL__
+
+static inline const char *exit_priv_name(int priv) {
+    return priv == EXIT_USER ? "user" : priv == EXIT_IOPORT ? "ioport" : "kernel";
+}
+
+static inline void exit_print_catalog(void) {
+    printf("%-20s %-22s %-7s %s\n", "name", "label", "path", "privilege");
+    for (int i = 0; i < EXIT_COUNT; i++) {
+        const exit_desc_t *e = &exit_catalog[i];
+        printf("%-20s %-22s %-7s %s%s%s\n", e->name, e->label, e->path, exit_priv_name(e->priv),
+               e->flags & EXIT_F_IRQS_OFF ? ", irqs off" : "",
+               e->flags & EXIT_F_IRQS_ON ? ", irqs on" : "");
+    }
+}
+
+/* Parse a comma separated list of entry names (case-insensitive)
+ * Returns the number of ids stored, -1 on an unknown name.
+ */
+static inline int exit_parse_list(const char *spec, int *ids, int max) {
+    int n = 0;
+    while (*spec && n < max) {
+        size_t len = strcspn(spec, ",");
+        int found = -1;
+        for (int i = 0; i < EXIT_COUNT && found < 0; i++)
+            if (strlen(exit_catalog[i].name) == len && strncasecmp(spec, exit_catalog[i].name, len) == 0)
+                found = i;
+        if (found < 0) {
+            fprintf(stderr, "Unknown exit '%.*s' (see -l)\n", (int)len, spec);
+            return -1;
+        }
+        ids[n++] = found;
+        spec += len;
+        if (*spec == ',') spec++;
+    }
+    return n;
+}
+
+#endif /* !__KERNEL__ */
+
+#endif /* EXITS_H */
@@ -0,0 +1,249 @@
+#ifndef HIST_H
+#define HIST_H
+
+/* Log-linear (HDR-style) latency histogram.
+ *
+ * Values below 2^(p+1) get a bucket each. Above that, every power-of-two
+ * range is split into 2^p equal sub-buckets, so any recorded value is
+ * known to within a relative error of 2^-p. Memory is fixed at
+ * HIST_BUCKETS(p) counters no matter how many samples are recorded, and
+ * histograms with the same precision merge by adding counters.
+ *
+ * Recording is integer-only so the header can be used from kernel
+ * modules as well; the floating point accessors are user-space only.
+ */
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <math.h>
+#include "report.h"
+#endif
+
+/* Number of counters needed for precision p (covers the full 64-bit range) */
+#define HIST_BUCKETS(p) ((size_t)(65 - (p)) << (p))
+
+/* 2^-7 < 0.8% relative error, 7424 buckets (58 KB) */
+#define HIST_DEFAULT_PRECISION 7
+#define HIST_MAX_PRECISION     20
+
+/* Histogram data structure */
+typedef struct {
+    uint64_t *counts;   /* Pointer to user-provided bucket array */
+    size_t nbuckets;
+    unsigned int precision;
+    uint64_t count;
+    uint64_t min;
+    uint64_t max;
+    uint64_t sum;       /* Enough for ~10^13 samples of 10^6 cycles */
+} hist_t;
+
+/* Bucket index of a value. No branches: OR-ing in 2^p clamps the
+ * exponent of small values so they land in the linear region.
+ */
+static inline size_t hist_index(unsigned int precision, uint64_t value)
+{
+    unsigned int msb = 63 - __builtin_clzll(value | (1ULL << precision));
+    unsigned int shift = msb - precision;
+    return ((size_t)shift << precision) + (size_t)(value >> shift);
+}
+
+/* Smallest value that maps to bucket idx */
+static inline uint64_t hist_bucket_low(unsigned int precision, size_t idx)
+{
+    unsigned int shift = idx >> precision;
+    if (shift > 0) shift--;
+    return (uint64_t)(idx - ((size_t)shift << precision)) << shift;
+}
+
+/* Number of distinct values that map to bucket idx */
+static inline uint64_t hist_bucket_width(unsigned int precision, size_t idx)
+{
+    unsigned int shift = idx >> precision;
+    if (shift > 0) shift--;
+    return 1ULL << shift;
+}
+
+/* Reset all counters, keeping the bucket array */
+static inline void hist_reset(hist_t *hist)
+{
+    for (size_t i = 0; i < hist->nbuckets; i++)
+        hist->counts[i] = 0;
+    hist->count = 0;
+    hist->min = ~0ULL;
+    hist->max = 0;
+    hist->sum = 0;
+}
+
+/* Initialize histogram with user-provided bucket array
+ * counts: Pre-allocated memory for HIST_BUCKETS(precision) counters
+ * nbuckets: Number of counters in the array
+ * precision: Sub-bucket bits; relative error is 2^-precision
+ * Returns -1 if the array is too small or the precision is out of range.
+ */
+static inline int hist_init(hist_t *hist, uint64_t *counts, size_t nbuckets,
+                            unsigned int precision)
+{
+    if (precision < 1 || precision > HIST_MAX_PRECISION ||
+        nbuckets < HIST_BUCKETS(precision)) {
+        return -1;
+    }
+    hist->counts = counts;
+    hist->nbuckets = HIST_BUCKETS(precision);
+    hist->precision = precision;
+    hist_reset(hist);
+    return 0;
+}
+
+/* Record a single measurement/sample */
+static inline void hist_record(hist_t *hist, uint64_t value)
+{
+    hist->counts[hist_index(hist->precision, value)]++;
+    hist->count++;
+    hist->sum += value;
+    hist->min = value < hist->min ? value : hist->min;
+    hist->max = value > hist->max ? value : hist->max;
+}
+
+/* Record multiple measurements at once */
+static inline void hist_record_samples(hist_t *hist, const uint64_t *values, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        hist_record(hist, values[i]);
+}
+
+/* Add the counters of src into dst (e.g. per-thread or per-run histograms)
+ * Returns -1 if the two histograms have different precision.
+ */
+static inline int hist_merge(hist_t *dst, const hist_t *src)
+{
+    if (dst->precision != src->precision) return -1;
+    for (size_t i = 0; i < dst->nbuckets; i++)
+        dst->counts[i] += src->counts[i];
+    dst->count += src->count;
+    dst->sum += src->sum;
+    if (src->min < dst->min) dst->min = src->min;
+    if (src->max > dst->max) dst->max = src->max;
+    return 0;
+}
+
+static inline uint64_t hist_min(const hist_t *hist)
+{
+    return hist->count ? hist->min : 0;
+}
+
+static inline uint64_t hist_max(const hist_t *hist)
+{
+    return hist->max;
+}
+
+/* Representative value of the k-th smallest sample (0-based): the middle
+ * of its bucket, clamped to the exact min/max.
+ */
+static inline uint64_t hist_value_at_rank(const hist_t *hist, uint64_t k)
+{
+    uint64_t seen = 0;
+
+    if (k == 0) return hist_min(hist);
+    if (k + 1 >= hist->count) return hist->max;
+
+    for (size_t i = 0; i < hist->nbuckets; i++) {
+        seen += hist->counts[i];
+        if (seen > k) {
+            uint64_t v = hist_bucket_low(hist->precision, i) +
+                         (hist_bucket_width(hist->precision, i) - 1) / 2;
+            if (v < hist->min) v = hist->min;
+            if (v > hist->max) v = hist->max;
+            return v;
+        }
+    }
+    return hist->max;
+}
+
+#ifndef __KERNEL__
+
+/* Calculate mean (average) */
+static inline double hist_mean(const hist_t *hist)
+{
+    if (hist->count == 0) return 0.0;
+    return (double)hist->sum / hist->count;
+}
+
+/* Calculate variance from bucket midpoints */
+static inline double hist_variance(const hist_t *hist)
+{
+    if (hist->count == 0) return 0.0;
+
+    double mean = hist_mean(hist);
+    double sum_sq_diff = 0.0;
+    for (size_t i = 0; i < hist->nbuckets; i++) {
+        if (hist->counts[i] == 0) continue;
+        double mid = hist_bucket_low(hist->precision, i) +
+                     (hist_bucket_width(hist->precision, i) - 1) / 2.0;
+        double diff = mid - mean;
+        sum_sq_diff += hist->counts[i] * diff * diff;
+    }
+    return sum_sq_diff / hist->count;
+}
+
+/* Calculate standard deviation */
+static inline double hist_stddev(const hist_t *hist)
+{
+    return sqrt(hist_variance(hist));
+}
+
+/* Calculate percentile, interpolated between ranks like stats_percentile
+ * percentile: value between 0 and 100 (e.g., 95 for 95th percentile)
+ */
+static inline double hist_percentile(const hist_t *hist, double percentile)
+{
+    if (hist->count == 0) return 0.0;
+    if (percentile < 0.0) percentile = 0.0;
+    if (percentile > 100.0) percentile = 100.0;
+
+    double rank = (percentile / 100.0) * (hist->count - 1);
+    uint64_t lower_idx = (uint64_t)rank;
+    uint64_t upper_idx = lower_idx + 1;
+
+    double lower = hist_value_at_rank(hist, lower_idx);
+    if (upper_idx >= hist->count) return lower;
+
+    double upper = hist_value_at_rank(hist, upper_idx);
+    return lower + (rank - lower_idx) * (upper - lower);
+}
+
+/* Print detailed statistics with percentiles (same layout as stats_print_detailed) */
+static inline void hist_print_detailed(const hist_t *hist, const char *label)
+{
+    if (hist->count == 0) {
+        printf("%s: No data\n", label);
+        return;
+    }
+
+    printf("\n=== Detailed Statistics: %s ===\n", label);
+    printf("Sample count:   %lu\n", hist->count);
+    stats_print_header();
+    stats_print_cycles("Min:", hist_min(hist));
+    stats_print_cycles("Max:", hist_max(hist));
+    stats_print_value("Mean:", hist_mean(hist));
+    stats_print_value("Median (50%):", hist_percentile(hist, 50.0));
+    stats_print_value("Std Dev:", hist_stddev(hist));
+    printf("Variance:       %.2f\n", hist_variance(hist));
+    printf("\nPercentiles:\n");
+    stats_print_value("  1st:", hist_percentile(hist, 1.0));
+    stats_print_value("  5th:", hist_percentile(hist, 5.0));
+    stats_print_value("  25th:", hist_percentile(hist, 25.0));
+    stats_print_value("  50th:", hist_percentile(hist, 50.0));
+    stats_print_value("  75th:", hist_percentile(hist, 75.0));
+    stats_print_value("  95th:", hist_percentile(hist, 95.0));
+    stats_print_value("  99th:", hist_percentile(hist, 99.0));
+    printf("  (histogram, relative error <= %.3f%%)\n", 100.0 / (1u << hist->precision));
+    printf("====================================\n\n");
+}
+
+#endif /* !__KERNEL__ */
+
+#endif /* HIST_H */
@@ -0,0 +1,46 @@
+#!/bin/bash
+# Runs the host tools on the fixtures in this directory and compares their
+# reports with the expected ones (make check builds the tools first).
+#
+# kvm-trace/: a capture directory as written by kvm-trace.sh. The header
+# page and the event formats were recorded on a 6.18 host. The ring-buffer
+# pages (cpu0.raw, cpu1.raw) hold a known event sequence, listed in
+# kvm-trace/README, so the expected latencies can be checked by hand.
+#
+# kvm-exit-stats/: /sys/kernel/debug/kvm counter directories, before and
+# after a 200000-iteration CPUID_0 series (fast) and OUT_E9 series (slow).
+# The counter names are those of a 6.18 host; the values were set by hand,
+# since the host does not allow reading them. The OUT_E9 counters checked
+# as a fast path must warn (exit status 1).
+set -uo pipefail
+
+cd "$(dirname "$0")/../.."
+FAILED=0
+
+# expect <expected output file> <expected exit status> <command...>
+expect() {
+    local want="$1" status="$2"
+    shift 2
+    "$@" 2>/dev/null | diff -u "$want" -
+    local rc=${PIPESTATUS[0]} differs=${PIPESTATUS[1]}
+    if [ "$rc" -ne "$status" ]; then
+        echo "FAIL: $* exited with $rc, expected $status"
+        FAILED=1
+    elif [ "$differs" -ne 0 ]; then
+        echo "FAIL: $* differs from $want"
+        FAILED=1
+    else
+        echo "ok: $*"
+    fi
+}
+
+expect host/fixtures/kvm-trace/expected.txt 0 host/kvm-trace host/fixtures/kvm-trace
+expect host/fixtures/kvm-trace/expected-pid1001.txt 0 host/kvm-trace -p 1001 host/fixtures/kvm-trace
+
+E=host/fixtures/kvm-exit-stats
+expect $E/fast.expected 0 host/kvm-exit-stats -c $E/fast-before $E/fast-after -n 200000 -p fast -l CPUID_0
+expect $E/slow.expected 0 host/kvm-exit-stats -c $E/slow-before $E/slow-after -n 200000 -p slow -l OUT_E9
+expect $E/slow-as-fast.expected 1 host/kvm-exit-stats -c $E/slow-before $E/slow-after -n 200000 \
+    -p fast -l "OUT_E9 as fast"
+
+exit $FAILED
@@ -0,0 +1,229 @@
+// Host-side exit path check from KVM's own counters, without tracing.
+// Snapshots the counters in /sys/kernel/debug/kvm (one file per counter:
+// the totals over all VMs at the top, per VM in <pid>-<fd>/) before and
+// after each series and reports the deltas per iteration:
+//
+//   - exits per iteration: every catalog entry except "none" should exit
+//     at least once per iteration
+//   - exits to user space (io_exits + mmio_exits + signal_exits +
+//     request_irq_exits): a "fast" or "medium" series, handled inside KVM,
+//     should have next to none, a "slow" series one per iteration
+//
+// The series come from the guest console: run the guest with
+// KVM_MB_MARKERS=1 and pipe its console through this tool, which copies
+// it to stdout and snapshots on every marker line (marker.h).
+// -c compares two saved counter directories instead, e.g. fixtures.
+// The counters are read from debugfs rather than KVM_GET_STATS_FD, since
+// the VM file descriptor belongs to QEMU.
+// Exits 1 if any series took an unexpected path, 2 on errors, 0 otherwise.
+//
+// Usage: kvm-exit-stats [-d dir] [-v vm] [-t ratio] [-q]
+//        kvm-exit-stats -c before-dir after-dir -n iterations [-p path] [-l label] [-t ratio]
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define MAX_COUNTERS  256
+#define NAME_MAX_LEN  64
+#define MARKER        "@@kvm-mb "      // marker.h
+#define DEFAULT_DIR   "/sys/kernel/debug/kvm"
+
+typedef struct {
+    char name[MAX_COUNTERS][NAME_MAX_LEN];
+    uint64_t v[MAX_COUNTERS];
+    int n;
+} snap_t;
+
+// Counters printed for every series, when the kernel has them; names
+// containing "fastpath" are printed as well
+static const char *const shown[] = {
+    "exits", "io_exits", "mmio_exits", "hypercalls", "halt_exits", "irq_exits",
+    "irq_window_exits", "signal_exits", "request_irq_exits", "insn_emulation",
+};
+
+// Exits that return from KVM_RUN to the VMM
+static const char *const user_exits[] = {
+    "io_exits", "mmio_exits", "signal_exits", "request_irq_exits",
+};
+
+static double max_user = 0.01;      // user-space exits per iteration allowed in-kernel
+
+// Read every numeric file of dir; subdirectories (per VM) are skipped
+static int snapshot(const char *dir, snap_t *s) {
+    DIR *d = opendir(dir);
+    struct dirent *de;
+
+    if (!d) { perror(dir); return -1; }
+    s->n = 0;
+    while ((de = readdir(d)) && s->n < MAX_COUNTERS) {
+        char path[4096], buf[64], *end;
+        struct stat st;
+        if (de->d_name[0] == '.' || strlen(de->d_name) >= NAME_MAX_LEN) continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        if (stat(path, &st) < 0 || !S_ISREG(st.st_mode)) continue;
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) continue;
+        ssize_t len = read(fd, buf, sizeof(buf) - 1);
+        close(fd);
+        if (len <= 0) continue;
+        buf[len] = '\0';
+        uint64_t v = strtoull(buf, &end, 10);
+        if (end == buf || (*end && *end != '\n')) continue;
+        snprintf(s->name[s->n], NAME_MAX_LEN, "%s", de->d_name);
+        s->v[s->n++] = v;
+    }
+    closedir(d);
+    if (s->n == 0) {
+        fprintf(stderr, "%s: no KVM counters (mount debugfs, is kvm loaded?)\n", dir);
+        return -1;
+    }
+    return 0;
+}
+
+// Index of name in s, -1 if the kernel does not have that counter
+static int find(const snap_t *s, const char *name) {
+    for (int i = 0; i < s->n; i++)
+        if (strcmp(s->name[i], name) == 0) return i;
+    return -1;
+}
+
+static int64_t delta(const snap_t *a, const snap_t *b, const char *name) {
+    int i = find(a, name), j = find(b, name);
+    return i < 0 || j < 0 ? 0 : (int64_t)(b->v[j] - a->v[i]);
+}
+
+static void print_counter(const snap_t *a, const snap_t *b, const char *name, uint64_t iters) {
+    int64_t d = delta(a, b, name);
+    printf("%-20s %14ld %14.4f\n", name, d, (double)d / iters);
+}
+
+// Returns 1 if the series took an unexpected path, 0 if not
+static int report(const snap_t *a, const snap_t *b, const char *label, const char *path,
+                  uint64_t iters) {
+    int64_t exits = delta(a, b, "exits"), user = 0;
+    int warn = 0;
+
+    if (iters == 0) iters = 1;
+    for (size_t i = 0; i < sizeof(user_exits) / sizeof(user_exits[0]); i++)
+        user += delta(a, b, user_exits[i]);
+    double exits_per = (double)exits / iters, user_per = (double)user / iters;
+
+    printf("=== KVM exits: %s (path %s) ===\n", label, path);
+    printf("Iterations:  %lu\n", iters);
+    printf("%-20s %14s %14s\n", "counter", "delta", "per iteration");
+    for (size_t i = 0; i < sizeof(shown) / sizeof(shown[0]); i++)
+        if (find(b, shown[i]) >= 0) print_counter(a, b, shown[i], iters);
+    for (int i = 0; i < b->n; i++)
+        if (strstr(b->name[i], "fastpath")) print_counter(a, b, b->name[i], iters);
+    printf("Exits to user space: %ld (%.4f per iteration, %.2f%% of exits)\n", user, user_per,
+           exits ? 100.0 * user / exits : 0.0);
+
+    if (strcmp(path, "none") != 0 && exits_per < 0.5) {
+        printf("WARNING: %.3f exits per iteration, the series did not exit as expected\n", exits_per);
+        warn = 1;
+    }
+    if ((strcmp(path, "fast") == 0 || strcmp(path, "medium") == 0) && user_per > max_user) {
+        printf("WARNING: \"%s\" series went to user space %.4f times per iteration "
+               "(threshold %g)\n", path, user_per, max_user);
+        warn = 1;
+    }
+    if (strcmp(path, "slow") == 0 && user_per < 0.5) {
+        printf("WARNING: \"slow\" series went to user space only %.4f times per iteration\n",
+               user_per);
+        warn = 1;
+    }
+    if (!warn) printf("Path: as expected\n");
+    printf("====================================\n\n");
+    return warn;
+}
+
+// Copy the console to stdout; snapshot and report around marked series
+static int filter(const char *dir, int quiet) {
+    static snap_t before, after;
+    char *line = NULL, name[64] = "", path[16] = "", label[256] = "";
+    size_t cap = 0;
+    ssize_t len;
+    int open_series = 0, series = 0, warnings = 0, errors = 0;
+
+    while ((len = getline(&line, &cap, stdin)) > 0) {
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) line[--len] = '\0';
+        char *m = strstr(line, MARKER);
+        if (!m) {
+            if (!quiet) puts(line);
+            fflush(stdout);
+            continue;
+        }
+        m += strlen(MARKER);
+        int off = 0;
+        unsigned long iters;
+        if (sscanf(m, "begin %63s %15s %n", name, path, &off) == 2 && off > 0) {
+            snprintf(label, sizeof(label), "%s", m + off);
+            open_series = snapshot(dir, &before) == 0;
+            if (!open_series) errors++;
+        } else if (sscanf(m, "end %63s %lu", name, &iters) == 2 && open_series) {
+            open_series = 0;
+            if (snapshot(dir, &after) < 0) { errors++; continue; }
+            warnings += report(&before, &after, label, path, iters);
+            series++;
+            fflush(stdout);
+        }
+    }
+    free(line);
+    printf("%d series checked, %d with an unexpected path\n", series, warnings);
+    return errors ? 2 : warnings ? 1 : 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-d dir] [-v vm] [-t ratio] [-q]   (guest console on stdin)\n", prog);
+    fprintf(stderr, "       %s -c before-dir after-dir -n iterations [-p path] [-l label] [-t ratio]\n", prog);
+    fprintf(stderr, "  -d  KVM counter directory (default: " DEFAULT_DIR ")\n");
+    fprintf(stderr, "  -v  one VM only: its <pid>-<fd> subdirectory (default: totals of all VMs)\n");
+    fprintf(stderr, "  -t  user-space exits per iteration tolerated for fast/medium paths (default: 0.01)\n");
+    fprintf(stderr, "  -q  do not copy the console to stdout, only print the reports\n");
+    fprintf(stderr, "  -c  compare two saved counter directories (e.g. fixtures) as one series\n");
+    fprintf(stderr, "  -n  iterations of that series; -p its expected path (default: fast)\n");
+    fprintf(stderr, "Exit status: 1 if a series took an unexpected path, 2 on errors, 0 otherwise\n");
+}
+
+int main(int argc, char **argv) {
+    const char *dir = DEFAULT_DIR, *vm = NULL, *path = "fast", *label = "series";
+    unsigned long iters = 0;
+    int opt, quiet = 0, compare = 0;
+    char vmdir[4096];
+
+    while ((opt = getopt(argc, argv, "d:v:t:qcn:p:l:")) != -1) {
+        switch (opt) {
+        case 'd': dir = optarg; break;
+        case 'v': vm = optarg; break;
+        case 't': max_user = atof(optarg); break;
+        case 'q': quiet = 1; break;
+        case 'c': compare = 1; break;
+        case 'n': iters = strtoul(optarg, NULL, 10); break;
+        case 'p': path = optarg; break;
+        case 'l': label = optarg; break;
+        default: usage(argv[0]); return 2;
+        }
+    }
+    if (max_user < 0.0 || (compare ? argc - optind != 2 || iters == 0 : optind != argc)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (compare) {
+        static snap_t before, after;
+        if (snapshot(argv[optind], &before) < 0 || snapshot(argv[optind + 1], &after) < 0)
+            return 2;
+        return report(&before, &after, label, path, iters);
+    }
+    if (vm) {
+        snprintf(vmdir, sizeof(vmdir), "%s/%s", dir, vm);
+        dir = vmdir;
+    }
+    return filter(dir, quiet);
+}
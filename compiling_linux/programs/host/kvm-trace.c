@@ -0,0 +1,679 @@
+// Host-side KVM exit latency analyzer for binary ftrace captures.
+// Reads the ring-buffer pages of kvm_exit/kvm_entry/kvm_userspace_exit/
+// kvm_pio directly (a kvm-trace.sh capture directory of trace_pipe_raw
+// dumps, or a trace-cmd trace.dat v6 file), merges the per-CPU streams by
+// timestamp and pairs every exit with the next entry of the same vCPU
+// thread. Latencies go into one log-linear histogram per exit reason, split
+// into exits KVM handled in the kernel (fastpath) and round trips through
+// the VMM in user space, where the time spent in user space is reported
+// separately. The files are mmap'ed and memory use is fixed.
+//
+// Usage: kvm-trace [-p pid] [-n] <capture dir | trace.dat>
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "hist.h"
+
+#define MAX_CPUS      256
+#define MAX_SLOTS     64        // distinct (reason, port) pairs; the rest go to "other"
+#define MAX_THREADS   4096      // vCPU threads tracked at once (power of two)
+#define MAX_NAMES     256       // exit reason names per ISA
+#define PRECISION     5         // 3% relative error, 15 KB per histogram
+
+// Ring buffer event types (kernel/trace/ring_buffer.c)
+#define RB_PADDING      29
+#define RB_TIME_EXTEND  30
+#define RB_TIME_STAMP   31
+#define RB_COMMIT_MASK  ((1ULL << 30) - 1)  // bits 30/31 flag missed events
+#define RB_MISSED       (3ULL << 30)
+#define RB_TS_MSB       (0xfULL << 59)
+
+// trace.dat option holding the trace clock (trace-cmd's tracecmd_option)
+#define TRACECMD_OPTION_TRACECLOCK 4
+
+// kvm_exit isa field
+#define KVM_ISA_VMX 1
+#define KVM_ISA_SVM 2
+
+typedef struct {
+    int offset, size;
+} field_t;
+
+typedef struct {
+    int id;                     // -1 if the event is missing from the capture
+    field_t f[2];
+} event_fmt_t;
+
+// Everything needed from the format files
+typedef struct {
+    field_t commit;             // page header
+    int data_offset, page_size;
+    field_t type, pid;          // common fields
+    event_fmt_t exit;           // exit_reason, isa
+    event_fmt_t entry;
+    event_fmt_t uexit;
+    event_fmt_t pio;            // port
+    const char *clock;
+} formats_t;
+
+typedef struct {
+    uint32_t value;
+    char name[28];
+} reason_name_t;
+
+static reason_name_t names[3][MAX_NAMES];  // indexed by isa
+static int nnames[3];
+
+typedef struct {
+    uint64_t key;               // isa << 60 | reason << 20 | port + 1
+    char name[48];
+    uint64_t exits, unpaired;
+    hist_t kernel;              // exit -> entry, handled in KVM
+    hist_t round;               // exit -> entry through user space
+    hist_t vmm;                 // user-space part of a round trip
+} slot_t;
+
+static slot_t slots[MAX_SLOTS + 1];    // last one is "other"
+static int nslots;
+static uint64_t slot_counts[MAX_SLOTS + 1][3][HIST_BUCKETS(PRECISION)];
+
+typedef struct {
+    int32_t pid;                // 0 = free
+    int32_t in_exit;
+    uint64_t exit_ts;
+    uint64_t uexit_ts;          // 0 if no user-space exit since exit_ts
+    uint64_t key;
+} vcpu_t;
+
+static vcpu_t vcpus[MAX_THREADS];
+static uint64_t vcpu_overflow;
+
+// One CPU's stream of pages
+typedef struct {
+    const uint8_t *data;
+    size_t size, page;
+    const uint8_t *ev, *end;    // current event, end of page data
+    uint64_t ts;                // timestamp of the current event
+    uint64_t missed;            // pages flagged with lost events
+    int done;
+} cursor_t;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static inline uint64_t read_num(const uint8_t *p, int size) {
+    switch (size) {
+    case 1: return *p;
+    case 2: { uint16_t v; memcpy(&v, p, 2); return v; }
+    case 4: { uint32_t v; memcpy(&v, p, 4); return v; }
+    default: { uint64_t v; memcpy(&v, p, 8); return v; }
+    }
+}
+
+// "field:<type> <name>;\toffset:N;\tsize:M;" -> offset and size
+static int parse_field(const char *fmt, const char *name, field_t *f) {
+    size_t len = strlen(name);
+    for (const char *p = fmt; (p = strstr(p, name)) != NULL; p += len) {
+        if ((p[-1] != ' ' && p[-1] != '*') || p[len] != ';') continue;
+        if (sscanf(p + len, "; offset:%d; size:%d;", &f->offset, &f->size) == 2) return 0;
+    }
+    return -1;
+}
+
+static void parse_event(const char *fmt, event_fmt_t *ev, const char *f0, const char *f1) {
+    const char *id = strstr(fmt, "\nID: ");
+    ev->id = -1;
+    if (!id || parse_field(fmt, f0, &ev->f[0]) < 0) return;
+    ev->f[1].size = 0;
+    if (f1 && parse_field(fmt, f1, &ev->f[1]) < 0) ev->f[1].size = 0;
+    ev->id = atoi(id + 5);
+}
+
+// Exit reason names straight from kvm_exit's print fmt: the first
+// __print_symbolic table is VMX, the second SVM
+static void parse_reason_names(const char *fmt) {
+    const char *p = strstr(fmt, "print fmt:");
+    for (int isa = KVM_ISA_VMX; p && isa <= KVM_ISA_SVM; isa++) {
+        p = strstr(p, "__print_symbolic(");
+        if (!p) break;
+        p += 17;
+        while (*p && *p != ')') {
+            const char *open = strchr(p, '{'), *close = strchr(p, ')');
+            if (!open || (close && close < open)) break;
+            char *end;
+            long v = strtol(open + 1, &end, 0);
+            while (*end == ' ') end++;
+            if (*end == '+') v += strtol(end + 1, &end, 0);
+            const char *q1 = strchr(end, '"'), *q2 = q1 ? strchr(q1 + 1, '"') : NULL;
+            if (!q2) break;
+            if (nnames[isa] < MAX_NAMES) {
+                reason_name_t *n = &names[isa][nnames[isa]++];
+                n->value = (uint32_t)v;
+                snprintf(n->name, sizeof(n->name), "%.*s", (int)(q2 - q1 - 1), q1 + 1);
+            }
+            p = strchr(q2, '}');
+            if (!p) break;
+            p++;
+        }
+    }
+}
+
+static int parse_formats(formats_t *fm, const char *header_page, const char *common_fmt) {
+    field_t data;
+    if (parse_field(header_page, "commit", &fm->commit) < 0 ||
+        parse_field(header_page, "data", &data) < 0) {
+        fprintf(stderr, "Unrecognized header_page format\n");
+        return -1;
+    }
+    fm->data_offset = data.offset;
+    fm->page_size = data.offset + data.size;
+    if (parse_field(common_fmt, "common_type", &fm->type) < 0 ||
+        parse_field(common_fmt, "common_pid", &fm->pid) < 0) {
+        fprintf(stderr, "Unrecognized event format\n");
+        return -1;
+    }
+    return 0;
+}
+
+static void parse_kvm_format(formats_t *fm, const char *fmt) {
+    if (strstr(fmt, "name: kvm_exit\n")) {
+        parse_event(fmt, &fm->exit, "exit_reason", "isa");
+        parse_reason_names(fmt);
+    } else if (strstr(fmt, "name: kvm_entry\n")) {
+        parse_event(fmt, &fm->entry, "vcpu_id", NULL);
+    } else if (strstr(fmt, "name: kvm_userspace_exit\n")) {
+        parse_event(fmt, &fm->uexit, "reason", NULL);
+    } else if (strstr(fmt, "name: kvm_pio\n")) {
+        parse_event(fmt, &fm->pio, "port", NULL);
+    }
+}
+
+static const char *reason_name(int isa, uint32_t reason) {
+    if (isa == KVM_ISA_VMX) reason &= 0xffff;
+    for (int i = 0; isa <= KVM_ISA_SVM && i < nnames[isa]; i++)
+        if (names[isa][i].value == reason) return names[isa][i].name;
+    return NULL;
+}
+
+static slot_t *get_slot(uint64_t key) {
+    for (int i = 0; i < nslots; i++)
+        if (slots[i].key == key) return &slots[i];
+    slot_t *s = nslots < MAX_SLOTS ? &slots[nslots++] : &slots[MAX_SLOTS];
+    if (s->name[0]) return s;       // "other", already set up
+
+    int isa = key >> 60;
+    uint32_t reason = (key >> 20) & 0xffffffff;
+    uint32_t port = key & 0xfffff;
+    const char *name = reason_name(isa, reason);
+    s->key = key;
+    if (s == &slots[MAX_SLOTS]) snprintf(s->name, sizeof(s->name), "(other)");
+    else if (name && port) snprintf(s->name, sizeof(s->name), "%s port 0x%x", name, port - 1);
+    else if (name) snprintf(s->name, sizeof(s->name), "%s", name);
+    else snprintf(s->name, sizeof(s->name), "reason %#x", reason);
+    hist_t *h[3] = { &s->kernel, &s->round, &s->vmm };
+    for (int k = 0; k < 3; k++)
+        hist_init(h[k], slot_counts[s - slots][k], HIST_BUCKETS(PRECISION), PRECISION);
+    return s;
+}
+
+static vcpu_t *get_vcpu(int32_t pid) {
+    uint32_t h = (uint32_t)pid * 2654435761u;
+    for (int i = 0; i < MAX_THREADS; i++) {
+        vcpu_t *v = &vcpus[(h + i) & (MAX_THREADS - 1)];
+        if (v->pid == pid) return v;
+        if (v->pid == 0) {
+            v->pid = pid;
+            return v;
+        }
+    }
+    vcpu_overflow++;
+    return NULL;
+}
+
+// Advance to the next data event; returns 0 at the end of the stream
+static int cursor_next(cursor_t *c, const formats_t *fm) {
+    for (;;) {
+        while (c->ev < c->end) {
+            const uint8_t *ev = c->ev;
+            uint32_t hdr = read_num(ev, 4);
+            uint32_t type_len = hdr & 31, delta = hdr >> 5;
+            switch (type_len) {
+            case RB_PADDING:
+                if (delta == 0) {               // rest of the page is empty
+                    c->ev = c->end;
+                    continue;
+                }
+                c->ev += 4 + read_num(ev + 4, 4);
+                continue;
+            case RB_TIME_EXTEND:
+                c->ts += (read_num(ev + 4, 4) << 27) | delta;
+                c->ev += 8;
+                continue;
+            case RB_TIME_STAMP:
+                c->ts = ((read_num(ev + 4, 4) << 27) | delta) | (c->ts & RB_TS_MSB);
+                c->ev += 8;
+                continue;
+            default:                            // data; the caller steps over it
+                c->ts += delta;
+                return 1;
+            }
+        }
+        // Next page
+        if ((c->page + 1) * fm->page_size > c->size) {
+            c->done = 1;
+            return 0;
+        }
+        const uint8_t *page = c->data + c->page * fm->page_size;
+        uint64_t commit = read_num(page + fm->commit.offset, fm->commit.size);
+        size_t len = commit & RB_COMMIT_MASK;
+        if (commit & RB_MISSED) c->missed++;
+        c->page++;
+        if (len > (size_t)(fm->page_size - fm->data_offset)) len = 0;   // corrupt or empty
+        c->ts = read_num(page, 8);
+        c->ev = page + fm->data_offset;
+        c->end = c->ev + len;
+    }
+}
+
+static inline const uint8_t *event_payload(const uint8_t *ev, size_t *len) {
+    uint32_t type_len = read_num(ev, 4) & 31;
+    if (type_len == 0) {
+        *len = read_num(ev + 4, 4) - 4;
+        return ev + 8;
+    }
+    *len = type_len * 4;
+    return ev + 4;
+}
+
+static inline void event_skip(cursor_t *c) {
+    uint32_t type_len = read_num(c->ev, 4) & 31;
+    c->ev += type_len ? 4 + type_len * 4 : 4 + read_num(c->ev + 4, 4);
+}
+
+typedef struct {
+    uint64_t events, exits, paired, missed_pages;
+} counters_t;
+
+static void handle_event(const formats_t *fm, const uint8_t *rec, size_t len, uint64_t ts,
+                         int32_t filter_pid, int split_ports, counters_t *cnt) {
+    if (len < (size_t)(fm->pid.offset + fm->pid.size)) return;
+    int type = read_num(rec + fm->type.offset, fm->type.size);
+    int32_t pid = read_num(rec + fm->pid.offset, fm->pid.size);
+    if (filter_pid && pid != filter_pid) return;
+    cnt->events++;
+
+    if (type == fm->exit.id) {
+        vcpu_t *v = get_vcpu(pid);
+        if (!v) return;
+        uint32_t reason = read_num(rec + fm->exit.f[0].offset, fm->exit.f[0].size);
+        uint64_t isa = fm->exit.f[1].size ? read_num(rec + fm->exit.f[1].offset, fm->exit.f[1].size)
+                                          : KVM_ISA_VMX;
+        if (v->in_exit) get_slot(v->key)->unpaired++;
+        v->in_exit = 1;
+        v->exit_ts = ts;
+        v->uexit_ts = 0;
+        v->key = (isa & 0xf) << 60 | (uint64_t)reason << 20;
+        cnt->exits++;
+    } else if (type == fm->entry.id) {
+        vcpu_t *v = get_vcpu(pid);
+        if (!v || !v->in_exit) return;      // no exit seen yet (start of trace)
+        slot_t *s = get_slot(v->key);
+        s->exits++;
+        if (v->uexit_ts) {
+            hist_record(&s->round, ts - v->exit_ts);
+            hist_record(&s->vmm, ts - v->uexit_ts);
+        } else {
+            hist_record(&s->kernel, ts - v->exit_ts);
+        }
+        v->in_exit = 0;
+        cnt->paired++;
+    } else if (type == fm->uexit.id) {
+        vcpu_t *v = get_vcpu(pid);
+        if (v && v->in_exit && !v->uexit_ts) v->uexit_ts = ts;
+    } else if (type == fm->pio.id && split_ports) {
+        vcpu_t *v = get_vcpu(pid);
+        if (v && v->in_exit && !(v->key & 0xfffff))
+            v->key |= read_num(rec + fm->pio.f[0].offset, fm->pio.f[0].size) + 1;
+    }
+}
+
+// Merge the per-CPU streams in timestamp order; vCPU threads migrate, so
+// an exit and its entry can be on different CPUs
+static void process(const formats_t *fm, cursor_t *cur, int ncpu, int32_t filter_pid,
+                    int split_ports, counters_t *cnt) {
+    int active = 0;
+    for (int i = 0; i < ncpu; i++)
+        active += cursor_next(&cur[i], fm);
+
+    while (active) {
+        cursor_t *c = NULL;
+        for (int i = 0; i < ncpu; i++)
+            if (!cur[i].done && (!c || cur[i].ts < c->ts)) c = &cur[i];
+        size_t len;
+        const uint8_t *rec = event_payload(c->ev, &len);
+        handle_event(fm, rec, len, c->ts, filter_pid, split_ports, cnt);
+        event_skip(c);
+        if (!cursor_next(c, fm)) active--;
+    }
+    for (int i = 0; i < ncpu; i++)
+        cnt->missed_pages += cur[i].missed;
+}
+
+static char *read_text(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) return NULL;
+    char *buf = calloc(1, 1 << 16);
+    if (buf) fread(buf, 1, (1 << 16) - 1, f);
+    fclose(f);
+    return buf;
+}
+
+static const uint8_t *map_file(const char *path, size_t *size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) { perror(path); return NULL; }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) { close(fd); *size = 0; return NULL; }
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) { perror("mmap"); return NULL; }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    *size = st.st_size;
+    return data;
+}
+
+// kvm-trace.sh directory: header_page, <event>.format, cpuN.raw
+static int open_capture_dir(const char *dir, formats_t *fm, cursor_t *cur, int *ncpu, uint64_t *bytes) {
+    static const char *events[] = { "kvm_exit", "kvm_entry", "kvm_userspace_exit", "kvm_pio" };
+    static char clock[32];
+    char path[4096];
+
+    snprintf(path, sizeof(path), "%s/header_page", dir);
+    char *header_page = read_text(path);
+    snprintf(path, sizeof(path), "%s/kvm_exit.format", dir);
+    char *exit_fmt = read_text(path);
+    if (!header_page || !exit_fmt) {
+        fprintf(stderr, "%s: missing header_page or kvm_exit.format\n", dir);
+        return -1;
+    }
+    if (parse_formats(fm, header_page, exit_fmt) < 0) return -1;
+    for (size_t i = 0; i < sizeof(events) / sizeof(events[0]); i++) {
+        snprintf(path, sizeof(path), "%s/%s.format", dir, events[i]);
+        char *fmt = read_text(path);
+        if (fmt) parse_kvm_format(fm, fmt);
+        free(fmt);
+    }
+    free(header_page);
+    free(exit_fmt);
+
+    snprintf(path, sizeof(path), "%s/trace_clock", dir);
+    FILE *f = fopen(path, "r");
+    if (f) {
+        if (fscanf(f, "%31s", clock) == 1) fm->clock = clock;
+        fclose(f);
+    }
+
+    DIR *d = opendir(dir);
+    struct dirent *de;
+    *ncpu = 0;
+    while (d && (de = readdir(d)) != NULL) {
+        int cpu;
+        char tail[8];
+        if (sscanf(de->d_name, "cpu%d.ra%1s", &cpu, tail) != 2 || *ncpu == MAX_CPUS) continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        cursor_t *c = &cur[*ncpu];
+        memset(c, 0, sizeof(*c));
+        c->data = map_file(path, &c->size);
+        if (!c->data) continue;
+        *bytes += c->size;
+        (*ncpu)++;
+    }
+    if (d) closedir(d);
+    return 0;
+}
+
+// trace-cmd trace.dat, file version 6 (flyrecord)
+static int open_trace_dat(const uint8_t *p, size_t size, formats_t *fm, cursor_t *cur, int *ncpu,
+                          uint64_t *bytes) {
+    static char clock[32];
+    const uint8_t *end = p + size, *q = p + 10;
+    char *header_page = NULL, *common_fmt = NULL;
+
+#define NEED(n) do { if ((size_t)(end - q) < (size_t)(n)) goto truncated; } while (0)
+    NEED(16);
+    if (strcmp((const char *)q, "6") != 0) {
+        fprintf(stderr, "trace.dat version %s is not supported, use "
+                "'trace-cmd convert --file-version 6'\n", (const char *)q);
+        return -1;
+    }
+    q += strlen((const char *)q) + 1;
+    if (q[0] != 0) {
+        fprintf(stderr, "Big-endian trace.dat files are not supported\n");
+        return -1;
+    }
+    uint32_t page_size = read_num(q + 2, 4);
+    q += 6;
+
+    NEED(12 + 8);
+    if (memcmp(q, "header_page", 12) != 0) goto truncated;
+    uint64_t len = read_num(q + 12, 8);
+    q += 20;
+    NEED(len);
+    header_page = strndup((const char *)q, len);
+    q += len;
+
+    NEED(13 + 8);
+    if (memcmp(q, "header_event", 13) != 0) goto truncated;
+    q += 21 + read_num(q + 13, 8);
+
+    // ftrace internal formats
+    NEED(4);
+    uint32_t count = read_num(q, 4);
+    q += 4;
+    for (uint32_t i = 0; i < count; i++) {
+        NEED(8);
+        q += 8 + read_num(q, 8);
+    }
+    // Event formats per system
+    NEED(4);
+    uint32_t systems = read_num(q, 4);
+    q += 4;
+    for (uint32_t s = 0; s < systems; s++) {
+        const char *system = (const char *)q;
+        q += strnlen(system, end - q) + 1;
+        NEED(4);
+        count = read_num(q, 4);
+        q += 4;
+        for (uint32_t i = 0; i < count; i++) {
+            NEED(8);
+            len = read_num(q, 8);
+            NEED(8 + len);
+            if (strcmp(system, "kvm") == 0) {
+                char *fmt = strndup((const char *)q + 8, len);
+                parse_kvm_format(fm, fmt);
+                if (!common_fmt && strstr(fmt, "common_pid")) common_fmt = fmt;
+                else free(fmt);
+            }
+            q += 8 + len;
+        }
+    }
+    NEED(4);
+    q += 4 + read_num(q, 4);        // kallsyms
+    NEED(4);
+    q += 4 + read_num(q, 4);        // printk formats
+    NEED(8);
+    q += 8 + read_num(q, 8);        // cmdlines
+    NEED(4);
+    uint32_t cpus = read_num(q, 4);
+    q += 4;
+
+    for (;;) {
+        NEED(10);
+        if (memcmp(q, "options  ", 10) == 0) {
+            q += 10;
+            for (;;) {
+                NEED(2);
+                uint16_t id = read_num(q, 2);
+                q += 2;
+                if (id == 0) break;
+                NEED(4);
+                len = read_num(q, 4);
+                NEED(4 + len);
+                if (id == TRACECMD_OPTION_TRACECLOCK) {
+                    // Contents of the trace_clock file: "local [x86-tsc] ..."
+                    char *text = strndup((const char *)q + 4, len);
+                    if (text && sscanf(strchr(text, '[') ? strchr(text, '[') : "", "[%31[^]]", clock) == 1)
+                        fm->clock = clock;
+                    free(text);
+                }
+                q += 4 + len;
+            }
+        } else if (memcmp(q, "flyrecord", 10) == 0) {
+            q += 10;
+            break;
+        } else {
+            fprintf(stderr, "Only flyrecord trace.dat files are supported\n");
+            goto fail;
+        }
+    }
+    if (!common_fmt || parse_formats(fm, header_page, common_fmt) < 0) goto fail;
+    if ((uint32_t)fm->page_size != page_size) {
+        fprintf(stderr, "Page size mismatch: header %u, header_page %d\n", page_size, fm->page_size);
+        goto fail;
+    }
+
+    NEED(16 * (size_t)cpus);
+    *ncpu = 0;
+    for (uint32_t i = 0; i < cpus && *ncpu < MAX_CPUS; i++) {
+        uint64_t off = read_num(q + 16 * i, 8), sz = read_num(q + 16 * i + 8, 8);
+        if (off > size || sz > size - off || sz == 0) continue;
+        cursor_t *c = &cur[(*ncpu)++];
+        memset(c, 0, sizeof(*c));
+        c->data = p + off;
+        c->size = sz;
+        *bytes += sz;
+    }
+#undef NEED
+    free(header_page);
+    free(common_fmt);
+    return 0;
+
+truncated:
+    fprintf(stderr, "Truncated or corrupt trace.dat\n");
+fail:
+    free(header_page);
+    free(common_fmt);
+    return -1;
+}
+
+static int compare_slots(const void *a, const void *b) {
+    const slot_t *x = a, *y = b;
+    double tx = x->kernel.sum + (double)x->round.sum, ty = y->kernel.sum + (double)y->round.sum;
+    return tx < ty ? 1 : tx > ty ? -1 : 0;
+}
+
+// count, median and p99 of one histogram, or only the median; "-" if empty
+static void print_column(const hist_t *h, int median_only) {
+    if (!median_only) printf(" %9lu", h->count);
+    if (!h->count) printf(median_only ? " %9s" : " %9s %9s", "-", "-");
+    else if (median_only) printf(" %9.0f", hist_percentile(h, 50.0));
+    else printf(" %9.0f %9.0f", hist_percentile(h, 50.0), hist_percentile(h, 99.0));
+}
+
+static void print_report(const char *path, const formats_t *fm, const counters_t *cnt) {
+    double total = 0;
+    for (int i = 0; i <= MAX_SLOTS; i++)
+        total += slots[i].kernel.sum + (double)slots[i].round.sum;
+    qsort(slots, nslots, sizeof(slot_t), compare_slots);
+
+    printf("\n=== KVM exit latency: %s ===\n", path);
+    printf("Events: %lu, exits: %lu, paired with an entry: %lu", cnt->events, cnt->exits, cnt->paired);
+    printf(", latencies in %s ticks\n", fm->clock ? fm->clock : "trace clock");
+    printf("%-32s %9s %6s | %9s %9s %9s | %9s %9s %9s %9s\n", "", "", "",
+           "in KVM", "", "", "via VMM", "", "", "in VMM");
+    printf("%-32s %9s %6s | %9s %9s %9s | %9s %9s %9s %9s\n", "exit reason", "exits", "time%",
+           "count", "median", "p99", "count", "median", "p99", "median");
+    for (int i = 0; i <= MAX_SLOTS; i++) {
+        slot_t *s = &slots[i];
+        if (!s->exits) continue;
+        double t = s->kernel.sum + (double)s->round.sum;
+        printf("%-32.32s %9lu %5.1f%% |", s->name, s->exits, total ? 100.0 * t / total : 0.0);
+        print_column(&s->kernel, 0);
+        printf(" |");
+        print_column(&s->round, 0);
+        print_column(&s->vmm, 1);
+        printf("\n");
+    }
+    uint64_t unpaired = 0;
+    for (int i = 0; i <= MAX_SLOTS; i++) unpaired += slots[i].unpaired;
+    if (unpaired) printf("Exits without a matching entry: %lu\n", unpaired);
+    if (cnt->missed_pages) printf("WARNING: %lu pages report lost events (buffer overrun)\n", cnt->missed_pages);
+    if (vcpu_overflow) printf("WARNING: more than %d vCPU threads, %lu events ignored\n", MAX_THREADS, vcpu_overflow);
+    if (fm->exit.id < 0 || fm->entry.id < 0)
+        printf("WARNING: kvm_exit/kvm_entry missing from the capture, nothing to pair\n");
+    else if (!cnt->exits)
+        printf("No kvm_exit events recorded\n");
+    printf("(percentiles from histograms, relative error <= %.1f%%)\n", 100.0 / (1u << PRECISION));
+    printf("====================================\n\n");
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-p pid] [-n] <capture dir | trace.dat>\n", prog);
+    fprintf(stderr, "  -p  only the vCPU thread with this pid\n");
+    fprintf(stderr, "  -n  do not split I/O exits by port\n");
+}
+
+int main(int argc, char **argv) {
+    static cursor_t cur[MAX_CPUS];
+    formats_t fm = { .exit.id = -1, .entry.id = -1, .uexit.id = -1, .pio.id = -1 };
+    int opt, split_ports = 1, ncpu = 0;
+    int32_t filter_pid = 0;
+
+    while ((opt = getopt(argc, argv, "p:n")) != -1) {
+        switch (opt) {
+        case 'p': filter_pid = atoi(optarg); break;
+        case 'n': split_ports = 0; break;
+        default: usage(argv[0]); return 1;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 1;
+    }
+    const char *path = argv[optind];
+
+    struct stat st;
+    if (stat(path, &st) < 0) { perror(path); return 1; }
+    uint64_t bytes = 0;
+    const uint8_t *dat = NULL;
+    size_t dat_size = 0;
+    if (S_ISDIR(st.st_mode)) {
+        if (open_capture_dir(path, &fm, cur, &ncpu, &bytes) < 0) return 1;
+    } else {
+        dat = map_file(path, &dat_size);
+        if (!dat || dat_size < 10 || memcmp(dat, "\x17\x08\x44tracing", 10) != 0) {
+            fprintf(stderr, "%s: not a capture directory or trace.dat file\n", path);
+            return 1;
+        }
+        if (open_trace_dat(dat, dat_size, &fm, cur, &ncpu, &bytes) < 0) return 1;
+    }
+
+    counters_t cnt = { 0 };
+    double t0 = now_sec();
+    process(&fm, cur, ncpu, filter_pid, split_ports, &cnt);
+    double dt = now_sec() - t0;
+    print_report(path, &fm, &cnt);
+    fprintf(stderr, "Parsed %lu events (%.1f MB, %d CPUs) in %.3f s: %.1f Mevents/s, %.1f MB/s\n",
+            cnt.events, bytes / 1e6, ncpu, dt, cnt.events / dt / 1e6, bytes / dt / 1e6);
+    return 0;
+}
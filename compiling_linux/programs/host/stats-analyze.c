@@ -0,0 +1,134 @@
+// Host-side analyzer for binary sample dumps (stats_dump.h).
+// The dump is mmap'ed and decoded in fixed-size chunks into a running
+// summary and a log-linear histogram, so memory use does not depend on
+// the number of samples. -e decodes each series into RAM instead and
+// prints the exact stats_print_detailed report.
+//
+// Usage: stats-analyze [-e] dump.bin [dump.bin...]
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "stats.h"
+#include "hist.h"
+#include "stats_dump.h"
+
+#define CHUNK 65536
+
+static uint64_t chunk[CHUNK];
+static uint64_t hist_counts[HIST_BUCKETS(HIST_DEFAULT_PRECISION)];
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Same layout as stats_print_detailed: exact summary, histogram percentiles
+static void print_streamed(stats_t *summary, hist_t *hist, const char *label) {
+    if (summary->total == 0) {
+        printf("%s: No data\n", label);
+        return;
+    }
+    printf("\n=== Detailed Statistics: %s ===\n", label);
+    printf("Sample count:   %lu\n", summary->total);
+    stats_print_header();
+    stats_print_cycles("Min:", stats_min(summary));
+    stats_print_cycles("Max:", stats_max(summary));
+    stats_print_value("Mean:", stats_mean(summary));
+    stats_print_value("Median (50%):", hist_percentile(hist, 50.0));
+    stats_print_value("Std Dev:", stats_stddev(summary));
+    printf("Variance:       %.2f\n", stats_variance(summary));
+    printf("\nPercentiles:\n");
+    stats_print_value("  1st:", hist_percentile(hist, 1.0));
+    stats_print_value("  5th:", hist_percentile(hist, 5.0));
+    stats_print_value("  25th:", hist_percentile(hist, 25.0));
+    stats_print_value("  50th:", hist_percentile(hist, 50.0));
+    stats_print_value("  75th:", hist_percentile(hist, 75.0));
+    stats_print_value("  95th:", hist_percentile(hist, 95.0));
+    stats_print_value("  99th:", hist_percentile(hist, 99.0));
+    printf("  (percentiles from histogram, relative error <= %.3f%%, use -e for exact)\n",
+           100.0 / (1u << hist->precision));
+    printf("====================================\n\n");
+}
+
+static int analyze(const char *path, int exact, uint64_t *total_samples) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) { perror(path); return -1; }
+    struct stat st;
+    if (fstat(fd, &st) < 0) { perror(path); close(fd); return -1; }
+    if (st.st_size == 0) { close(fd); return 0; }
+
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) { perror("mmap"); return -1; }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    stats_dump_reader_t r;
+    stats_dump_reader_init(&r, data, st.st_size);
+    int ret = 0, found;
+    while ((found = stats_dump_next_series(&r)) == 1) {
+        printf("# %s: %s, %lu samples, cpu %d, tsc %lu Hz\n", path, r.label,
+               r.header.count, r.header.cpu, r.header.tsc_hz);
+        stats_set_tsc_hz(r.header.tsc_hz);     // ns columns when the dump knows it
+
+        stats_t stats;
+        hist_t hist;
+        uint64_t *buf = NULL;
+        if (exact) {
+            buf = malloc(r.header.count * sizeof(uint64_t));
+            if (!buf) { fprintf(stderr, "%s: cannot hold %lu samples\n", r.label, r.header.count); ret = -1; break; }
+        }
+        stats_init(&stats, buf, exact ? r.header.count : 0);
+        hist_init(&hist, hist_counts, HIST_BUCKETS(HIST_DEFAULT_PRECISION), HIST_DEFAULT_PRECISION);
+
+        long n;
+        while ((n = stats_dump_read(&r, chunk, CHUNK)) > 0) {
+            stats_add_samples(&stats, chunk, n);
+            if (!exact) hist_record_bulk(&hist, chunk, n);
+        }
+        if (n < 0) { fprintf(stderr, "%s: corrupt data in series %s\n", path, r.label); ret = -1; free(buf); break; }
+
+        *total_samples += stats.total;
+        if (exact) stats_print_detailed(&stats, r.label);
+        else print_streamed(&stats, &hist, r.label);
+        free(buf);
+    }
+    if (found < 0) { fprintf(stderr, "%s: not a valid sample dump\n", path); ret = -1; }
+    munmap(data, st.st_size);
+    return ret;
+}
+
+int main(int argc, char **argv) {
+    int opt, exact = 0, ret = 0;
+    while ((opt = getopt(argc, argv, "e")) != -1) {
+        switch (opt) {
+        case 'e': exact = 1; break;
+        default:
+            fprintf(stderr, "Usage: %s [-e] dump.bin [dump.bin...]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "Usage: %s [-e] dump.bin [dump.bin...]\n", argv[0]);
+        return 1;
+    }
+
+    uint64_t total = 0, bytes = 0;
+    double t0 = now_sec();
+    for (int i = optind; i < argc; i++) {
+        struct stat st;
+        if (stat(argv[i], &st) == 0) bytes += st.st_size;
+        if (analyze(argv[i], exact, &total) < 0) ret = 1;
+    }
+    double dt = now_sec() - t0;
+    fprintf(stderr, "Decoded %lu samples (%.1f MB) in %.3f s: %.1f Msamples/s, %.1f MB/s\n",
+            total, bytes / 1e6, dt, total / dt / 1e6, bytes / dt / 1e6);
+    return ret;
+}
@@ -0,0 +1,196 @@
+// Run-to-run regression check over two binary sample dumps (stats_dump.h),
+// e.g. before and after a host kernel or QEMU upgrade. Series are matched
+// by label; for each pair:
+//
+//   - a one-sided Mann-Whitney U test: do the new samples tend to be slower?
+//   - bootstrap confidence intervals of the change in median and p99,
+//     resampling each run independently
+//
+// The median regressed when the U test is significant at -a and the lower
+// bound of its change is above the minimum effect (-t), so shifts too small
+// to matter are not flagged just because N is large. The U test compares
+// whole distributions and can miss a worse tail under a better median, so
+// p99 is judged by its bootstrap interval alone, at the same level.
+// Exits 1 if any series regressed, 2 on errors, 0 otherwise.
+//
+// Usage: stats-compare [-a alpha] [-t pct] [-B reps] base.bin new.bin
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "stats.h"
+#include "stats_dump.h"
+
+#define MAX_SERIES 256
+#define SEED       0x9e3779b97f4a7c15ull
+#define TSC_TOLERANCE 0.001     // calibrated frequencies jitter run to run
+
+typedef struct {
+    char label[STATS_DUMP_LABEL_MAX + 1];
+    uint64_t tsc_hz;
+    stats_t stats;
+} series_t;
+
+typedef struct {
+    series_t s[MAX_SERIES];
+    int n;
+} run_t;
+
+static double alpha = 0.01;         // significance level
+static double min_effect = 0.02;    // relative change that counts
+static size_t B = 1000;             // bootstrap replicates
+
+// Decode every series of a dump into RAM
+static int load(const char *path, run_t *run) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) { perror(path); return -1; }
+    struct stat st;
+    if (fstat(fd, &st) < 0) { perror(path); close(fd); return -1; }
+    if (st.st_size == 0) { close(fd); return 0; }
+
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) { perror("mmap"); return -1; }
+
+    stats_dump_reader_t r;
+    stats_dump_reader_init(&r, data, st.st_size);
+    int ret = 0, found;
+    while ((found = stats_dump_next_series(&r)) == 1) {
+        if (run->n == MAX_SERIES) {
+            fprintf(stderr, "%s: more than %d series\n", path, MAX_SERIES);
+            ret = -1;
+            break;
+        }
+        series_t *s = &run->s[run->n];
+        uint64_t *buf = malloc(r.header.count * sizeof(uint64_t));
+        if (!buf) { fprintf(stderr, "%s: cannot hold %lu samples\n", r.label, r.header.count); ret = -1; break; }
+        long n = stats_dump_read(&r, buf, r.header.count);
+        if (n < 0) { fprintf(stderr, "%s: corrupt data in series %s\n", path, r.label); free(buf); ret = -1; break; }
+        stats_init_filled(&s->stats, buf, n);
+        snprintf(s->label, sizeof(s->label), "%s", r.label);
+        s->tsc_hz = r.header.tsc_hz;
+        run->n++;
+    }
+    if (found < 0) { fprintf(stderr, "%s: not a valid sample dump\n", path); ret = -1; }
+    munmap(data, st.st_size);
+    return ret;
+}
+
+static series_t *find(run_t *run, const char *label) {
+    for (int i = 0; i < run->n; i++)
+        if (strcmp(run->s[i].label, label) == 0) return &run->s[i];
+    return NULL;
+}
+
+static void print_change(const char *name, double base, double new, double lo, double hi) {
+    printf("%-8s %12.1f %12.1f %+8.2f%%   [%+.2f%%, %+.2f%%]\n", name, base, new,
+           100.0 * (new - base) / base, 100.0 * lo / base, 100.0 * hi / base);
+}
+
+// Returns 1 if the new series regressed, 0 if not, -1 on errors
+static int compare(series_t *base, series_t *new) {
+    static const double pcts[] = { 50.0, 99.0 };
+    static const char *names[] = { "Median", "p99" };
+    double *rb = malloc(2 * B * sizeof(double)), *rn = malloc(2 * B * sizeof(double));
+    double z = 0.0, p = 0.5, prob = 0.5, est_b[2], est_n[2];
+    int slower[2] = { 0 }, faster[2] = { 0 };
+
+    if (!rb || !rn || stats_bootstrap(&base->stats, pcts, 2, rb, B, SEED) < 0 ||
+        stats_bootstrap(&new->stats, pcts, 2, rn, B, SEED + 1) < 0) {
+        fprintf(stderr, "%s: bootstrap failed\n", base->label);
+        free(rb);
+        free(rn);
+        return -1;
+    }
+    stats_percentiles(&base->stats, pcts, est_b, 2);
+    stats_percentiles(&new->stats, pcts, est_n, 2);
+    stats_mann_whitney(&base->stats, &new->stats, &z, &p, &prob);
+
+    printf("=== %s ===\n", base->label);
+    if (base->tsc_hz && new->tsc_hz &&
+        fabs((double)new->tsc_hz / base->tsc_hz - 1.0) > TSC_TOLERANCE)
+        printf("Note: TSC %lu Hz vs %lu Hz, cycles are not directly comparable\n",
+               base->tsc_hz, new->tsc_hz);
+    printf("%-8s %12s %12s %9s   %.0f%% CI of the change\n", "", "base", "new", "change",
+           100.0 * (1.0 - 2.0 * alpha));
+    printf("%-8s %12zu %12zu\n", "Samples", base->stats.count, new->stats.count);
+    for (int i = 0; i < 2; i++) {
+        // Difference of independent replicates: one bootstrap of new - base
+        double *d = rn + i * B, lo, hi;
+        for (size_t b = 0; b < B; b++) d[b] -= rb[i * B + b];
+        stats_bootstrap_ci(d, B, 1.0 - 2.0 * alpha, &lo, &hi);
+        print_change(names[i], est_b[i], est_n[i], lo, hi);
+        slower[i] = lo > min_effect * est_b[i];
+        faster[i] = hi < -min_effect * est_b[i];
+    }
+    printf("Mann-Whitney U: z = %.2f, p = %.3g (new slower), P(new > base) = %.3f\n",
+           z, p, prob);
+    slower[0] = slower[0] && p < alpha;
+    faster[0] = faster[0] && 1.0 - p < alpha;
+    if (slower[0] || slower[1])
+        printf("Verdict: REGRESSION (%s)\n", slower[0] && slower[1] ? "median and p99" :
+               slower[0] ? "median" : "p99");
+    else if (faster[0] || faster[1])
+        printf("Verdict: improvement (%s)\n", faster[0] && faster[1] ? "median and p99" :
+               faster[0] ? "median" : "p99");
+    else
+        printf("Verdict: no significant change\n");
+    printf("====================================\n\n");
+    free(rb);
+    free(rn);
+    return slower[0] || slower[1];
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-a alpha] [-t pct] [-B reps] base.bin new.bin\n", prog);
+    fprintf(stderr, "  -a  significance level, one-sided (default: 0.01)\n");
+    fprintf(stderr, "  -t  minimum change of median or p99 that counts, in %% (default: 2)\n");
+    fprintf(stderr, "  -B  bootstrap replicates (default: 1000; each costs one pass over the samples)\n");
+    fprintf(stderr, "Exit status: 1 if any series regressed, 2 on errors, 0 otherwise\n");
+}
+
+int main(int argc, char **argv) {
+    static run_t base, new;
+    int opt, regressions = 0, errors = 0;
+
+    while ((opt = getopt(argc, argv, "a:t:B:")) != -1) {
+        switch (opt) {
+        case 'a': alpha = atof(optarg); break;
+        case 't': min_effect = atof(optarg) / 100.0; break;
+        case 'B': B = strtoul(optarg, NULL, 10); break;
+        default: usage(argv[0]); return 2;
+        }
+    }
+    if (argc - optind != 2 || alpha <= 0.0 || alpha >= 0.5 || min_effect < 0.0 || B < 100) {
+        usage(argv[0]);
+        return 2;
+    }
+    if (load(argv[optind], &base) < 0 || load(argv[optind + 1], &new) < 0) return 2;
+
+    for (int i = 0; i < base.n; i++) {
+        series_t *n = find(&new, base.s[i].label);
+        if (!n) {
+            printf("%s: only in %s\n", base.s[i].label, argv[optind]);
+            continue;
+        }
+        if (base.s[i].stats.count == 0 || n->stats.count == 0) {
+            printf("%s: no samples\n\n", base.s[i].label);
+            continue;
+        }
+        int r = compare(&base.s[i], n);
+        if (r < 0) errors++;
+        else regressions += r;
+    }
+    for (int i = 0; i < new.n; i++)
+        if (!find(&base, new.s[i].label))
+            printf("%s: only in %s\n", new.s[i].label, argv[optind + 1]);
+
+    printf("%d regression%s (alpha %g, minimum change %.1f%%)\n", regressions,
+           regressions == 1 ? "" : "s", alpha, 100.0 * min_effect);
+    return errors ? 2 : regressions ? 1 : 0;
+}
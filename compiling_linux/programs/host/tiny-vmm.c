@@ -0,0 +1,371 @@
+// Minimal VMM on /dev/kvm, a stand-in for QEMU when measuring exits.
+// The guest is a flat 64-bit payload that runs one exits.h catalog loop,
+// records its own TSC deltas into guest memory and reports completion on
+// GUEST_PORT_DONE. Exits that KVM hands to user space (port I/O, HLT) go
+// to a handler that does nothing, echoes like QEMU's debugcon, or spins
+// for a fixed time to simulate device work, so the slow path can be
+// split into KVM's share and the VMM's share.
+//
+// Two series per entry: the guest's view of each exit, and the host's
+// view of ioctl(KVM_RUN) (only meaningful for exits that reach user space).
+//
+// Usage: tiny-vmm [-m noop|echo|work] [-w cycles] [-e exit,...] [-t sec] [-l] [-R] [-U] [N]
+#define _GNU_SOURCE
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/kvm.h>
+#include "stats.h"
+#include "timing.h"
+#include "tsc.h"
+#include "exits.h"
+
+// Guest physical layout (identity mapped with 2 MB pages)
+#define GUEST_PML4      0x1000
+#define GUEST_PDPT      0x2000
+#define GUEST_PD        0x3000
+#define GUEST_CODE      0x10000
+#define GUEST_STACK     0x100000    // grows down
+#define GUEST_SAMPLES   0x200000
+#define GUEST_MEM_MAX   (1UL << 30) // one page directory
+
+#define GUEST_PORT_DONE 0x501
+
+enum { HANDLER_NOOP, HANDLER_ECHO, HANDLER_WORK };
+static const char *handler_names[] = { "noop", "echo", "work" };
+
+// Guest code. Every loop is copied into guest memory as part of the
+// guest_text section, so it must be position independent and
+// self-contained: no calls out of the section, no data, no stack
+// protector.
+#define GUEST_FN __attribute__((section("guest_text"), noinline, no_stack_protector))
+#define GUEST_RECORD(v) (*out++ = (v))
+#define GUEST_LOOP(name, label, path, priv, flags, setup, body)             \
+GUEST_FN static void guest_##name(uint64_t *out, uint64_t n) {            \
+    EXIT_TIMED_LOOP(n, setup, body, GUEST_RECORD);                          \
+    for (;;) exit_outb(GUEST_PORT_DONE, 0);                                \
+}
+EXIT_CATALOG(GUEST_LOOP)
+#undef GUEST_LOOP
+
+static void (*const guest_loops[EXIT_COUNT])(uint64_t *, uint64_t) = {
+#define GUEST_LOOP_PTR(name, ...) guest_##name,
+    EXIT_CATALOG(GUEST_LOOP_PTR)
+#undef GUEST_LOOP_PTR
+};
+
+extern char __start_guest_text[], __stop_guest_text[];
+
+// Watchdog: a guest stuck on an exit (e.g. a hypercall that a nested
+// hypervisor keeps re-entering) interrupts KVM_RUN instead of hanging
+static volatile sig_atomic_t watchdog_fired;
+
+static void watchdog(int sig) {
+    (void)sig;
+    watchdog_fired = 1;
+}
+
+typedef struct {
+    int kvm, vm, vcpu;
+    struct kvm_run *run;
+    uint8_t *mem;
+    size_t mem_size;
+    int handler;
+    uint64_t work_cycles;
+    uint64_t echoed;        // bytes written by the guest in echo mode
+    unsigned int timeout;   // seconds per series, 0 disables the watchdog
+} vmm_t;
+
+static int vmm_init(vmm_t *v, size_t mem_size) {
+    v->kvm = open("/dev/kvm", O_RDWR | O_CLOEXEC);
+    if (v->kvm < 0) { perror("/dev/kvm"); return -1; }
+    if (ioctl(v->kvm, KVM_GET_API_VERSION, 0) != KVM_API_VERSION) {
+        fprintf(stderr, "Unexpected KVM API version\n");
+        return -1;
+    }
+    v->vm = ioctl(v->kvm, KVM_CREATE_VM, 0);
+    if (v->vm < 0) { perror("KVM_CREATE_VM"); return -1; }
+
+    v->mem_size = mem_size;
+    v->mem = mmap(NULL, mem_size, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (v->mem == MAP_FAILED) { perror("mmap guest memory"); return -1; }
+    struct kvm_userspace_memory_region region = {
+        .slot = 0,
+        .guest_phys_addr = 0,
+        .memory_size = mem_size,
+        .userspace_addr = (uintptr_t)v->mem,
+    };
+    if (ioctl(v->vm, KVM_SET_USER_MEMORY_REGION, &region) < 0) {
+        perror("KVM_SET_USER_MEMORY_REGION");
+        return -1;
+    }
+
+    v->vcpu = ioctl(v->vm, KVM_CREATE_VCPU, 0);
+    if (v->vcpu < 0) { perror("KVM_CREATE_VCPU"); return -1; }
+    int run_size = ioctl(v->kvm, KVM_GET_VCPU_MMAP_SIZE, 0);
+    if (run_size <= 0) { perror("KVM_GET_VCPU_MMAP_SIZE"); return -1; }
+    v->run = mmap(NULL, run_size, PROT_READ | PROT_WRITE, MAP_SHARED, v->vcpu, 0);
+    if (v->run == MAP_FAILED) { perror("mmap kvm_run"); return -1; }
+    return 0;
+}
+
+// Pass the host's supported CPUID through, so CPUID leaves return real
+// data and XSETBV is allowed. Returns 1 if XSAVE is available.
+static int vmm_setup_cpuid(vmm_t *v) {
+    int nent = 256;
+    struct kvm_cpuid2 *cpuid = calloc(1, sizeof(*cpuid) + nent * sizeof(struct kvm_cpuid_entry2));
+    int xsave = 0;
+
+    if (!cpuid) return 0;
+    cpuid->nent = nent;
+    if (ioctl(v->kvm, KVM_GET_SUPPORTED_CPUID, cpuid) == 0) {
+        for (uint32_t i = 0; i < cpuid->nent; i++)
+            if (cpuid->entries[i].function == 1)
+                xsave = !!(cpuid->entries[i].ecx & (1u << 26));
+        if (ioctl(v->vcpu, KVM_SET_CPUID2, cpuid) < 0) {
+            perror("KVM_SET_CPUID2");
+            xsave = 0;
+        }
+    }
+    free(cpuid);
+    return xsave;
+}
+
+// Flat 64-bit long mode: identity-mapped 2 MB pages, one code and one
+// data segment, no IDT (a fault in the guest shuts it down).
+static int vmm_setup_long_mode(vmm_t *v, int xsave) {
+    uint64_t *pml4 = (uint64_t *)(v->mem + GUEST_PML4);
+    uint64_t *pdpt = (uint64_t *)(v->mem + GUEST_PDPT);
+    uint64_t *pd = (uint64_t *)(v->mem + GUEST_PD);
+    struct kvm_sregs sregs;
+
+    pml4[0] = GUEST_PDPT | 0x3;                 // present, writable
+    pdpt[0] = GUEST_PD | 0x3;
+    for (uint64_t i = 0; i < v->mem_size >> 21; i++)
+        pd[i] = (i << 21) | 0x83;               // present, writable, 2 MB
+
+    if (ioctl(v->vcpu, KVM_GET_SREGS, &sregs) < 0) { perror("KVM_GET_SREGS"); return -1; }
+    sregs.cr3 = GUEST_PML4;
+    sregs.cr4 = (1 << 5) | (1 << 9);            // PAE, OSFXSR
+    if (xsave) sregs.cr4 |= 1 << 18;            // OSXSAVE
+    sregs.cr0 = 0x80050033;                     // PG, AM, WP, NE, ET, MP, PE
+    sregs.efer = 0x500;                         // LME, LMA
+
+    struct kvm_segment seg = {
+        .base = 0, .limit = 0xffffffff, .selector = 1 << 3,
+        .present = 1, .type = 11, .dpl = 0, .db = 0, .s = 1, .l = 1, .g = 1,
+    };
+    sregs.cs = seg;
+    seg.type = 3;
+    seg.selector = 2 << 3;
+    seg.l = 0;
+    seg.db = 1;
+    sregs.ds = sregs.es = sregs.fs = sregs.gs = sregs.ss = seg;
+    if (ioctl(v->vcpu, KVM_SET_SREGS, &sregs) < 0) { perror("KVM_SET_SREGS"); return -1; }
+    return 0;
+}
+
+static int vmm_start(vmm_t *v, int id, uint64_t n) {
+    struct kvm_regs regs;
+    memset(&regs, 0, sizeof(regs));
+    regs.rip = GUEST_CODE + ((char *)guest_loops[id] - __start_guest_text);
+    regs.rsp = GUEST_STACK;
+    regs.rdi = GUEST_SAMPLES;
+    regs.rsi = n;
+    regs.rflags = 0x2;
+    if (ioctl(v->vcpu, KVM_SET_REGS, &regs) < 0) { perror("KVM_SET_REGS"); return -1; }
+    return 0;
+}
+
+// User-space side of an exit
+static void vmm_handle(vmm_t *v) {
+    struct kvm_run *run = v->run;
+    uint8_t *data = (uint8_t *)run + run->io.data_offset;
+
+    switch (v->handler) {
+    case HANDLER_NOOP:
+        break;
+    case HANDLER_ECHO:
+        // Like QEMU's debugcon: OUT consumes the byte, IN reads back the port id
+        if (run->exit_reason == KVM_EXIT_IO) {
+            if (run->io.direction == KVM_EXIT_IO_OUT) v->echoed += run->io.size * run->io.count;
+            else memset(data, 0xe9, run->io.size * run->io.count);
+        }
+        break;
+    case HANDLER_WORK: {
+        uint64_t end = timing_tsc_start() + v->work_cycles;
+        while (timing_tsc_start() < end)
+            ;
+        break;
+    }
+    }
+}
+
+// Run one catalog entry to completion. host (optional) collects the
+// KVM_RUN round trips that ended in a user-space exit other than the done
+// port.
+static int vmm_run_series(vmm_t *v, int id, uint64_t n, stats_t *host) {
+    if (vmm_start(v, id, n) < 0) return -1;
+    watchdog_fired = 0;
+    alarm(v->timeout);
+    for (;;) {
+        uint64_t t0 = rdtsc_serialized_start();
+        int ret = ioctl(v->vcpu, KVM_RUN, 0);
+        uint64_t t1 = rdtsc_serialized_end();
+        if (ret < 0 && errno == EINTR && watchdog_fired) {
+            struct kvm_regs regs;
+            ioctl(v->vcpu, KVM_GET_REGS, &regs);
+            fprintf(stderr, "%s: no completion after %u s, guest at rip %#llx (offset %#llx)\n",
+                    exit_catalog[id].name, v->timeout, regs.rip, regs.rip - GUEST_CODE);
+            return -1;
+        }
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            perror("KVM_RUN");
+            alarm(0);
+            return -1;
+        }
+        switch (v->run->exit_reason) {
+        case KVM_EXIT_IO:
+            if (v->run->io.port == GUEST_PORT_DONE) {
+                alarm(0);
+                return 0;
+            }
+            break;
+        case KVM_EXIT_HLT:
+            break;
+        case KVM_EXIT_SHUTDOWN:
+            fprintf(stderr, "%s: guest shut down (fault, e.g. an unsupported MSR)\n",
+                    exit_catalog[id].name);
+            alarm(0);
+            return -1;
+        default:
+            fprintf(stderr, "%s: unexpected exit reason %u\n", exit_catalog[id].name,
+                    v->run->exit_reason);
+            alarm(0);
+            return -1;
+        }
+        if (host) stats_add_sample(host, t1 - t0);
+        vmm_handle(v);
+    }
+}
+
+static void usage(const char *prog) {
+    printf("Usage: %s [-m noop|echo|work] [-w cycles] [-e exit,...] [-t sec] [-l] [-R] [-U] [N]\n", prog);
+    printf("  -m  user-space exit handler (default: noop)\n");
+    printf("  -w  TSC cycles of simulated device work per exit with -m work (default: 1000)\n");
+    printf("  -e  catalog entries to measure (default: CPUID_0,HC_INVALID,OUT_E9,HLT)\n");
+    printf("  -t  give up on a series after this many seconds, 0 = never (default: 30)\n");
+    printf("  -l  list the exit catalog\n");
+    printf("  -R  raw statistics only (no timer calibration / baseline correction)\n");
+    printf("  -U  run even if the TSC is not invariant or RDTSC exits\n");
+    printf("  N   number of samples per series (default: 200000)\n");
+}
+
+int main(int argc, char **argv) {
+    vmm_t v = { .handler = HANDLER_NOOP, .work_cycles = 1000, .timeout = 30 };
+    int ids[EXIT_COUNT] = { EXIT_CPUID_0, EXIT_HC_INVALID, EXIT_OUT_E9, EXIT_HLT };
+    int nids = 4;
+    int raw_only = 0, force = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "m:w:e:t:lRU")) != -1) {
+        switch (opt) {
+        case 'm':
+            v.handler = -1;
+            for (int h = 0; h < 3; h++)
+                if (strcmp(optarg, handler_names[h]) == 0) v.handler = h;
+            if (v.handler < 0) { usage(argv[0]); return 1; }
+            break;
+        case 'w': v.work_cycles = strtoull(optarg, NULL, 10); break;
+        case 'e':
+            nids = exit_parse_list(optarg, ids, EXIT_COUNT);
+            if (nids < 0) return 1;
+            break;
+        case 't': v.timeout = strtoul(optarg, NULL, 10); break;
+        case 'l': exit_print_catalog(); return 0;
+        case 'R': raw_only = 1; break;
+        case 'U': force = 1; break;
+        default: usage(argv[0]); return 1;
+        }
+    }
+    const uint64_t N = (optind < argc) ? strtoull(argv[optind], NULL, 10) : 200000;
+    size_t code_size = __stop_guest_text - __start_guest_text;
+    size_t mem_size = (GUEST_SAMPLES + N * sizeof(uint64_t) + (2 << 20) - 1) & ~((size_t)(2 << 20) - 1);
+    if (N == 0 || mem_size > GUEST_MEM_MAX) {
+        fprintf(stderr, "N must be between 1 and %lu\n", (GUEST_MEM_MAX - GUEST_SAMPLES) / 8);
+        return 1;
+    }
+
+    // The guest reads the host TSC (no offset scaling is set up), so the
+    // host's frequency and sanity apply to both sets of samples
+    tsc_info_t tsc;
+    if (tsc_check(&tsc, force) < 0) return 1;
+
+    struct sigaction sa = { .sa_handler = watchdog };    // no SA_RESTART
+    sigaction(SIGALRM, &sa, NULL);
+    if (vmm_init(&v, mem_size) < 0) return 1;
+    int xsave = vmm_setup_cpuid(&v);
+    if (vmm_setup_long_mode(&v, xsave) < 0) return 1;
+    memcpy(v.mem + GUEST_CODE, __start_guest_text, code_size);
+
+    // The timer pair costs differ inside the guest (RDTSC may even exit
+    // under nested virtualization), so calibrate with the guest's own NOP
+    // loop rather than the host cache
+    timing_calib_t calib;
+    if (!raw_only) {
+        stats_t baseline;
+        if (vmm_run_series(&v, EXIT_NOP, N, NULL) < 0) return 1;
+        stats_init_filled(&baseline, (uint64_t *)(v.mem + GUEST_SAMPLES), N);
+        if (timing_calib_from_stats(&calib, "tiny-vmm-guest-" TIMING_NAME, &baseline) < 0)
+            raw_only = 1;
+        // A native timer pair costs tens of cycles; thousands means the
+        // guest's RDTSC exits (typically the outer hypervisor of a nested setup)
+        else if (calib.median > TSC_EXIT_CYCLES)
+            printf("WARNING: guest timer pair costs %.0f cycles, guest RDTSC appears to exit\n",
+                   calib.median);
+    }
+
+    printf("=== Tiny VMM Microbenchmark ===\n");
+    printf("Number of iterations: %lu, handler: %s", N, handler_names[v.handler]);
+    if (v.handler == HANDLER_WORK) printf(" (%lu cycles)", v.work_cycles);
+    printf("\n\n");
+
+    uint64_t *host_buf = malloc(N * sizeof(uint64_t));
+    if (!host_buf) { perror("malloc"); return 1; }
+    int ret = 0;
+    for (int k = 0; k < nids; k++) {
+        const exit_desc_t *e = &exit_catalog[ids[k]];
+        char label[64];
+        stats_t guest, host;
+
+        stats_init(&host, host_buf, N);
+        if (vmm_run_series(&v, ids[k], N, &host) < 0) {
+            ret = 1;
+            continue;
+        }
+
+        // The guest wrote its samples straight into its memory
+        stats_init_filled(&guest, (uint64_t *)(v.mem + GUEST_SAMPLES), N);
+        snprintf(label, sizeof(label), "%s(tiny-vmm guest, %s)", e->label, e->path);
+        stats_print_detailed(&guest, label);
+        if (!raw_only) timing_print_corrected(&guest, &calib, label);
+        if (host.total) {
+            snprintf(label, sizeof(label), "%s(tiny-vmm KVM_RUN, %s)", e->label, e->path);
+            stats_print_detailed(&host, label);
+        } else {
+            printf("(%s was handled inside KVM: no user-space exits)\n\n", e->name);
+        }
+    }
+    if (v.echoed) printf("Echo handler consumed %lu bytes\n", v.echoed);
+    free(host_buf);
+    return ret;
+}
@@ -0,0 +1,197 @@
+#ifndef ISOLATE_H
+#define ISOLATE_H
+
+/* Interference detection for user-space measurement loops.
+ *
+ * Long tails often come from timer ticks, device interrupts, SMIs or the
+ * task being migrated, not from the exit path under test. In isolation
+ * mode samples are collected in chunks. Around each chunk the CPU id is
+ * read from TSC_AUX (RDTSCP), the interrupt count of that CPU is read
+ * from /proc/interrupts, and the SMI count from MSR 0x34 if /dev/cpu/N/msr
+ * is available. A chunk whose CPU changed or whose counts moved is
+ * contaminated: its samples are dropped from the series and only folded
+ * into a summary, so the interference rate can be reported separately.
+ *
+ * Reading the counters takes tens of microseconds, but it happens between
+ * chunks, outside any timed region.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "stats.h"
+#include "timing.h"
+
+#define ISOLATE_DEFAULT_CHUNK 256
+#define ISOLATE_MSR_SMI_COUNT 0x34
+
+/* Reasons a chunk was dropped (bit mask) */
+#define ISOLATE_IRQ       0x1
+#define ISOLATE_MIGRATED  0x2
+#define ISOLATE_SMI       0x4
+
+typedef struct {
+    size_t chunk;               /* samples per chunk */
+    uint64_t *pending;          /* samples of the current chunk */
+    size_t npending;
+    /* Counter snapshot at the start of the current chunk */
+    uint32_t cpu;
+    int64_t irqs;               /* -1 if /proc/interrupts is unreadable */
+    int64_t smis;               /* -1 if the MSR is unreadable */
+    /* Totals */
+    uint64_t chunks;
+    uint64_t dirty[3];          /* contaminated chunks by reason: irq, migrated, smi */
+    uint64_t dirty_chunks;
+    stats_t dropped;            /* summary of the dropped samples */
+} isolate_t;
+
+/* CPU id from IA32_TSC_AUX (Linux stores node << 12 | cpu) */
+static inline uint32_t isolate_cpu(void)
+{
+    uint32_t aux;
+    timing_rdtscp(&aux);
+    return aux & 0xfff;
+}
+
+/* Interrupts delivered to cpu so far, summed over all /proc/interrupts rows */
+static inline int64_t isolate_irq_count(uint32_t cpu)
+{
+    static char buf[1 << 16];
+    static int fd = -2;
+    if (fd == -2) fd = open("/proc/interrupts", O_RDONLY);
+    if (fd < 0) return -1;
+
+    ssize_t len = pread(fd, buf, sizeof(buf) - 1, 0);
+    if (len <= 0) return -1;
+    buf[len] = '\0';
+
+    /* Header: "CPU0 CPU1 ..." gives the column of this CPU (CPUs can be offline) */
+    char *line = buf, *nl = strchr(line, '\n');
+    if (!nl) return -1;
+    int col = -1, ncols = 0;
+    for (char *p = line; p < nl; ) {
+        unsigned int id;
+        int used;
+        if (sscanf(p, " CPU%u%n", &id, &used) != 1) break;
+        if (id == cpu) col = ncols;
+        ncols++;
+        p += used;
+    }
+    if (col < 0) return -1;
+
+    int64_t total = 0;
+    for (line = nl + 1; *line; line = nl + 1) {
+        nl = strchr(line, '\n');
+        if (!nl) nl = line + strlen(line);
+        char *p = strchr(line, ':');
+        if (p && p < nl) {
+            /* Rows like ERR/MIS carry a single global count; they stop early */
+            p++;
+            for (int c = 0; c <= col; c++) {
+                char *end;
+                unsigned long long v = strtoull(p, &end, 10);
+                if (end == p || end > nl) break;
+                if (c == col) total += v;
+                p = end;
+            }
+        }
+        if (!*nl) break;
+    }
+    return total;
+}
+
+/* SMIs seen by cpu (MSR_SMI_COUNT), -1 without the msr driver */
+static inline int64_t isolate_smi_count(uint32_t cpu)
+{
+    static int fd = -2;
+    static uint32_t fd_cpu;
+    char path[32];
+    uint64_t v;
+
+    if (fd == -2 || fd_cpu != cpu) {
+        if (fd >= 0) close(fd);
+        snprintf(path, sizeof(path), "/dev/cpu/%u/msr", cpu);
+        fd = open(path, O_RDONLY);
+        fd_cpu = cpu;
+    }
+    if (fd < 0 || pread(fd, &v, sizeof(v), ISOLATE_MSR_SMI_COUNT) != sizeof(v))
+        return -1;
+    return (uint32_t)v;
+}
+
+/* Snapshot the counters; call right before the first sample of a loop */
+static inline void isolate_begin(isolate_t *iso)
+{
+    iso->npending = 0;
+    iso->cpu = isolate_cpu();
+    iso->irqs = isolate_irq_count(iso->cpu);
+    iso->smis = isolate_smi_count(iso->cpu);
+}
+
+static inline int isolate_init(isolate_t *iso, size_t chunk)
+{
+    memset(iso, 0, sizeof(*iso));
+    iso->chunk = chunk ? chunk : ISOLATE_DEFAULT_CHUNK;
+    iso->pending = malloc(iso->chunk * sizeof(uint64_t));
+    stats_init(&iso->dropped, NULL, 0);
+    return iso->pending ? 0 : -1;
+}
+
+/* Close the current chunk and start the next one
+ * Returns 0 if the pending samples are clean, otherwise the ISOLATE_*
+ * reasons; contaminated samples are counted as dropped. The caller
+ * consumes iso->pending[0..npending) and then sets npending to 0.
+ */
+static inline int isolate_end_chunk(isolate_t *iso)
+{
+    uint32_t cpu = isolate_cpu();
+    int64_t irqs = isolate_irq_count(cpu);
+    int64_t smis = isolate_smi_count(cpu);
+    int reason = 0;
+
+    if (cpu != iso->cpu) reason |= ISOLATE_MIGRATED;
+    else if (irqs != iso->irqs) reason |= ISOLATE_IRQ;
+    if (smis != iso->smis) reason |= ISOLATE_SMI;
+
+    if (iso->npending) {
+        iso->chunks++;
+        if (reason) {
+            iso->dirty_chunks++;
+            for (int r = 0; r < 3; r++)
+                if (reason & (1 << r)) iso->dirty[r]++;
+            for (size_t i = 0; i < iso->npending; i++)
+                stats_update_summary(&iso->dropped, iso->pending[i]);
+        }
+    }
+    iso->cpu = cpu;
+    iso->irqs = irqs;
+    iso->smis = smis;
+    return reason;
+}
+
+/* Queue one sample; returns 1 when the chunk is full */
+static inline int isolate_add(isolate_t *iso, uint64_t v)
+{
+    iso->pending[iso->npending++] = v;
+    return iso->npending == iso->chunk;
+}
+
+static inline void isolate_print(isolate_t *iso, const char *label)
+{
+    printf("=== Interference: %s ===\n", label);
+    printf("Chunks: %lu of %zu samples, contaminated: %lu (%.2f%%)\n",
+           iso->chunks, iso->chunk, iso->dirty_chunks,
+           iso->chunks ? 100.0 * iso->dirty_chunks / iso->chunks : 0.0);
+    printf("  interrupts: %lu  migrated: %lu  SMI: %lu%s%s\n",
+           iso->dirty[0], iso->dirty[1], iso->dirty[2],
+           iso->irqs < 0 ? "  (no /proc/interrupts)" : "",
+           iso->smis < 0 ? "  (no SMI counter)" : "");
+    if (iso->dropped.total)
+        printf("Dropped samples: %lu, mean %.2f, max %lu cycles\n",
+               iso->dropped.total, iso->dropped.mean, iso->dropped.max);
+    printf("====================================\n\n");
+}
+
+#endif /* ISOLATE_H */
@@ -5,32 +5,392 @@
 #include <sys/ioctl.h>
 #include <errno.h>
 #include <string.h>
+#include <sys/mman.h>
+#include "stats.h"
+#include "hist.h"
+#include "timing.h"
+#include "tsc.h"
+#include "exits.h"
+#include "adaptive.h"
+#include "cold.h"
+#include "results.h"
+#include "marker.h"
+#include "load.h"
+#include "modules/kvm-microbench.h"
 
-// Define the IOCTL commands (must match the kernel module)
-#define IOCTL_RUN_VMCALL   _IOW('v', 1, unsigned long)  // runs N vmcall
-#define IOCTL_RUN_FAST     _IOW('v', 2, unsigned long)  // runs N cpuid (fast path)
-#define IOCTL_RUN_SLOW     _IOW('v', 3, unsigned long)  // runs N out 0xE9 from kernel
+// Series are selected from the exits.h catalog and run with EXIT_IOCTL(id);
+// the module also keeps its legacy commands 1-4 (VMCALL, CPUID, OUT, empty)
 
 #define DEVICE_PATH "/dev/kvm-microbench"
 
+static int raw_only;
+static timing_calib_t calib;
+static tsc_info_t tsc;
+static results_t results;             // -r; results_add is a no-op without it
+static const exit_desc_t *current;    // entry being measured, for the results
+
+// Print one finished series and add it to the results
+static void series_report(stats_t *stats, const char *label) {
+    stats_print_detailed(stats, label);
+    if (!raw_only) timing_print_corrected(stats, &calib, label);
+    results_add(&results, stats, label, current, "kernel");
+}
+
+// Run one series in the module, then read its raw samples in place from
+// the module's buffer through mmap (no copy, no dmesg parsing).
+// With label == NULL the series is the empty-body baseline and only
+// feeds the timer calibration.
+// Measured series end their console marker (marker.h) right after the
+// ioctl; the marker is begun by the caller.
+static int run_series(int fd, unsigned long cmd, unsigned long n, const char *label) {
+    long ret = ioctl(fd, cmd, n);
+    if (ret < 0)
+        return -1;
+    if (label) marker_end(current, ret ? (unsigned long)ret : n);
+    if (ret == 0) {
+        printf("  (module does not export samples, see dmesg)\n");
+        return 0;
+    }
+
+    size_t count = (size_t)ret < n ? (size_t)ret : n;
+    size_t len = count * sizeof(uint64_t);
+    uint64_t *samples = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (samples == MAP_FAILED) {
+        fprintf(stderr, "Error: mmap of %zu samples failed: %s\n", count, strerror(errno));
+        if (!label) raw_only = 1;
+        return 0;
+    }
+
+    stats_t stats;
+    stats_init_filled(&stats, samples, count);
+    if (!label) {
+        if (timing_calib_from_stats(&calib, "kernel-" TIMING_NAME, &stats) == 0)
+            timing_calib_save(&calib);
+        else
+            raw_only = 1;
+    } else {
+        series_report(&stats, label);
+    }
+    munmap(samples, len);
+    return 0;
+}
+
+static uint64_t executed;      // samples run by fetch_series, for the end marker
+
+// Run one series in the module and append its samples to stats
+static int fetch_series(int fd, unsigned long cmd, unsigned long n, stats_t *stats) {
+    long got = ioctl(fd, cmd, n);
+    if (got <= 0) {
+        if (got == 0) errno = ENODATA;     // module does not export samples
+        return -1;
+    }
+    executed += got;
+    size_t len = got * sizeof(uint64_t);
+    uint64_t *chunk = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    if (chunk == MAP_FAILED)
+        return -1;
+    stats_add_samples(stats, chunk, got);
+    munmap(chunk, len);
+    return 0;
+}
+
+// Adaptive mode (-A): repeat the ioctl with growing chunks and collect
+// the samples in user space until the series has converged
+static int adaptive;
+static adaptive_t adapt;
+
+static int run_adaptive(int fd, unsigned long cmd, unsigned long cap, const char *label) {
+    uint64_t *buf = malloc(cap * sizeof(uint64_t));
+    stats_t stats;
+    adaptive_run_t run;
+    size_t n;
+    int ret = 0;
+
+    if (!buf) return -1;
+    stats_init(&stats, buf, cap);
+    adaptive_begin(&run);
+    executed = 0;
+    while (ret == 0 && (n = adaptive_next(&adapt, &stats, &run)) > 0)
+        ret = fetch_series(fd, cmd, n, &stats);
+    marker_end(current, executed);
+    if (ret == 0) {
+        adaptive_print(&run, &adapt, label);
+        series_report(&stats, label);
+    }
+    free(buf);
+    return ret;
+}
+
+// Cold mode (-C): the entry warm, then with the module disturbing caches
+// and TLB before every sample; both distributions side by side
+static int run_cold(int fd, int id, unsigned long n, const char *label,
+                    const struct kvm_mb_cold *req) {
+    static const struct kvm_mb_cold warm_req = { 0 };
+    uint64_t *buf = malloc(2 * n * sizeof(uint64_t));
+    stats_t warm, cold;
+    char cold_label[80], how[128];
+    int ret;
+
+    if (!buf) return -1;
+    stats_init(&warm, buf, n);
+    stats_init(&cold, buf + n, n);
+    snprintf(cold_label, sizeof(cold_label), "%s cold", label);
+    ret = fetch_series(fd, EXIT_IOCTL(id), n, &warm);
+    marker_end(current, n);
+    if (ret == 0 && (ret = ioctl(fd, IOCTL_SET_COLD, req)) == 0) {
+        marker_begin(current, cold_label);
+        ret = fetch_series(fd, EXIT_IOCTL(id), n, &cold);
+        marker_end(current, n);
+        ioctl(fd, IOCTL_SET_COLD, &warm_req);
+    }
+    if (ret == 0) {
+        cold_describe(req->flags, req->sweep_bytes, how, sizeof(how));
+        series_report(&warm, label);
+        series_report(&cold, cold_label);
+        cold_print_compare(&warm, &cold, label, how);
+    }
+    free(buf);
+    return ret;
+}
+
+// "0-3,6" or "all" -> CPU mask (first KVM_MB_MAX_CPUS CPUs)
+static uint64_t parse_cpus(const char *spec) {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    uint64_t mask = 0;
+
+    if (strcmp(spec, "all") == 0) {
+        for (long c = 0; c < ncpu && c < KVM_MB_MAX_CPUS; c++) mask |= 1ULL << c;
+        return mask;
+    }
+    while (*spec) {
+        char *end;
+        unsigned long lo = strtoul(spec, &end, 10), hi = lo;
+        if (end == spec) return 0;
+        if (*end == '-') hi = strtoul(end + 1, &end, 10);
+        if (hi < lo || hi >= KVM_MB_MAX_CPUS) return 0;
+        for (unsigned long c = lo; c <= hi; c++) mask |= 1ULL << c;
+        spec = end;
+        if (*spec == ',') spec++;
+        else if (*spec) return 0;
+    }
+    return mask;
+}
+
+// All CPUs of the mask exit at the same time, each from its own pinned
+// kthread. Prints one line per CPU and the combined distribution.
+static int run_parallel(int fd, int id, uint64_t cpus, unsigned long n, unsigned long duration_ms,
+                        const char *label) {
+    struct kvm_mb_parallel req = {
+        .exit_id = id,
+        .cpus = cpus,
+        .samples = n,
+        .duration_us = duration_ms * 1000,
+    };
+    long ret = ioctl(fd, IOCTL_RUN_PARALLEL, &req);
+    if (ret < 0)
+        return -1;
+    marker_end(current, ret);
+
+    int nr = __builtin_popcountll(cpus);
+    size_t len = nr * req.stride * sizeof(uint64_t);
+    uint64_t *samples = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (samples == MAP_FAILED) {
+        fprintf(stderr, "Error: mmap of %d x %lu samples failed: %s\n", nr,
+                (unsigned long)req.stride, strerror(errno));
+        return 0;
+    }
+    stats_t all;
+    uint64_t *buf = malloc(ret * sizeof(uint64_t));
+    if (!buf) {
+        munmap(samples, len);
+        return -1;
+    }
+    stats_init(&all, buf, ret);
+
+    static const double pcts[] = { 50.0, 99.0 };
+    printf("=== Per-CPU: %s, %d CPUs in parallel ===\n", label, nr);
+    printf("%5s %10s %10s %10s %10s %10s\n", "cpu", "samples", "median", "p99", "max", "median ns");
+    for (int c = 0, k = 0; c < KVM_MB_MAX_CPUS; c++) {
+        if (!(cpus & (1ULL << c))) continue;
+        stats_t s;
+        double p[2];
+        stats_init_filled(&s, samples + k * req.stride, req.count[k]);
+        stats_merge(&all, &s);
+        if (stats_percentiles(&s, pcts, p, 2) == 0)
+            printf("%5d %10zu %10.1f %10.1f %10lu %10.1f\n", c, s.count, p[0], p[1], stats_max(&s),
+                   stats_cycles_to_ns(p[0]));
+        k++;
+    }
+    printf("====================================\n\n");
+    series_report(&all, label);
+    free(buf);
+    munmap(samples, len);
+    return 0;
+}
+
+// Streaming mode: the module folds the samples into a histogram instead
+// of storing them (IOCTL_RUN_HIST), on the calling thread or, with cpus,
+// on one pinned kthread per CPU. n = 0 runs for duration_ms.
+static int run_hist(int fd, int id, uint64_t cpus, unsigned long n, unsigned long duration_ms,
+                    const char *label) {
+    size_t nb = HIST_BUCKETS(HIST_DEFAULT_PRECISION);
+    uint64_t *counts = calloc(nb, sizeof(uint64_t));
+    if (!counts)
+        return -1;
+    struct kvm_mb_hist req = {
+        .exit_id = id,
+        .precision = HIST_DEFAULT_PRECISION,
+        .cpus = cpus,
+        .samples = n,
+        .duration_us = duration_ms * 1000,
+        .counts_ptr = (uintptr_t)counts,
+        .nbuckets = nb,
+    };
+    if (ioctl(fd, IOCTL_RUN_HIST, &req) < 0) {
+        free(counts);
+        return -1;
+    }
+    marker_end(current, req.count);
+    hist_t hist;
+    hist_init(&hist, counts, nb, HIST_DEFAULT_PRECISION);
+    hist.count = req.count;
+    hist.min = req.min;
+    hist.max = req.max;
+    hist.sum = req.sum;
+    hist_print_detailed(&hist, label);
+    free(counts);
+    return 0;
+}
+
+// Throughput mode (-L): the module paces the exits itself
+// (IOCTL_RUN_PACED) and load_curve (load.h) sweeps the offered load
+typedef struct {
+    int fd, id;
+} load_ctx_t;
+
+static uint64_t load_paced(void *ctx, uint64_t interval, size_t n, stats_t *s) {
+    load_ctx_t *c = ctx;
+    struct kvm_mb_paced req = { .exit_id = c->id, .samples = n, .interval = interval };
+    long got = ioctl(c->fd, IOCTL_RUN_PACED, &req);
+    if (got < 0)
+        return 0;
+    if (s && got > 0) {
+        size_t len = got * sizeof(uint64_t);
+        uint64_t *chunk = mmap(NULL, len, PROT_READ, MAP_SHARED, c->fd, 0);
+        if (chunk == MAP_FAILED)
+            return 0;
+        stats_add_samples(s, chunk, got);
+        munmap(chunk, len);
+    }
+    return req.cycles;
+}
+
 int main(int argc, char *argv[]) {
     int fd;
     unsigned long num_iterations = 200000;  // Default value
-    int ret;
+    int opt;
+    int ids[EXIT_COUNT] = { EXIT_CPUID_0, EXIT_HC_INVALID, EXIT_OUT_E9 };
+    int nids = 3, force = 0, use_hist = 0, n_given = 0, load = 0;
+    uint64_t cpus = 0;
+    unsigned long duration_ms = 0;
+    double width = 0.01, budget = 10.0;
+    struct kvm_mb_cold cold_req = { 0 };
+    size_t cold_sweep;
+    const char *results_path = NULL;
 
-    // Parse number of iterations if provided
-    if (argc >= 2) {
-        num_iterations = strtoul(argv[1], NULL, 10);
-        if (num_iterations == 0) {
-            fprintf(stderr, "Error: Invalid number of iterations\n");
-            printf("Usage: %s [num_iterations]\n", argv[0]);
-            printf("  num_iterations: Number of samples to collect (default: 200000)\n");
-            return 1;
+    while ((opt = getopt(argc, argv, "HRe:lp:d:Aw:t:C:Lr:U")) != -1) {
+        switch (opt) {
+        case 'H': use_hist = 1; break;
+        case 'R': raw_only = 1; break;
+        case 'p':
+            cpus = parse_cpus(optarg);
+            if (!cpus) {
+                fprintf(stderr, "Error: Invalid CPU list '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case 'd': duration_ms = strtoul(optarg, NULL, 10); break;
+        case 'A': adaptive = 1; break;
+        case 'w': width = atof(optarg) / 100.0; break;
+        case 't': budget = atof(optarg); break;
+        case 'C':
+            if (cold_parse(optarg, &cold_req.flags, &cold_sweep) < 0) num_iterations = 0;
+            cold_req.sweep_bytes = cold_sweep;
+            break;
+        case 'L': load = 1; break;
+        case 'r': results_path = optarg; break;
+        case 'U': force = 1; break;
+        case 'e':
+            nids = exit_parse_list(optarg, ids, EXIT_COUNT);
+            if (nids < 0) return 1;
+            break;
+        case 'l': exit_print_catalog(); return 0;
+        default: num_iterations = 0; break;
         }
     }
+    // Parse number of iterations if provided
+    if (optind < argc) {
+        num_iterations = strtoul(argv[optind], NULL, 10);
+        n_given = 1;
+    }
+    if (num_iterations == 0) {
+        fprintf(stderr, "Error: Invalid number of iterations\n");
+        printf("Usage: %s [-H] [-R] [-e exit,...] [-l] [-p cpus] [-d ms] [-A [-w pct] [-t sec]]\n"
+               "          [-C cold] [-L] [-r results] [-U] [num_iterations]\n", argv[0]);
+        printf("  -H: stream into an in-kernel histogram instead of storing the samples\n");
+        printf("      (no limit on num_iterations; with -d and no num_iterations, run for -d)\n");
+        printf("  -R: raw statistics only (no timer calibration / baseline correction)\n");
+        printf("  -e: catalog entries to measure (default: CPUID_0,HC_INVALID,OUT_E9)\n");
+        printf("  -l: list the exit catalog\n");
+        printf("  -p: run on these CPUs at once, one pinned kthread each (\"0-3,6\" or \"all\")\n");
+        printf("  -d: with -p or -H, stop each thread after this many ms (num_iterations caps the samples)\n");
+        printf("  -A: adaptive: sample until the median and p99 95%% CIs are narrow enough\n");
+        printf("  -w: with -A, target CI width in %% of the estimate (default: 1)\n");
+        printf("  -t: with -A, time budget per series in seconds (default: 10)\n");
+        printf("  -C: also measure cold: sweep[=size],code,stack,wbinvd,tlb disturbed before each\n");
+        printf("      sample (sweep default %u MB); prints warm and cold side by side\n",
+               COLD_DEFAULT_SWEEP >> 20);
+        printf("  -L: throughput: max exit rate, then latency from the intended start at rising\n");
+        printf("      offered load (open loop) up to the knee; num_iterations exits per point\n");
+        printf("  -r: also write a summary of every series as JSON, or CSV for a .csv file\n");
+        printf("  -U: run even if the TSC is not invariant or RDTSC exits\n");
+        printf("  num_iterations: Number of samples to collect (default: 200000, per CPU with -p,\n");
+        printf("                  the cap with -A)\n");
+        return 1;
+    }
+
+    if (adaptive && cpus) {
+        fprintf(stderr, "Error: -A cannot be combined with -p\n");
+        return 1;
+    }
+    if (cold_req.flags && (adaptive || cpus)) {
+        fprintf(stderr, "Error: -C cannot be combined with -A or -p\n");
+        return 1;
+    }
+    if (use_hist && (adaptive || cold_req.flags || results_path)) {
+        fprintf(stderr, "Error: -A, -C and -r need raw samples, not -H\n");
+        return 1;
+    }
+    if (load && (use_hist || adaptive || cold_req.flags || cpus)) {
+        fprintf(stderr, "Error: -L cannot be combined with -H, -A, -C or -p\n");
+        return 1;
+    }
+    // A histogram run with a duration and no explicit count runs for the duration
+    if (use_hist && duration_ms && !n_given)
+        num_iterations = 0;
+    adaptive_init(&adapt, width, budget);
+    if (tsc_check(&tsc, force) < 0) return 1;
+    if (results_path && results_open(&results, results_path, tsc.sample_hz) < 0) {
+        perror(results_path);
+        return 1;
+    }
 
     printf("=== Kernel Space Microbenchmark ===\n");
-    printf("Number of iterations: %lu\n\n", num_iterations);
+    if (num_iterations) printf("Number of iterations: %lu\n", num_iterations);
+    if (use_hist) printf("Streaming into an in-kernel histogram\n");
+    if (cpus) printf("Parallel on CPU mask %#lx\n", (unsigned long)cpus);
+    if (duration_ms && (cpus || use_hist)) printf("For %lu ms per thread\n", duration_ms);
+    printf("\n");
 
     // Open the device
     fd = open(DEVICE_PATH, O_RDWR);
@@ -44,36 +404,54 @@ int main(int argc, char *argv[]) {
 
     printf("Device opened successfully.\n\n");
 
-    // Test 1: CPUID (Fast Path)
-    printf("Running Test 1: CPUID instruction (fast path)...\n");
-    ret = ioctl(fd, IOCTL_RUN_FAST, num_iterations);
-    if (ret < 0) {
-        fprintf(stderr, "Error: IOCTL_RUN_FAST failed: %s\n", strerror(errno));
+    if (load) {
+        uint64_t *buf = malloc(num_iterations * sizeof(uint64_t));
+        int ret = buf ? 0 : -1;
+        for (int k = 0; k < nids && ret == 0; k++) {
+            const exit_desc_t *e = &exit_catalog[ids[k]];
+            load_ctx_t ctx = { fd, ids[k] };
+            char label[64];
+            snprintf(label, sizeof(label), "%s(kernel, %s)", e->label, e->path);
+            errno = 0;
+            ret = load_curve(load_paced, &ctx, num_iterations, buf, tsc.hz, &results, e, "kernel",
+                             label);
+            if (ret < 0)
+                fprintf(stderr, "Error: %s throughput run failed: %s\n", e->name,
+                        errno ? strerror(errno) : "no TSC frequency");
+        }
+        free(buf);
         close(fd);
-        return 1;
+        if (results_close(&results) < 0) { perror(results_path); return 1; }
+        return ret < 0 ? 1 : 0;
     }
-    printf("  ✓ Completed\n\n");
 
-    // Test 2: VMCALL
-    printf("Running Test 2: VMCALL instruction...\n");
-    ret = ioctl(fd, IOCTL_RUN_VMCALL, num_iterations);
-    if (ret < 0) {
-        fprintf(stderr, "Error: IOCTL_RUN_VMCALL failed: %s\n", strerror(errno));
-        close(fd);
-        return 1;
-    }
-    printf("  ✓ Completed\n\n");
+    // Timer overhead of the module's TSC pair, cached per boot
+    if (!raw_only && !use_hist && timing_calib_load(&calib, "kernel-" TIMING_NAME) < 0 &&
+        run_series(fd, EXIT_IOCTL(EXIT_NOP), TIMING_CALIB_SAMPLES, NULL) < 0)
+        raw_only = 1;
 
-    // Test 3: OUT instruction (Slow Path)
-    printf("Running Test 3: OUT instruction to port 0xE9 (slow path)...\n");
-    ret = ioctl(fd, IOCTL_RUN_SLOW, num_iterations);
-    if (ret < 0) {
-        fprintf(stderr, "Error: IOCTL_RUN_SLOW failed: %s\n", strerror(errno));
-        close(fd);
-        return 1;
+    for (int k = 0; k < nids; k++) {
+        const exit_desc_t *e = &exit_catalog[ids[k]];
+        char label[64];
+        current = e;
+        snprintf(label, sizeof(label), "%s(kernel, %s)", e->label, e->path);
+        printf("Running Test %d: %s...\n", k + 1, label);
+        marker_begin(e, label);
+        int ret;
+        if (use_hist) ret = run_hist(fd, ids[k], cpus, num_iterations, duration_ms, label);
+        else if (cpus) ret = run_parallel(fd, ids[k], cpus, num_iterations, duration_ms, label);
+        else if (adaptive) ret = run_adaptive(fd, EXIT_IOCTL(ids[k]), num_iterations, label);
+        else if (cold_req.flags) ret = run_cold(fd, ids[k], num_iterations, label, &cold_req);
+        else ret = run_series(fd, EXIT_IOCTL(ids[k]), num_iterations, label);
+        if (ret < 0) {
+            fprintf(stderr, "Error: %s ioctl failed: %s\n", e->name, strerror(errno));
+            close(fd);
+            return 1;
+        }
+        printf("  ✓ Completed\n\n");
     }
-    printf("  ✓ Completed\n\n");
 
     close(fd);
+    if (results_close(&results) < 0) { perror(results_path); return 1; }
     return 0;
 }
@@ -0,0 +1,89 @@
+#ifndef LOAD_H
+#define LOAD_H
+
+/* Open-loop throughput: maximum exit rate and latency vs offered load.
+ *
+ * The closed-loop series issue an exit, wait for it, time it and issue
+ * the next, so they measure the latency of a single exit but neither the
+ * rate a vCPU can sustain nor the queueing once a path saturates.
+ * load_curve() first runs the exits back to back and reports exits per
+ * second. It then offers load at fractions of that rate: each exit is due
+ * at a fixed time (EXIT_PACED_LOOP, exits.h) and its latency is measured
+ * from the due time, so an exit that is held up by the previous one
+ * carries its waiting time (no coordinated omission).
+ *
+ * Offered load rises until the knee: achieved throughput falls below
+ * LOAD_KNEE_RATE of the offered rate, or p99 exceeds LOAD_KNEE_FACTOR
+ * times its value at the lightest load. Each point goes to the results
+ * file as "<label> @ <rate>/s".
+ *
+ * Usage, with run() executing n exits due every interval TSC cycles into
+ * s (interval 0 and s NULL: back to back, untimed) and returning the TSC
+ * cycles from the first due time to the end of the last exit:
+ *
+ *     load_curve(run, ctx, n, buf, tsc.hz, &results, e, "user", label);
+ *
+ * Pacing and latencies are in TSC ticks (timing_tsc_start, timing.h)
+ * under every timing strategy, so tsc_hz is the TSC frequency itself.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include "stats.h"
+#include "results.h"
+
+#define LOAD_KNEE_RATE   0.95
+#define LOAD_KNEE_FACTOR 10.0
+
+typedef uint64_t (*load_run_fn)(void *ctx, uint64_t interval, size_t n, stats_t *s);
+
+/* Offered load as a fraction of the maximum rate */
+static const double load_fractions[] = {
+    0.1, 0.25, 0.5, 0.6, 0.7, 0.8, 0.85, 0.9, 0.95, 1.0, 1.1, 1.25, 1.5
+};
+
+/* Max-rate run, then the paced sweep up to the knee
+ * buf: room for n samples
+ * Returns 0, or -1 if a run failed or the TSC frequency is unknown.
+ */
+static inline int load_curve(load_run_fn run, void *ctx, size_t n, uint64_t *buf,
+                             double tsc_hz, results_t *r, const exit_desc_t *e,
+                             const char *context, const char *label)
+{
+    static const double pcts[] = { 50.0, 99.0, 99.9 };
+    double hz = tsc_hz, base_p99 = 0.0;
+
+    if (hz <= 0.0 || n == 0) return -1;
+    uint64_t cycles = run(ctx, 0, n, NULL);
+    if (cycles == 0) return -1;
+    double max_rate = n * hz / cycles;
+
+    printf("=== Throughput: %s ===\n", label);
+    printf("Max rate: %.0f exits/s back to back (%.1f cycles per exit)\n", max_rate,
+           (double)cycles / n);
+    printf("Latency from the intended start, %zu exits per point:\n", n);
+    printf("%6s %12s %12s %10s %10s %10s %10s %10s\n", "load", "offered/s", "achieved/s",
+           "p50", "p99", "p99.9", "max", "p99 ns");
+    for (size_t i = 0; i < sizeof(load_fractions) / sizeof(load_fractions[0]); i++) {
+        double offered = load_fractions[i] * max_rate, p[3];
+        stats_t s;
+        stats_init(&s, buf, n);
+        cycles = run(ctx, (uint64_t)(hz / offered), n, &s);
+        if (cycles == 0) return -1;
+        double achieved = n * hz / cycles;
+        stats_percentiles(&s, pcts, p, 3);
+        if (i == 0) base_p99 = p[1];
+        int knee = achieved < LOAD_KNEE_RATE * offered || p[1] > LOAD_KNEE_FACTOR * base_p99;
+        printf("%5.0f%% %12.0f %12.0f %10.1f %10.1f %10.1f %10lu %10.1f%s\n",
+               100.0 * load_fractions[i], offered, achieved, p[0], p[1], p[2], stats_max(&s),
+               p[1] * 1e9 / hz, knee ? "  <- knee" : "");
+        char plabel[128];
+        snprintf(plabel, sizeof(plabel), "%s @ %.0f/s", label, offered);
+        results_add(r, &s, plabel, e, context);
+        if (knee) break;
+    }
+    printf("====================================\n\n");
+    return 0;
+}
+
+#endif /* LOAD_H */
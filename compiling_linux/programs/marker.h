@@ -0,0 +1,71 @@
+#ifndef MARKER_H
+#define MARKER_H
+
+/* Series boundaries on the console, for host/kvm-exit-stats.
+ *
+ * With KVM_MB_MARKERS set in the environment (e.g. on the kernel command
+ * line through qemu.sh, or in the guest shell) the harnesses print
+ *
+ *   @@kvm-mb begin <exit> <path> <label>
+ *   @@kvm-mb end <exit> <iterations>
+ *
+ * around every series. The host reads the guest console through
+ * kvm-exit-stats, which snapshots the KVM exit counters on each line.
+ * The console is slow, so after a marker the harness waits until the line
+ * has left the serial port and then sleeps MARKER_SETTLE_MS, so the host
+ * snapshot falls between the series and not into one. Exits of the idle
+ * guest during that window (timer ticks, the marker itself) still land in
+ * the counts; they are small against a series of 10^5 iterations.
+ *
+ * Without KVM_MB_MARKERS nothing is printed and nothing waits.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <termios.h>
+#include <unistd.h>
+#include "exits.h"
+
+#define MARKER_ENV       "KVM_MB_MARKERS"
+#define MARKER_PREFIX    "@@kvm-mb"
+#define MARKER_SETTLE_MS 100
+
+static inline int marker_enabled(void)
+{
+    static int enabled = -1;
+    if (enabled < 0) {
+        const char *v = getenv(MARKER_ENV);
+        enabled = v && *v && strcmp(v, "0") != 0;
+    }
+    return enabled;
+}
+
+/* Push the line out to the host and give it time to take its snapshot */
+static inline void marker_settle(void)
+{
+    struct timespec ts = { 0, MARKER_SETTLE_MS * 1000000L };
+
+    fflush(stdout);
+    tcdrain(STDOUT_FILENO);     /* fails harmlessly when stdout is not a tty */
+    nanosleep(&ts, NULL);
+}
+
+static inline void marker_begin(const exit_desc_t *e, const char *label)
+{
+    if (!marker_enabled()) return;
+    printf(MARKER_PREFIX " begin %s %s %s\n", e->name, e->path, label);
+    marker_settle();
+}
+
+/* iterations: exits executed by the series, including dropped samples */
+static inline void marker_end(const exit_desc_t *e, uint64_t iterations)
+{
+    if (!marker_enabled()) return;
+    printf(MARKER_PREFIX " end %s %lu\n", e->name, iterations);
+    marker_settle();
+}
+
+#endif /* MARKER_H */
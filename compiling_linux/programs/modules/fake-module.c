@@ -3,20 +3,177 @@
 #include <linux/fs.h>
 #include <linux/cdev.h>
 #include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/sched.h>
+#include <linux/sched/signal.h>
 #include <linux/sort.h>
 #include <linux/kernel.h>
 #include <linux/types.h>
 #include <asm/msr.h>
 #include <asm/processor.h>
+#include "../timing.h"
+#include "../exits.h"
+#include "kvm-fake-ring.h"
 
 static dev_t devno;
 static struct cdev cdev;
 static struct class *cls;
 
+// Legacy commands; EXIT_IOCTL(id) runs one entry of the exits.h catalog
 #define IOCTL_RUN_VMCALL   _IOW('v', 1, unsigned long)  // does vmcall
 #define IOCTL_RUN_CPUID     _IOW('v', 2, unsigned long)  // does cpuid
 #define IOCTL_RUN_OUTB     _IOW('v', 3, unsigned long)  // does out 0xE9 from kernel
 
+#define RING_SIZE PAGE_ALIGN(sizeof(struct kvm_fake_ring))
+#define RING_CHUNK 4096     // executions between reschedule points
+
+static inline void ring_exec(u32 op, u32 arg){
+    switch (op) {
+    case KVM_FAKE_OP_CPUID: {
+        int ax=arg, bx, cx=0, dx;
+        asm volatile("cpuid":"+a"(ax), "=b"(bx), "+c"(cx), "=d"(dx));
+        break;
+    }
+    case KVM_FAKE_OP_VMCALL: {
+        unsigned long ax = arg;
+        asm volatile("vmcall" : "+a"(ax) : : "memory");
+        break;
+    }
+    case KVM_FAKE_OP_OUTB:
+        asm volatile("outb %b0, %w1":: "a"('T'), "Nd"((u16)arg) : "memory");
+        break;
+    case KVM_FAKE_OP_NOP:
+        break;
+    }
+}
+
+// One execution of catalog entry id (exits.h)
+static void exec_exit(int id){
+    unsigned long irqflags = 0;
+
+#define EXEC_CASE(name, label, path, priv, flags, setup, body) \
+    case EXIT_##name: {                                         \
+        if ((flags) & EXIT_F_IRQS_OFF) local_irq_save(irqflags);\
+        uint64_t arg = (setup);                                 \
+        (void)arg;                                              \
+        body;                                                   \
+        if ((flags) & EXIT_F_IRQS_OFF) local_irq_restore(irqflags); \
+        break;                                                  \
+    }
+    switch (id) {
+    EXIT_CATALOG(EXEC_CASE)
+    }
+#undef EXEC_CASE
+}
+
+// repeat executions of catalog entry id from the ring, each one timed or
+// all of them at once (added to *batch); one specialised loop per entry
+static u32 ring_exit(int id, struct kvm_fake_ring *ring, u32 cq_tail, u32 repeat, int each,
+                     u64 *batch){
+    u32 i;
+
+#define CQ_PUSH(v) (ring->cq[cq_tail++ & (KVM_FAKE_CQ_ENTRIES - 1)] = (v))
+#define RING_CASE(name, label, path, priv, flags, setup, body)  \
+    case EXIT_##name:                                           \
+        if (each) {                                             \
+            EXIT_TIMED_LOOP(repeat, setup, body, CQ_PUSH);      \
+        } else {                                                \
+            uint64_t arg = (setup);                             \
+            (void)arg;                                          \
+            u64 t0 = rdtsc_serialized_start();                  \
+            for (i = 0; i < repeat; i++) { body; }              \
+            u64 t1 = rdtsc_serialized_end();                    \
+            *batch += t1 - t0;                                  \
+        }                                                       \
+        break;
+    switch (id) {
+    EXIT_CATALOG(RING_CASE)
+    }
+#undef RING_CASE
+#undef CQ_PUSH
+    return cq_tail;
+}
+
+// Same for the KVM_FAKE_OP_* operations
+static u32 ring_ops(u32 op, u32 arg, struct kvm_fake_ring *ring, u32 cq_tail, u32 repeat,
+                    int each, u64 *batch){
+    u32 i;
+
+    if (each) {
+        for (i = 0; i < repeat; i++) {
+            u64 t0 = rdtsc_serialized_start();
+            ring_exec(op, arg);
+            u64 t1 = rdtsc_serialized_end();
+            ring->cq[cq_tail++ & (KVM_FAKE_CQ_ENTRIES - 1)] = t1 - t0;
+        }
+    } else {
+        u64 t0 = rdtsc_serialized_start();
+        for (i = 0; i < repeat; i++)
+            ring_exec(op, arg);
+        u64 t1 = rdtsc_serialized_end();
+        *batch += t1 - t0;
+    }
+    return cq_tail;
+}
+
+static bool ring_op_valid(u32 op){
+    if (op >= KVM_FAKE_OP_CPUID && op <= KVM_FAKE_OP_NOP)
+        return true;
+    op -= KVM_FAKE_OP_EXIT_BASE;
+    return op < EXIT_COUNT && !(exit_catalog[op].flags & EXIT_F_IRQS_OFF);
+}
+
+// Run every queued submission. A submission is only consumed if the
+// completion queue has room for all of its completions. Long submissions
+// run in RING_CHUNK pieces with a reschedule point in between (a batch
+// timed as a whole leaves the reschedules out of its time), and a fatal
+// signal abandons the submission in progress.
+static long run_ring(struct kvm_fake_ring *ring){
+    u32 sq_head = READ_ONCE(ring->sq_head);
+    u32 sq_tail = smp_load_acquire(&ring->sq_tail);
+    u32 cq_tail = ring->cq_tail;
+    long done = 0;
+
+    if (sq_tail - sq_head > KVM_FAKE_SQ_ENTRIES)
+        return -EINVAL;
+
+    while (sq_head != sq_tail) {
+        struct kvm_fake_sqe sqe = ring->sq[sq_head & (KVM_FAKE_SQ_ENTRIES - 1)];
+        u32 repeat = sqe.repeat ? sqe.repeat : 1;
+        int each = sqe.flags & KVM_FAKE_TIME_EACH;
+        u32 need = each ? repeat : 1;
+        u64 batch = 0;
+        u32 i, c;
+
+        if (!ring_op_valid(sqe.op))
+            return done ? done : -EINVAL;
+        if (repeat > KVM_FAKE_MAX_REPEAT)
+            return done ? done : -EINVAL;
+        if (need > KVM_FAKE_CQ_ENTRIES - (cq_tail - READ_ONCE(ring->cq_head)))
+            break;
+
+        for (i = 0; i < repeat; i += c) {
+            c = min_t(u32, repeat - i, RING_CHUNK);
+            if (sqe.op >= KVM_FAKE_OP_EXIT_BASE)
+                cq_tail = ring_exit(sqe.op - KVM_FAKE_OP_EXIT_BASE, ring, cq_tail, c, each, &batch);
+            else
+                cq_tail = ring_ops(sqe.op, sqe.arg, ring, cq_tail, c, each, &batch);
+            cond_resched();
+            if (fatal_signal_pending(current))
+                return done ? done : -EINTR;
+        }
+        if (!each)
+            ring->cq[cq_tail++ & (KVM_FAKE_CQ_ENTRIES - 1)] = batch;
+
+        sq_head++;
+        done++;
+        smp_store_release(&ring->cq_tail, cq_tail);
+        WRITE_ONCE(ring->sq_head, sq_head);
+    }
+    return done;
+}
+
 static long dev_ioctl(struct file *f, unsigned int cmd, unsigned long arg){
 
     switch (cmd) {
@@ -33,14 +190,40 @@ static long dev_ioctl(struct file *f, unsigned int cmd, unsigned long arg){
             asm volatile("outb %b0, %w1":: "a"('T'), "Nd"(0xe9) : "memory");
             break;
         }
-        default: return -EINVAL;
+        case IOCTL_RUN_RING:
+            if (!f->private_data) return -EINVAL;
+            return run_ring(f->private_data);
+        default: {
+            int id = exit_ioctl_id(cmd);
+            if (id < 0) return -EINVAL;
+            exec_exit(id);
+            break;
+        }
     }
     return 0;
 }
 
+// Each open file gets its own ring, mapped into user space with mmap
+static int dev_open(struct inode *inode, struct file *f){
+    f->private_data = vmalloc_user(RING_SIZE);
+    return f->private_data ? 0 : -ENOMEM;
+}
+
+static int dev_release(struct inode *inode, struct file *f){
+    vfree(f->private_data);
+    return 0;
+}
+
+static int dev_mmap(struct file *f, struct vm_area_struct *vma){
+    return remap_vmalloc_range(vma, f->private_data, vma->vm_pgoff);
+}
+
 static const struct file_operations fops = {
     .owner = THIS_MODULE,
     .unlocked_ioctl = dev_ioctl,
+    .open = dev_open,
+    .release = dev_release,
+    .mmap = dev_mmap,
 };
 
 static int __init fake_init(void){
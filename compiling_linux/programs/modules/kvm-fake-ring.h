@@ -0,0 +1,57 @@
+/* Shared-memory submission/completion ring between user space and
+ * fake-module (/dev/kvm-fake). Included by both sides.
+ *
+ * User space mmaps the ring, queues operations in the submission queue
+ * (sq) and issues one IOCTL_RUN_RING. The module executes them, writes TSC
+ * deltas to the completion queue (cq), and returns the number of
+ * submissions it consumed. One syscall can drive thousands of exits.
+ *
+ * Both queues are single-producer/single-consumer rings indexed by
+ * free-running head/tail counters; sizes are powers of two.
+ */
+#ifndef KVM_FAKE_RING_H
+#define KVM_FAKE_RING_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define KVM_FAKE_SQ_ENTRIES 256
+#define KVM_FAKE_CQ_ENTRIES 65536
+#define KVM_FAKE_MAX_REPEAT KVM_FAKE_CQ_ENTRIES   // larger repeats get -EINVAL
+
+#define IOCTL_RUN_RING     _IO('v', 4)      // runs all queued submissions
+
+enum kvm_fake_op {
+    KVM_FAKE_OP_CPUID  = 1,     // arg: CPUID leaf (EAX)
+    KVM_FAKE_OP_VMCALL = 2,     // arg: hypercall number (RAX)
+    KVM_FAKE_OP_OUTB   = 3,     // arg: I/O port
+    KVM_FAKE_OP_NOP    = 4,     // empty body, for timer overhead calibration
+};
+
+// Any entry of the exits.h catalog (arg unused). Entries that need
+// interrupts disabled are rejected; run those in mesurement-module.
+#define KVM_FAKE_OP_EXIT_BASE 0x100
+#define KVM_FAKE_OP_EXIT(id)  (KVM_FAKE_OP_EXIT_BASE + (id))
+
+// sqe.flags
+#define KVM_FAKE_TIME_EACH  0x1 // one completion per execution; otherwise one
+                                // completion for all `repeat` executions
+
+struct kvm_fake_sqe {
+    __u32 op;
+    __u32 arg;
+    __u32 repeat;               // number of executions, 0 is treated as 1;
+                                // at most KVM_FAKE_MAX_REPEAT
+    __u32 flags;
+};
+
+struct kvm_fake_ring {
+    __u32 sq_head;              // consumed by the module
+    __u32 sq_tail;              // produced by user space
+    __u32 cq_head;              // consumed by user space
+    __u32 cq_tail;              // produced by the module
+    struct kvm_fake_sqe sq[KVM_FAKE_SQ_ENTRIES];
+    __u64 cq[KVM_FAKE_CQ_ENTRIES];  // TSC deltas
+};
+
+#endif /* KVM_FAKE_RING_H */
@@ -0,0 +1,82 @@
+/* Parallel, cold, streaming and paced modes of mesurement-module (/dev/kvm-microbench).
+ * Included by both sides.
+ *
+ * IOCTL_RUN_PARALLEL starts one kthread per CPU in `cpus`, each bound to
+ * its CPU. The threads meet at a start barrier, so their exits overlap,
+ * then each one runs the catalog entry for `samples` samples or until
+ * `duration_us` has passed. The ioctl returns once every thread has
+ * signalled completion, with the total number of samples.
+ *
+ * The samples stay in the fd's buffer (mmap the device): the k-th CPU
+ * of the mask owns slots [k * stride, k * stride + count[k]).
+ */
+#ifndef KVM_MICROBENCH_H
+#define KVM_MICROBENCH_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define KVM_MB_MAX_CPUS 64
+
+struct kvm_mb_parallel {
+    __u32 exit_id;              // exits.h catalog id
+    __u32 flags;                // must be 0
+    __u64 cpus;                 // bit mask of CPUs, one thread each
+    __u64 samples;              // samples per CPU (size of its slice)
+    __u64 duration_us;          // stop after this long, 0 = take all samples
+    __u64 stride;               // out: slots per CPU slice (cache-line multiple)
+    __u64 count[KVM_MB_MAX_CPUS];   // out: samples taken, in mask order
+};
+
+#define IOCTL_RUN_PARALLEL _IOWR('v', 5, struct kvm_mb_parallel)
+
+/* Cold mode (cold.h): until reset with flags = 0, every loop of the
+ * module disturbs caches/TLB before each sample. The sweep buffer is
+ * allocated by the module.
+ */
+struct kvm_mb_cold {
+    __u32 flags;                // COLD_* from cold.h, 0 = warm
+    __u32 reserved;             // must be 0
+    __u64 sweep_bytes;          // with COLD_SWEEP, at most COLD_MAX_SWEEP
+};
+
+#define IOCTL_SET_COLD _IOW('v', 6, struct kvm_mb_cold)
+
+/* Streaming mode: fold the samples into a histogram (hist.h) instead of
+ * storing them, so a run is bounded by time rather than memory. With
+ * cpus = 0 the calling thread measures, otherwise one pinned kthread per
+ * CPU as with IOCTL_RUN_PARALLEL; their histograms are merged and the
+ * buckets copied to counts_ptr.
+ */
+#define KVM_MB_HIST_MAX_PRECISION 10
+
+struct kvm_mb_hist {
+    __u32 exit_id;              // exits.h catalog id
+    __u32 precision;            // hist.h sub-bucket bits, 0 = default
+    __u64 cpus;                 // bit mask of CPUs, 0 = calling thread
+    __u64 samples;              // per thread, 0 = until duration_us
+    __u64 duration_us;          // stop after this long, 0 = take all samples
+    __u64 counts_ptr;           // user buffer of nbuckets counters
+    __u64 nbuckets;             // at least HIST_BUCKETS(precision)
+    __u64 count, min, max, sum; // out: summary of the merged histogram
+};
+
+#define IOCTL_RUN_HIST _IOWR('v', 7, struct kvm_mb_hist)
+
+/* Throughput mode (load.h): with interval = 0 the entry runs `samples`
+ * times back to back, untimed. Otherwise exit i is due at start + i *
+ * interval TSC cycles and its sample is the time from that due time to
+ * its end (open loop, EXIT_PACED_LOOP). The samples land in the fd's
+ * buffer as with EXIT_IOCTL; the ioctl returns their count.
+ */
+struct kvm_mb_paced {
+    __u32 exit_id;              // exits.h catalog id
+    __u32 flags;                // must be 0
+    __u64 samples;
+    __u64 interval;             // TSC cycles between due times, 0 = back to back
+    __u64 cycles;               // out: first due time to the end of the last exit
+};
+
+#define IOCTL_RUN_PACED _IOWR('v', 8, struct kvm_mb_paced)
+
+#endif /* KVM_MICROBENCH_H */
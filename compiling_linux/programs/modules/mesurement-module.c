@@ -3,119 +3,802 @@
 #include <linux/fs.h>
 #include <linux/cdev.h>
 #include <linux/slab.h>
-#include <linux/sort.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
 #include <linux/kernel.h>
 #include <linux/types.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/cpumask.h>
+#include <linux/timekeeping.h>
+#include <linux/math64.h>
+#include <linux/mutex.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/sched.h>
 #include <asm/msr.h>
 #include <asm/processor.h>
+#include <asm/msr-index.h>
+#include <asm/tsc.h>
+#include <asm/cpufeature.h>
+#include "../timing.h"
+#include "../exits.h"
+#include "../cold.h"
+#include "../hist.h"
+#include "../stats_select.h"
+#include "kvm-microbench.h"
 
 static dev_t devno;
 static struct cdev cdev;
 static struct class *cls;
 
-static inline u64 tsc_start(void){
-    unsigned int a,d;
-    asm volatile("cpuid" : : "a"(0) : "rbx","rcx","rdx");
-    asm volatile("rdtsc" : "=a"(a), "=d"(d));
-    return ((u64)d<<32)|a;
-}
-static inline u64 tsc_end(void){
-    unsigned int a,d,c;
-    asm volatile("rdtscp" : "=a"(a), "=d"(d), "=c"(c));
-    asm volatile("lfence");
-    return ((u64)d<<32)|a;
-}
-
+// Legacy commands; EXIT_IOCTL(id) runs any entry of the exits.h catalog
 #define IOCTL_RUN_VMCALL   _IOW('v', 1, unsigned long)  // runs N vmcall
-#define IOCTL_RUN_FAST     _IOW('v', 2, unsigned long)  // runs N vmcall
+#define IOCTL_RUN_FAST     _IOW('v', 2, unsigned long)  // runs N cpuid
 #define IOCTL_RUN_SLOW     _IOW('v', 3, unsigned long)  // runs N out 0xE9 from kernel
+#define IOCTL_RUN_EMPTY    _IOW('v', 4, unsigned long)  // runs N empty bodies (timer overhead)
 
-static u64 *samples;
-static size_t S;
+// Per-open state: every file descriptor has its own sample buffer and
+// cold-mode settings, so several processes (or threads with their own
+// fd) can measure at once. The lock serialises runs, reconfiguration and
+// mmap on one fd; runs on different fds proceed in parallel.
+struct mb_file {
+    struct mutex lock;
+    // vmalloc_user() so user space can mmap it and read the raw samples
+    // of the last run in place (see dev_mmap). Not kvmalloc: a kmalloc'ed
+    // buffer could not be mapped with remap_vmalloc_range.
+    u64 *samples;
+    size_t S;
+    atomic_t mappings;
+    cold_t cold;        // IOCTL_SET_COLD: caches/TLB disturbed before each sample
+};
 
-static int cmp_u64(const void *a, const void *b)
-{
-    u64 x = *(const u64 *)a;
-    u64 y = *(const u64 *)b;
-    if (x < y) return -1;
-    if (x > y) return 1;
-    return 0;
+// Isolation mode: run the loops in chunks of this many samples with
+// interrupts and preemption disabled, re-enabling them in between so a
+// long series cannot stall the CPU. 0 keeps both enabled.
+#define ISOLATE_MAX_CHUNK 4096
+static unsigned int isolate_chunk;
+module_param(isolate_chunk, uint, 0644);
+MODULE_PARM_DESC(isolate_chunk, "samples per IRQs-off chunk, 0 = off (max 4096)");
+
+// Summary of the last run (of any fd), published in debugfs under
+// kvm-microbench/: "summary" (key: value) and "percentiles" (one row per
+// series). Percentiles use the rank interpolation of stats.h; values are
+// kept in cycles x 100.
+#define MB_NPCTS 9
+static const unsigned int mb_pcts[MB_NPCTS] = { 100, 500, 2500, 5000, 7500, 9000, 9500, 9900, 9990 };
+static const char *const mb_pct_names[MB_NPCTS] = {
+    "p1", "p5", "p25", "p50", "p75", "p90", "p95", "p99", "p99.9"
+};
+
+struct mb_series {
+    char what[16];              // "ioctl", "cpu3", "hist"
+    u64 count, min, max;
+    u64 mean;                   // x 100
+    u64 pct[MB_NPCTS];          // x 100
+};
+
+struct mb_run {
+    const char *exit;
+    const char *mode;           // "ioctl", "parallel" or "hist"
+    pid_t pid;
+    unsigned int precision;     // hist mode: relative error 2^-precision, 0 = exact
+    unsigned int nseries;
+    struct mb_series series[];
+};
+
+static DEFINE_MUTEX(last_lock);
+static struct mb_run *last_run;
+static struct dentry *dbg_dir;
+
+// NULL on allocation failure; the run is then only reported to the log
+static struct mb_run *run_alloc(int id, const char *mode, unsigned int nseries){
+    struct mb_run *run = kzalloc(struct_size(run, series, nseries), GFP_KERNEL);
+
+    if (run) {
+        run->exit = exit_catalog[id].name;
+        run->mode = mode;
+        run->pid = task_pid_nr(current);
+        run->nseries = nseries;
+    }
+    return run;
 }
 
-static long dev_ioctl(struct file *f, unsigned int cmd, unsigned long arg){
-    size_t N = arg ? arg : 200000;
-    if (!samples || S < N) {
-        kfree(samples);
-        samples = kmalloc_array(N, sizeof(u64), GFP_KERNEL);
-        if (!samples)
+static void run_publish(struct mb_run *run){
+    struct mb_run *old;
+
+    if (!run)
+        return;
+    mutex_lock(&last_lock);
+    old = last_run;
+    last_run = run;
+    mutex_unlock(&last_lock);
+    kfree(old);
+}
+
+// Run n samples of catalog entry id into out; every entry gets its own
+// inlined loop (exits.h), and a second one for cold mode
+static void run_loop(const cold_t *cold, int id, u64 *out, size_t n){
+#define RECORD(v) (*out++ = (v))
+#define RUN_CASE(name, label, path, priv, flags, setup, body) \
+    case EXIT_##name: EXIT_TIMED_LOOP(n, setup, body, RECORD); break;
+#define COLD_CASE(name, label, path, priv, flags, setup, body) \
+    case EXIT_##name: EXIT_COLD_LOOP(n, setup, body, RECORD, cold_disturb(cold)); break;
+    if (cold->flags) {
+        switch (id) {
+        EXIT_CATALOG(COLD_CASE)
+        }
+        return;
+    }
+    switch (id) {
+    EXIT_CATALOG(RUN_CASE)
+    }
+#undef COLD_CASE
+#undef RUN_CASE
+#undef RECORD
+}
+
+static long set_cold(struct mb_file *mf, struct kvm_mb_cold __user *ureq){
+    struct kvm_mb_cold req;
+    u8 *buf = NULL;
+
+    if (copy_from_user(&req, ureq, sizeof(req)))
+        return -EFAULT;
+    if ((req.flags & ~COLD_ALL_FLAGS) || req.reserved)
+        return -EINVAL;
+    if (req.flags & COLD_SWEEP) {
+        if (!req.sweep_bytes || req.sweep_bytes > COLD_MAX_SWEEP)
+            return -EINVAL;
+        buf = vzalloc(req.sweep_bytes);
+        if (!buf)
             return -ENOMEM;
-        S = N;
     }
-    size_t i;
+    vfree((void *)mf->cold.sweep);
+    mf->cold.sweep = buf;
+    mf->cold.sweep_bytes = buf ? req.sweep_bytes : 0;
+    mf->cold.flags = req.flags;
+    printk(KERN_INFO "kvm-microbench: cold flags=%#x sweep=%llu\n", req.flags,
+           (unsigned long long)mf->cold.sweep_bytes);
+    return 0;
+}
 
-    // Print command as a string
-    const char *cmd_str = "unknown";
+// Legacy ioctl numbers map onto catalog entries
+static int cmd_to_exit(unsigned int cmd){
     switch (cmd) {
-    case IOCTL_RUN_VMCALL: cmd_str = "IOCTL_RUN_VMCALL"; break;
-    case IOCTL_RUN_FAST: cmd_str = "IOCTL_RUN_FAST"; break;
-    case IOCTL_RUN_SLOW: cmd_str = "IOCTL_RUN_SLOW"; break;
+    case IOCTL_RUN_VMCALL: return EXIT_HC_INVALID;
+    case IOCTL_RUN_FAST: return EXIT_CPUID_0;
+    case IOCTL_RUN_SLOW: return EXIT_OUT_E9;
+    case IOCTL_RUN_EMPTY: return EXIT_NOP;
     }
-    printk(KERN_INFO "kvm-microbench: ioctl cmd=%s N=%zu\n", cmd_str, N);
+    return exit_ioctl_id(cmd);
+}
 
-    switch (cmd) {
-    case IOCTL_RUN_FAST:
-        for (i=0;i<N;i++) {
-            u64 t0 = tsc_start();
-            int ax=0x0, bx, cx, dx;
-            asm volatile("cpuid":"+a"(ax), "=b"(bx), "=c"(cx), "=d"(dx));
-            u64 t1 = tsc_end();
-            samples[i] = t1 - t0;
-        }
-        break;
-    case IOCTL_RUN_VMCALL:
-        for (i=0;i<N;i++) {
-            u64 t0 = tsc_start();
-            asm volatile("vmcall" ::: "memory");
-            u64 t1 = tsc_end();
-            samples[i] = t1 - t0;
+// Grow the fd's sample buffer to hold n samples (mf->lock held)
+static int samples_reserve(struct mb_file *mf, size_t n){
+    if (mf->samples && mf->S >= n)
+        return 0;
+    // Never free a buffer that user space still has mapped
+    if (atomic_read(&mf->mappings) > 0)
+        return -EBUSY;
+    if (n > SIZE_MAX / sizeof(u64))
+        return -EINVAL;
+    vfree(mf->samples);
+    mf->samples = vmalloc_user(n * sizeof(u64));
+    if (!mf->samples) {
+        mf->S = 0;
+        return -ENOMEM;
+    }
+    mf->S = n;
+    return 0;
+}
+
+struct run_stats {
+    unsigned int chunks, smi_chunks;
+};
+
+// Run up to n samples of entry id into out. With a deadline (ktime ns)
+// the run stops at the first chunk boundary past it. With hist (streaming
+// mode) out only holds one chunk, which is folded into hist after every
+// chunk, so n is not bounded by memory. Returns the number of samples taken.
+static size_t run_chunked(const cold_t *cold, int id, u64 *out, size_t n, u64 deadline,
+                          hist_t *hist, struct run_stats *rs){
+    int irqs_off = isolate_chunk || (exit_catalog[id].flags & EXIT_F_IRQS_OFF);
+    size_t i, chunk;
+
+    // In isolation mode no interrupt or preemption can land inside a chunk;
+    // only SMIs (and the host descheduling the vCPU) still can
+    // Every run is chunked with a reschedule point in between: N may be
+    // tens of millions of slow exits, minutes in a single ioctl
+    if (irqs_off)
+        chunk = min_t(size_t, isolate_chunk ? isolate_chunk : ISOLATE_MAX_CHUNK, ISOLATE_MAX_CHUNK);
+    else
+        chunk = ISOLATE_MAX_CHUNK;
+    for (i = 0; i < n; i += chunk) {
+        size_t end = i + min(n - i, chunk);
+        u64 *dst = hist ? out : out + i;
+        unsigned long flags = 0;
+        u64 smi0 = 0, smi1 = 0;
+        int have_smi = 0;
+
+        if (irqs_off) {
+            preempt_disable();
+            local_irq_save(flags);
+            have_smi = !rdmsrl_safe(MSR_SMI_COUNT, &smi0);
         }
-        break;
-    case IOCTL_RUN_SLOW:
-        for (i=0;i<N;i++) {
-            u64 t0 = tsc_start();
-            asm volatile("outb %b0, %w1":: "a"('T'), "Nd"(0xe9) : "memory");
-            u64 t1 = tsc_end();
-            samples[i] = t1 - t0;
+        run_loop(cold, id, dst, end - i);
+        if (irqs_off) {
+            if (have_smi && !rdmsrl_safe(MSR_SMI_COUNT, &smi1) && smi1 != smi0)
+                rs->smi_chunks++;
+            local_irq_restore(flags);
+            preempt_enable();
+            rs->chunks++;
         }
-        break;
-    default: return -EINVAL;
+        if (hist)
+            hist_record_samples(hist, dst, end - i);
+        cond_resched();
+        if (deadline && ktime_get_ns() >= deadline)
+            return end;
     }
+    return n;
+}
+
+// TSC cycles to ns with the kernel's own TSC calibration (0 if it has none,
+// or if the samples are not TSC cycles)
+static u64 cyc2ns(u64 cycles)
+{
+    // APERF cycles (TIMING_RDPRU) have no fixed rate
+    if (!TIMING_COUNTS_TSC)
+        return 0;
+    return tsc_khz ? div_u64(cycles * 1000000, tsc_khz) : 0;
+}
 
-    // compute p50,p90,p99
-    sort(samples, N, sizeof(u64), cmp_u64, NULL);    
-    u64 p50 = samples[(N * 50) / 100];
-    u64 p90 = samples[(N * 90) / 100];
-    u64 p99 = samples[(N * 99) / 100];
-    // calculate average
+// Print a series summary in cycles and in ns, and keep it in run (if any)
+static void series_publish(struct mb_run *run, unsigned int k, const struct mb_series *sr){
+    static const int show[] = { 3, 5, 7 };     // p50, p90, p99
+    unsigned long long q[4];
+    int i;
+
+    q[0] = sr->mean;
+    for (i = 0; i < 3; i++)
+        q[i + 1] = sr->pct[show[i]];
+    printk(KERN_INFO "kvm-microbench: %s %llu samples: min=%llu max=%llu avg=%llu.%02llu p50=%llu.%02llu p90=%llu.%02llu p99=%llu.%02llu\n",
+           sr->what, (unsigned long long)sr->count, (unsigned long long)sr->min,
+           (unsigned long long)sr->max, q[0] / 100, q[0] % 100, q[1] / 100, q[1] % 100,
+           q[2] / 100, q[2] % 100, q[3] / 100, q[3] % 100);
+    for (i = 0; i < 4; i++)
+        q[i] = cyc2ns(q[i]) / 100;
+    printk(KERN_INFO "kvm-microbench: %s in ns (tsc %u kHz): min=%llu max=%llu avg=%llu p50=%llu p90=%llu p99=%llu\n",
+           sr->what, tsc_khz, (unsigned long long)cyc2ns(sr->min), (unsigned long long)cyc2ns(sr->max), q[0], q[1], q[2], q[3]);
+    if (run && k < run->nseries)
+        run->series[k] = *sr;
+}
+
+// Summarise n samples into series k of run: selection instead of a sort,
+// O(N) per rank. Selection reorders, so it runs on a copy: v is the
+// buffer user space maps, in recording order.
+static void report(struct mb_run *run, unsigned int k, const char *what, const u64 *v, size_t n){
+    struct mb_series sr = { .count = n };
+    u64 *copy;
+    size_t i;
     u64 sum = 0;
-    for (i = 0; i < N; i++) {
-        sum += samples[i];
-    }
-    u64 avg = sum / N;
-    // max min
-    u64 max = samples[N - 1];
-    u64 min = samples[0];
-    
-    printk(KERN_INFO "Microbench results over %zu samples: min=%llu max=%llu avg=%llu p50=%llu p90=%llu p99=%llu\n",
-           N, (unsigned long long)min, (unsigned long long)max, (unsigned long long)avg,
-           (unsigned long long)p50, (unsigned long long)p90, (unsigned long long)p99);
 
+    if (!n)
+        return;
+    copy = kvmalloc_array(n, sizeof(u64), GFP_KERNEL);
+    if (!copy) {
+        printk(KERN_WARNING "kvm-microbench: no memory to summarise %zu samples\n", n);
+        return;
+    }
+    memcpy(copy, v, n * sizeof(u64));
+    strscpy(sr.what, what, sizeof(sr.what));
+    sr.min = sr.max = v[0];
+    for (i = 0; i < n; i++) {
+        sum += v[i];
+        sr.min = min(sr.min, v[i]);
+        sr.max = max(sr.max, v[i]);
+    }
+    sr.mean = div64_u64(sum, n) * 100 + div64_u64(sum % n * 100, n);
+    stats_percentiles_bp(copy, n, mb_pcts, sr.pct, MB_NPCTS);
+    kvfree(copy);
+    series_publish(run, k, &sr);
+}
+
+// Same summary from a histogram: each order statistic is the middle of
+// its bucket, so percentiles are within the histogram's relative error
+static void report_hist(struct mb_run *run, const hist_t *hist){
+    struct mb_series sr = { .what = "hist", .count = hist->count };
+    size_t lower;
+    u64 frac;
+    int i;
+
+    if (!hist->count)
+        return;
+    sr.min = hist_min(hist);
+    sr.max = hist_max(hist);
+    sr.mean = div64_u64(hist->sum, hist->count) * 100 +
+              div64_u64(hist->sum % hist->count * 100, hist->count);
+    for (i = 0; i < MB_NPCTS; i++) {
+        stats_rank_bp(hist->count, mb_pcts[i], &lower, &frac);
+        sr.pct[i] = stats_interp_x100(hist_value_at_rank(hist, lower),
+                                      hist_value_at_rank(hist, lower + 1), frac);
+    }
+    series_publish(run, 0, &sr);
+}
+
+static int mb_summary_show(struct seq_file *m, void *unused){
+    mutex_lock(&last_lock);
+    if (last_run) {
+        seq_printf(m, "exit: %s\nmode: %s\npid: %d\nseries: %u\n", last_run->exit,
+                   last_run->mode, last_run->pid, last_run->nseries);
+        seq_printf(m, "precision: %u\ntsc_khz: %u\n", last_run->precision, tsc_khz);
+    }
+    mutex_unlock(&last_lock);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(mb_summary);
+
+// Cycles, two decimals; a header line, then one row per series
+static int mb_percentiles_show(struct seq_file *m, void *unused){
+    unsigned int k;
+    int i;
+
+    seq_puts(m, "series count min max mean");
+    for (i = 0; i < MB_NPCTS; i++)
+        seq_printf(m, " %s", mb_pct_names[i]);
+    seq_puts(m, "\n");
+    mutex_lock(&last_lock);
+    for (k = 0; last_run && k < last_run->nseries; k++) {
+        const struct mb_series *sr = &last_run->series[k];
+
+        if (!sr->count)
+            continue;
+        seq_printf(m, "%s %llu %llu %llu %llu.%02llu", sr->what, (unsigned long long)sr->count,
+                   (unsigned long long)sr->min, (unsigned long long)sr->max,
+                   (unsigned long long)sr->mean / 100, (unsigned long long)sr->mean % 100);
+        for (i = 0; i < MB_NPCTS; i++)
+            seq_printf(m, " %llu.%02llu", (unsigned long long)sr->pct[i] / 100,
+                       (unsigned long long)sr->pct[i] % 100);
+        seq_puts(m, "\n");
+    }
+    mutex_unlock(&last_lock);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(mb_percentiles);
+
+// Parallel mode: one pinned kthread per CPU
+struct mb_barrier {
+    atomic_t pending;           // workers that have not arrived yet
+    int go;
+};
+
+struct mb_worker {
+    struct task_struct *task;
+    struct completion done;
+    struct mb_barrier *barrier;
+    const cold_t *cold;
+    int id;
+    unsigned int cpu;
+    u64 *out;
+    size_t n;
+    u64 duration_ns;
+    hist_t hist;                // streaming mode when hist.counts is set
+    size_t taken;
+    struct run_stats rs;
+};
+
+static int mb_worker_fn(void *data){
+    struct mb_worker *w = data;
+    u64 deadline = 0;
+
+    // The last worker to arrive releases the others, so no thread depends
+    // on the caller (or another thread) getting its CPU back
+    if (atomic_dec_and_test(&w->barrier->pending))
+        smp_store_release(&w->barrier->go, 1);
+    else
+        while (!smp_load_acquire(&w->barrier->go))
+            cpu_relax();
+
+    if (w->duration_ns)
+        deadline = ktime_get_ns() + w->duration_ns;
+    w->taken = run_chunked(w->cold, w->id, w->out, w->n, deadline,
+                           w->hist.counts ? &w->hist : NULL, &w->rs);
+    // Signals the caller and exits without returning into module text
+    kthread_complete_and_exit(&w->done, 0);
+}
+
+// Number of CPUs in a request mask, -EINVAL if one is not online
+static int mask_cpus(u64 cpus){
+    unsigned int cpu;
+    int nr = 0;
+
+    for (cpu = 0; cpu < KVM_MB_MAX_CPUS; cpu++) {
+        if (!(cpus & (1ULL << cpu)))
+            continue;
+        if (cpu >= nr_cpu_ids || !cpu_online(cpu))
+            return -EINVAL;
+        nr++;
+    }
+    return nr ? nr : -EINVAL;
+}
+
+// Start one kthread per CPU of the mask on workers[] (in mask order, the
+// rest already filled in), release them together and wait for all
+static int run_workers(struct mb_worker *workers, unsigned int nr, u64 cpus){
+    struct mb_barrier barrier = { .go = 0 };
+    unsigned int cpu, k = 0;
+    int ret;
+
+    atomic_set(&barrier.pending, nr);
+    for (cpu = 0; cpu < KVM_MB_MAX_CPUS; cpu++) {
+        struct mb_worker *w;
+
+        if (!(cpus & (1ULL << cpu)))
+            continue;
+        w = &workers[k];
+        init_completion(&w->done);
+        w->barrier = &barrier;
+        w->cpu = cpu;
+        w->task = kthread_create(mb_worker_fn, w, "kvm-mb/%u", cpu);
+        if (IS_ERR(w->task)) {
+            ret = PTR_ERR(w->task);
+            goto err_stop;
+        }
+        kthread_bind(w->task, cpu);
+        k++;
+    }
+    for (k = 0; k < nr; k++)
+        wake_up_process(workers[k].task);
+    for (k = 0; k < nr; k++)
+        wait_for_completion(&workers[k].done);
     return 0;
+
+err_stop:
+    // Threads that were created but never woken exit without running
+    while (k--)
+        kthread_stop(workers[k].task);
+    return ret;
+}
+
+static long run_parallel(struct mb_file *mf, struct kvm_mb_parallel __user *uarg){
+    struct kvm_mb_parallel req;
+    struct mb_worker *workers;
+    unsigned int k;
+    size_t stride, total = 0;
+    struct mb_run *run;
+    long ret;
+    int nr;
+
+    if (copy_from_user(&req, uarg, sizeof(req)))
+        return -EFAULT;
+    if (req.exit_id >= EXIT_COUNT || req.flags || !req.cpus || !req.samples)
+        return -EINVAL;
+    if ((exit_catalog[req.exit_id].flags & EXIT_F_IRQS_ON) && isolate_chunk)
+        return -EINVAL;
+    nr = mask_cpus(req.cpus);
+    if (nr < 0)
+        return nr;
+
+    // Slices start on a cache line so no two threads write the same one
+    stride = ALIGN(req.samples, SMP_CACHE_BYTES / sizeof(u64));
+    if (stride > SIZE_MAX / sizeof(u64) / nr)
+        return -EINVAL;
+    ret = samples_reserve(mf, stride * nr);
+    if (ret)
+        return ret;
+
+    workers = kcalloc(nr, sizeof(*workers), GFP_KERNEL);
+    if (!workers)
+        return -ENOMEM;
+    printk(KERN_INFO "kvm-microbench: parallel exit=%s cpus=%#llx N=%llu duration=%lluus\n",
+           exit_catalog[req.exit_id].name, (unsigned long long)req.cpus,
+           (unsigned long long)req.samples, (unsigned long long)req.duration_us);
+
+    for (k = 0; k < nr; k++) {
+        struct mb_worker *w = &workers[k];
+
+        w->cold = &mf->cold;
+        w->id = req.exit_id;
+        w->out = mf->samples + k * stride;
+        w->n = req.samples;
+        w->duration_ns = req.duration_us * NSEC_PER_USEC;
+    }
+    ret = run_workers(workers, nr, req.cpus);
+    if (ret) {
+        kfree(workers);
+        return ret;
+    }
+
+    req.stride = stride;
+    run = run_alloc(req.exit_id, "parallel", nr);
+    for (k = 0; k < nr; k++) {
+        struct mb_worker *w = &workers[k];
+        char what[16];
+
+        req.count[k] = w->taken;
+        total += w->taken;
+        if (w->rs.chunks)
+            printk(KERN_INFO "kvm-microbench: cpu %u isolation: %u of %u chunks saw an SMI\n",
+                   w->cpu, w->rs.smi_chunks, w->rs.chunks);
+        snprintf(what, sizeof(what), "cpu%u", w->cpu);
+        report(run, k, what, w->out, w->taken);
+    }
+    run_publish(run);
+    kfree(workers);
+    if (copy_to_user(uarg, &req, sizeof(req)))
+        return -EFAULT;
+    return total;
+}
+
+// Streaming mode: fold the samples into a histogram per thread, merge
+// them and copy the buckets out. Memory is one chunk of scratch and one
+// bucket array per thread, however long the run.
+static long run_hist(struct mb_file *mf, struct kvm_mb_hist __user *ureq){
+    struct kvm_mb_hist req;
+    struct mb_worker *workers;
+    u64 *counts = NULL, *scratch = NULL;
+    struct mb_run *run;
+    hist_t total;
+    size_t nb, n;
+    int nr = 1, k;
+    long ret;
+
+    if (copy_from_user(&req, ureq, sizeof(req)))
+        return -EFAULT;
+    if (!req.precision)
+        req.precision = HIST_DEFAULT_PRECISION;
+    if (req.exit_id >= EXIT_COUNT || req.precision > KVM_MB_HIST_MAX_PRECISION ||
+        (!req.samples && !req.duration_us))
+        return -EINVAL;
+    if ((exit_catalog[req.exit_id].flags & EXIT_F_IRQS_ON) && isolate_chunk)
+        return -EINVAL;
+    nb = HIST_BUCKETS(req.precision);
+    if (req.nbuckets < nb)
+        return -EINVAL;
+    if (req.cpus) {
+        nr = mask_cpus(req.cpus);
+        if (nr < 0)
+            return nr;
+    }
+    n = req.samples ? req.samples : SIZE_MAX;
+
+    workers = kcalloc(nr, sizeof(*workers), GFP_KERNEL);
+    // Bucket arrays: the merged one, then one per thread
+    counts = kvcalloc((size_t)(nr + 1) * nb, sizeof(u64), GFP_KERNEL);
+    scratch = kvmalloc_array((size_t)nr * ISOLATE_MAX_CHUNK, sizeof(u64), GFP_KERNEL);
+    if (!workers || !counts || !scratch) {
+        ret = -ENOMEM;
+        goto out;
+    }
+    printk(KERN_INFO "kvm-microbench: hist exit=%s cpus=%#llx N=%llu duration=%lluus precision=%u\n",
+           exit_catalog[req.exit_id].name, (unsigned long long)req.cpus,
+           (unsigned long long)req.samples, (unsigned long long)req.duration_us, req.precision);
+
+    for (k = 0; k < nr; k++) {
+        struct mb_worker *w = &workers[k];
+
+        w->cold = &mf->cold;
+        w->id = req.exit_id;
+        w->out = scratch + (size_t)k * ISOLATE_MAX_CHUNK;
+        w->n = n;
+        w->duration_ns = req.duration_us * NSEC_PER_USEC;
+        hist_init(&w->hist, counts + (size_t)(k + 1) * nb, nb, req.precision);
+    }
+    if (req.cpus) {
+        ret = run_workers(workers, nr, req.cpus);
+        if (ret)
+            goto out;
+    } else {
+        struct mb_worker *w = &workers[0];
+        u64 deadline = w->duration_ns ? ktime_get_ns() + w->duration_ns : 0;
+
+        w->taken = run_chunked(w->cold, w->id, w->out, w->n, deadline, &w->hist, &w->rs);
+    }
+
+    hist_init(&total, counts, nb, req.precision);
+    for (k = 0; k < nr; k++) {
+        hist_merge(&total, &workers[k].hist);
+        if (workers[k].rs.chunks)
+            printk(KERN_INFO "kvm-microbench: thread %d isolation: %u of %u chunks saw an SMI\n",
+                   k, workers[k].rs.smi_chunks, workers[k].rs.chunks);
+    }
+    req.count = total.count;
+    req.min = hist_min(&total);
+    req.max = hist_max(&total);
+    req.sum = total.sum;
+    run = run_alloc(req.exit_id, "hist", 1);
+    if (run)
+        run->precision = req.precision;
+    report_hist(run, &total);
+    run_publish(run);
+    ret = 0;
+    if (copy_to_user(u64_to_user_ptr(req.counts_ptr), counts, nb * sizeof(u64)) ||
+        copy_to_user(ureq, &req, sizeof(req)))
+        ret = -EFAULT;
+out:
+    kvfree(scratch);
+    kvfree(counts);
+    kfree(workers);
+    return ret;
+}
+
+// n exits of entry id, each due interval cycles after the previous one
+// (*due is the first due time and advances); out NULL: back to back, untimed
+static void paced_loop(int id, u64 *out, size_t n, u64 interval, u64 *due){
+    u64 d = *due;
+#define RECORD(v) (*out++ = (v))
+#define PACED_CASE(name, label, path, priv, flags, setup, body) \
+    case EXIT_##name: EXIT_PACED_LOOP(n, setup, body, RECORD, interval, d); break;
+#define RATE_CASE(name, label, path, priv, flags, setup, body) \
+    case EXIT_##name: EXIT_RATE_LOOP(n, setup, body); break;
+    if (!out) {
+        switch (id) {
+        EXIT_CATALOG(RATE_CASE)
+        }
+        return;
+    }
+    switch (id) {
+    EXIT_CATALOG(PACED_CASE)
+    }
+    *due = d;
+#undef RATE_CASE
+#undef PACED_CASE
+#undef RECORD
+}
+
+// Throughput mode (load.h): back to back for the maximum rate, or open
+// loop with each exit due at a fixed time and timed from it. Runs in
+// chunks with a reschedule point between them; time lost there is
+// charged to the exits that were due meanwhile, as it should be.
+static long run_paced(struct mb_file *mf, struct kvm_mb_paced __user *ureq){
+    struct kvm_mb_paced req;
+    u64 *out = NULL, start, due;
+    size_t i, n;
+    int ret;
+
+    if (copy_from_user(&req, ureq, sizeof(req)))
+        return -EFAULT;
+    if (req.exit_id >= EXIT_COUNT || req.flags || !req.samples)
+        return -EINVAL;
+    // The pacing spin needs interrupts on and a fixed schedule without them
+    if (exit_catalog[req.exit_id].flags & (EXIT_F_IRQS_OFF | EXIT_F_IRQS_ON))
+        return -EINVAL;
+    n = req.samples;
+    if (req.interval) {
+        ret = samples_reserve(mf, n);
+        if (ret)
+            return ret;
+        out = mf->samples;
+    }
+    printk(KERN_INFO "kvm-microbench: paced exit=%s N=%zu interval=%llu\n",
+           exit_catalog[req.exit_id].name, n, (unsigned long long)req.interval);
+
+    start = due = timing_tsc_start();
+    for (i = 0; i < n; i += ISOLATE_MAX_CHUNK) {
+        size_t len = min_t(size_t, n - i, ISOLATE_MAX_CHUNK);
+
+        paced_loop(req.exit_id, out ? out + i : NULL, len, req.interval, &due);
+        cond_resched();
+    }
+    req.cycles = timing_tsc_end() - start;
+    if (copy_to_user(ureq, &req, sizeof(req)))
+        return -EFAULT;
+
+    // Sample count of this run; the samples are readable through mmap
+    return out ? n : 0;
+}
+
+static long dev_ioctl_locked(struct mb_file *mf, unsigned int cmd, unsigned long arg){
+    size_t N = arg ? arg : 200000;
+    struct run_stats rs = { 0 };
+    struct mb_run *run;
+    int id, ret;
+
+    if (cmd == IOCTL_RUN_PARALLEL)
+        return run_parallel(mf, (struct kvm_mb_parallel __user *)arg);
+    if (cmd == IOCTL_RUN_HIST)
+        return run_hist(mf, (struct kvm_mb_hist __user *)arg);
+    if (cmd == IOCTL_RUN_PACED)
+        return run_paced(mf, (struct kvm_mb_paced __user *)arg);
+    if (cmd == IOCTL_SET_COLD)
+        return set_cold(mf, (struct kvm_mb_cold __user *)arg);
+
+    id = cmd_to_exit(cmd);
+    if (id < 0)
+        return -EINVAL;
+    ret = samples_reserve(mf, N);
+    if (ret)
+        return ret;
+    printk(KERN_INFO "kvm-microbench: ioctl exit=%s N=%zu\n", exit_catalog[id].name, N);
+
+    // HLT only returns on an interrupt; TSC_DEADLINE write-back needs them off
+    if ((exit_catalog[id].flags & EXIT_F_IRQS_ON) && isolate_chunk)
+        return -EINVAL;
+
+    run_chunked(&mf->cold, id, mf->samples, N, 0, NULL, &rs);
+    if (rs.chunks)
+        printk(KERN_INFO "kvm-microbench: isolation: %u of %u chunks saw an SMI (%u.%02u%%)\n",
+               rs.smi_chunks, rs.chunks, 100 * rs.smi_chunks / rs.chunks,
+               (10000 * rs.smi_chunks / rs.chunks) % 100);
+    run = run_alloc(id, "ioctl", 1);
+    report(run, 0, "ioctl", mf->samples, N);
+    run_publish(run);
+
+    // Sample count of this run; the samples are readable through mmap
+    return N;
+}
+
+static long dev_ioctl(struct file *f, unsigned int cmd, unsigned long arg){
+    struct mb_file *mf = f->private_data;
+    long ret;
+
+    if (mutex_lock_interruptible(&mf->lock))
+        return -ERESTARTSYS;
+    ret = dev_ioctl_locked(mf, cmd, arg);
+    mutex_unlock(&mf->lock);
+    return ret;
+}
+
+static int dev_open(struct inode *inode, struct file *f){
+    struct mb_file *mf = kzalloc(sizeof(*mf), GFP_KERNEL);
+
+    if (!mf)
+        return -ENOMEM;
+    mutex_init(&mf->lock);
+    atomic_set(&mf->mappings, 0);
+    f->private_data = mf;
+    return 0;
+}
+
+// Mappings hold a reference to the file, so none is left by now
+static int dev_release(struct inode *inode, struct file *f){
+    struct mb_file *mf = f->private_data;
+
+    vfree(mf->samples);
+    vfree((void *)mf->cold.sweep);
+    kfree(mf);
+    return 0;
+}
+
+static void dev_vm_open(struct vm_area_struct *vma){
+    struct mb_file *mf = vma->vm_private_data;
+    atomic_inc(&mf->mappings);
+}
+
+static void dev_vm_close(struct vm_area_struct *vma){
+    struct mb_file *mf = vma->vm_private_data;
+    atomic_dec(&mf->mappings);
+}
+
+static const struct vm_operations_struct dev_vm_ops = {
+    .open = dev_vm_open,
+    .close = dev_vm_close,
+};
+
+// Map the sample buffer of the fd's last run (no copy). The mapping must
+// fit inside the buffer; the buffer is not reallocated while it is mapped.
+static int dev_mmap(struct file *f, struct vm_area_struct *vma){
+    struct mb_file *mf = f->private_data;
+    int ret = -ENODATA;
+
+    if (mutex_lock_interruptible(&mf->lock))
+        return -ERESTARTSYS;
+    if (mf->samples)
+        ret = remap_vmalloc_range(vma, mf->samples, vma->vm_pgoff);
+    if (!ret) {
+        vma->vm_ops = &dev_vm_ops;
+        vma->vm_private_data = mf;
+        dev_vm_open(vma);
+    }
+    mutex_unlock(&mf->lock);
+    return ret;
 }
 
 static const struct file_operations fops = {
     .owner = THIS_MODULE,
     .unlocked_ioctl = dev_ioctl,
+    .open = dev_open,
+    .release = dev_release,
+    .mmap = dev_mmap,
 };
 
 static int __init microbench_init(void){
@@ -134,10 +817,15 @@ static int __init microbench_init(void){
         ret = -ENOMEM; goto err_class;
     }
 
-    samples = NULL;
-    S = 0;
+    // Failures only cost the debugfs view; the log still has every result
+    dbg_dir = debugfs_create_dir("kvm-microbench", NULL);
+    debugfs_create_file("summary", 0444, dbg_dir, NULL, &mb_summary_fops);
+    debugfs_create_file("percentiles", 0444, dbg_dir, NULL, &mb_percentiles_fops);
 
-    printk(KERN_INFO "kvm-microbench module loaded\n");
+    printk(KERN_INFO "kvm-microbench module loaded (tsc %u kHz)\n", tsc_khz);
+    // Same policy as tsc.h in user space, but a module can only flag it
+    if (!boot_cpu_has(X86_FEATURE_CONSTANT_TSC) || !boot_cpu_has(X86_FEATURE_NONSTOP_TSC))
+        printk(KERN_WARNING "kvm-microbench: TSC is not invariant, cycle results do not map to time\n");
     return 0;
 
 err_class:
@@ -150,11 +838,12 @@ err_unregister:
 }
 
 static void __exit microbench_exit(void){
+    debugfs_remove_recursive(dbg_dir);
+    kfree(last_run);
     device_destroy(cls, devno);
     class_destroy(cls);
     cdev_del(&cdev);
     unregister_chrdev_region(devno, 1);
-    kfree(samples);
     printk(KERN_INFO "kvm-microbench module unloaded\n");
 }
 
@@ -0,0 +1,245 @@
+#ifndef PMU_H
+#define PMU_H
+
+/* Hardware performance counters next to the cycle timings (user space).
+ *
+ * With -P the harnesses open one perf_event counter per PMU_EVENTS entry
+ * for their own task and run each series in chunks of PMU_CHUNK samples,
+ * reading every counter before and after a chunk. Hardware counters are
+ * read with RDPMC through the counter's mmap'ed perf_event_mmap_page, so
+ * no syscall lands between the two reads; software counters (context
+ * switches) can only be read with read(), which is done outside the
+ * hardware window. The samples themselves never contain a counter read.
+ *
+ * The deltas accumulate in a pmu_series_t kept in the series next to its
+ * stats_t: totals, and the per-exit minimum and maximum over the chunks.
+ * Per-exit values include the timer pair and loop around each exit.
+ *
+ * In a KVM guest the virtual PMU only counts while the vCPU runs guest
+ * code, so time the host spends handling an exit shows up in the TSC but
+ * not in the cycles counter. Their ratio is the share of each sample spent
+ * in the guest: close to 1 for cheap in-guest work, low for exits handled
+ * by KVM, lowest for those that go out to QEMU (documents/questions.md).
+ * KVM may also trap RDPMC; that only costs time at chunk boundaries.
+ *
+ * Guests without a virtual PMU (or with perf_event_paranoid blocking
+ * access) degrade to whatever opens; if nothing does, series run as usual.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "timing.h"
+
+#define PMU_CHUNK  10000            /* samples between counter reads */
+
+enum { PMU_CYCLES, PMU_INSTRUCTIONS, PMU_LLC_MISSES, PMU_BRANCH_MISSES, PMU_CTX_SWITCHES, PMU_EVENTS };
+
+static const struct {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+} pmu_events[PMU_EVENTS] = {
+    [PMU_CYCLES]        = { "cycles",           PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    [PMU_INSTRUCTIONS]  = { "instructions",     PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    [PMU_LLC_MISSES]    = { "LLC misses",       PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    [PMU_BRANCH_MISSES] = { "branch misses",    PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    [PMU_CTX_SWITCHES]  = { "context switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+};
+
+typedef struct {
+    int fd[PMU_EVENTS];                         /* -1: not available */
+    struct perf_event_mmap_page *page[PMU_EVENTS];
+    int err[PMU_EVENTS];                        /* errno of a failed open */
+    int nopen;
+    int user_only;                              /* kernel counting was refused */
+} pmu_t;
+
+typedef struct {
+    uint64_t v[PMU_EVENTS];
+    uint64_t tsc;
+    unsigned int rdpmc;                         /* events read with RDPMC, bitmask */
+} pmu_snapshot_t;
+
+/* Counter deltas of one series */
+typedef struct {
+    uint64_t total[PMU_EVENTS];
+    uint64_t tsc;                               /* TSC cycles inside the chunks */
+    uint64_t samples;                           /* executed, including dropped ones */
+    uint64_t chunks;
+    double min[PMU_EVENTS], max[PMU_EVENTS];    /* per exit, over chunks */
+    unsigned int rdpmc;                         /* events ever read with RDPMC */
+} pmu_series_t;
+
+static inline void pmu_series_init(pmu_series_t *ps)
+{
+    memset(ps, 0, sizeof(*ps));
+}
+
+static inline int pmu_open_event(int i, int exclude_kernel)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = pmu_events[i].type;
+    attr.config = pmu_events[i].config;
+    attr.exclude_kernel = exclude_kernel;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/* Open the counters for the calling thread
+ * kernel: also count in the kernel (user-to-kernel); falls back to user
+ * space only where perf_event_paranoid forbids it.
+ * Returns the number of counters opened.
+ */
+static inline int pmu_open(pmu_t *p, int kernel)
+{
+    long page = sysconf(_SC_PAGESIZE);
+
+    memset(p, 0, sizeof(*p));
+    for (int i = 0; i < PMU_EVENTS; i++) {
+        int fd = pmu_open_event(i, !kernel);
+        if (fd < 0 && kernel && (errno == EACCES || errno == EPERM)) {
+            fd = pmu_open_event(i, 1);
+            if (fd >= 0) p->user_only = 1;
+        }
+        p->fd[i] = fd;
+        if (fd < 0) {
+            p->err[i] = errno;
+            continue;
+        }
+        p->nopen++;
+        if (pmu_events[i].type == PERF_TYPE_HARDWARE) {
+            void *m = mmap(NULL, page, PROT_READ, MAP_SHARED, fd, 0);
+            p->page[i] = m == MAP_FAILED ? NULL : m;
+        }
+    }
+    if (!kernel) p->user_only = 1;
+    return p->nopen;
+}
+
+/* Read one counter with RDPMC (perf_event_mmap_page protocol)
+ * Returns -1 if user-space reads are not allowed or the event is not on
+ * a counter right now (multiplexed out); read() it instead.
+ */
+static inline int pmu_rdpmc(const volatile struct perf_event_mmap_page *pc, uint64_t *value)
+{
+    uint32_t seq, idx;
+    uint64_t count;
+
+    do {
+        seq = pc->lock;
+        asm volatile("" ::: "memory");
+        idx = pc->index;
+        count = pc->offset;
+        if (!pc->cap_user_rdpmc || idx == 0)
+            return -1;
+        unsigned int lo, hi, shift = 64 - pc->pmc_width;
+        asm volatile("rdpmc" : "=a"(lo), "=d"(hi) : "c"(idx - 1));
+        int64_t pmc = (int64_t)(((uint64_t)hi << 32 | lo) << shift) >> shift;
+        count += pmc;
+        asm volatile("" ::: "memory");
+    } while (pc->lock != seq);
+    *value = count;
+    return 0;
+}
+
+static inline void pmu_read_hw(const pmu_t *p, pmu_snapshot_t *s)
+{
+    for (int i = 0; i < PMU_EVENTS; i++) {
+        if (p->fd[i] < 0 || pmu_events[i].type != PERF_TYPE_HARDWARE) continue;
+        if (p->page[i] && pmu_rdpmc(p->page[i], &s->v[i]) == 0) s->rdpmc |= 1u << i;
+        else if (read(p->fd[i], &s->v[i], sizeof(uint64_t)) != sizeof(uint64_t)) s->v[i] = 0;
+    }
+}
+
+static inline void pmu_read_sw(const pmu_t *p, pmu_snapshot_t *s)
+{
+    for (int i = 0; i < PMU_EVENTS; i++) {
+        if (p->fd[i] < 0 || pmu_events[i].type == PERF_TYPE_HARDWARE) continue;
+        if (read(p->fd[i], &s->v[i], sizeof(uint64_t)) != sizeof(uint64_t)) s->v[i] = 0;
+    }
+}
+
+/* Read the counters before a chunk: syscalls first, RDPMC last */
+static inline void pmu_begin(const pmu_t *p, pmu_snapshot_t *t0)
+{
+    memset(t0, 0, sizeof(*t0));
+    if (!p->nopen) return;
+    pmu_read_sw(p, t0);
+    pmu_read_hw(p, t0);
+    t0->tsc = rdtsc_serialized_start();
+}
+
+/* Read them after a chunk of n samples and add the deltas to ps */
+static inline void pmu_end(const pmu_t *p, const pmu_snapshot_t *t0, pmu_series_t *ps, uint64_t n)
+{
+    pmu_snapshot_t t1;
+
+    if (!p->nopen || n == 0) return;
+    memset(&t1, 0, sizeof(t1));
+    t1.tsc = rdtsc_serialized_end();
+    pmu_read_hw(p, &t1);
+    pmu_read_sw(p, &t1);
+
+    for (int i = 0; i < PMU_EVENTS; i++) {
+        if (p->fd[i] < 0) continue;
+        uint64_t d = t1.v[i] - t0->v[i];
+        double per = (double)d / n;
+        ps->total[i] += d;
+        if (ps->chunks == 0 || per < ps->min[i]) ps->min[i] = per;
+        if (ps->chunks == 0 || per > ps->max[i]) ps->max[i] = per;
+    }
+    ps->rdpmc |= t0->rdpmc & t1.rdpmc;
+    ps->tsc += t1.tsc - t0->tsc;
+    ps->samples += n;
+    ps->chunks++;
+}
+
+/* Samples to run before the next counter read */
+static inline long pmu_chunk(const pmu_t *p, long left)
+{
+    return p->nopen && left > PMU_CHUNK ? PMU_CHUNK : left;
+}
+
+static inline void pmu_print_status(const pmu_t *p)
+{
+    printf("PMU: %d of %d counters", p->nopen, PMU_EVENTS);
+    if (p->nopen) printf(", %s", p->user_only ? "user space only" : "user and kernel");
+    printf("\n");
+    for (int i = 0; i < PMU_EVENTS; i++)
+        if (p->fd[i] < 0)
+            printf("  %s: not available (%s)\n", pmu_events[i].name, strerror(p->err[i]));
+    if (p->fd[PMU_CYCLES] < 0 && p->fd[PMU_INSTRUCTIONS] < 0)
+        printf("  no hardware PMU (no vPMU in this guest?); timings are unaffected\n");
+    printf("\n");
+}
+
+static inline void pmu_print(const pmu_t *p, const pmu_series_t *ps, const char *label)
+{
+    if (!p->nopen || ps->samples == 0) return;
+    printf("=== PMU counters: %s ===\n", label);
+    printf("Counted: %lu samples in %lu chunks\n", ps->samples, ps->chunks);
+    printf("%-18s %12s %12s %12s %14s  %s\n", "event", "per exit", "min", "max", "total", "read");
+    for (int i = 0; i < PMU_EVENTS; i++) {
+        if (p->fd[i] < 0) continue;
+        printf("%-18s %12.3f %12.3f %12.3f %14lu  %s\n", pmu_events[i].name,
+               (double)ps->total[i] / ps->samples, ps->min[i], ps->max[i], ps->total[i],
+               ps->rdpmc & (1u << i) ? "rdpmc" : "read()");
+    }
+    if (p->fd[PMU_CYCLES] >= 0 && ps->tsc > 0)
+        printf("Counted cycles / TSC cycles: %.3f (in a guest, low when exits are handled by "
+               "the host)\n", (double)ps->total[PMU_CYCLES] / ps->tsc);
+    if (p->fd[PMU_CYCLES] >= 0 && p->fd[PMU_INSTRUCTIONS] >= 0 && ps->total[PMU_CYCLES] > 0)
+        printf("IPC: %.3f\n", (double)ps->total[PMU_INSTRUCTIONS] / ps->total[PMU_CYCLES]);
+    printf("====================================\n\n");
+}
+
+#endif /* PMU_H */
@@ -0,0 +1,47 @@
+#ifndef REPORT_H
+#define REPORT_H
+
+/* Report rows shared by the stats.h and hist.h printers. */
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* TSC frequency for the reports: when set (tsc_probe does it), every cycle
+ * figure is printed next to its value in nanoseconds.
+ */
+static double stats_tsc_hz;
+
+static inline void stats_set_tsc_hz(double hz)
+{
+    stats_tsc_hz = hz;
+}
+
+static inline double stats_cycles_to_ns(double cycles)
+{
+    return stats_tsc_hz > 0.0 ? cycles * 1e9 / stats_tsc_hz : 0.0;
+}
+
+/* Report rows: "name  cycles" or, with a known frequency, "name  cycles  ns" */
+static inline void stats_print_header(void)
+{
+    if (stats_tsc_hz > 0.0)
+        printf("%-16s%12s %12s\n", "", "cycles", "ns");
+}
+
+static inline void stats_print_value(const char *name, double cycles)
+{
+    if (stats_tsc_hz > 0.0)
+        printf("%-16s%12.2f %12.2f\n", name, cycles, stats_cycles_to_ns(cycles));
+    else
+        printf("%-16s%.2f\n", name, cycles);
+}
+
+static inline void stats_print_cycles(const char *name, uint64_t cycles)
+{
+    if (stats_tsc_hz > 0.0)
+        printf("%-16s%12lu %12.2f\n", name, cycles, stats_cycles_to_ns(cycles));
+    else
+        printf("%-16s%lu\n", name, cycles);
+}
+
+#endif /* REPORT_H */
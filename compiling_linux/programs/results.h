@@ -0,0 +1,213 @@
+#ifndef RESULTS_H
+#define RESULTS_H
+
+/* Machine-readable results: one record per series, as JSON or CSV.
+ *
+ * Every record carries the reporting metadata of documents/measurements.md
+ * (CPU model, host and guest kernel, QEMU version, instruction, path) next
+ * to the summary and percentiles, in cycles and, with a known TSC
+ * frequency, in nanoseconds. The format follows the file extension:
+ * ".csv" writes one row per series with the metadata repeated, anything
+ * else a JSON document { "env": {...}, "series": [...] }.
+ *
+ * The guest cannot see the host's kernel or QEMU version; qemu.sh puts
+ * them on the kernel command line, from where they reach every process as
+ * the environment variables KVM_MB_HOST_KERNEL and KVM_MB_QEMU.
+ * Outside qemu.sh set them by hand, or they are reported as "unknown".
+ *
+ * Raw samples are not included; write a binary dump (-o, stats_dump.h)
+ * alongside for stats-compare.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/utsname.h>
+#include "stats.h"
+#include "timing.h"
+#include "exits.h"
+
+#define RESULTS_ENV_HOST_KERNEL "KVM_MB_HOST_KERNEL"
+#define RESULTS_ENV_QEMU        "KVM_MB_QEMU"
+#define RESULTS_NPCTS           9
+
+static const double results_pcts[RESULTS_NPCTS] = { 1, 5, 25, 50, 75, 90, 95, 99, 99.9 };
+static const char *const results_pct_names[RESULTS_NPCTS] = {
+    "p1", "p5", "p25", "p50", "p75", "p90", "p95", "p99", "p99.9"
+};
+
+typedef struct {
+    char cpu_model[128];
+    char guest_kernel[160];
+    char host_kernel[128];
+    char qemu[64];
+    double tsc_hz;
+} results_env_t;
+
+typedef struct {
+    FILE *f;
+    int csv;
+    size_t nseries;
+    results_env_t env;
+} results_t;
+
+static inline void results_getenv(char *buf, size_t len, const char *name)
+{
+    const char *v = getenv(name);
+    snprintf(buf, len, "%s", v && *v ? v : "unknown");
+}
+
+static inline void results_env_collect(results_env_t *env, double tsc_hz)
+{
+    struct utsname u;
+    char line[256];
+    FILE *f = fopen("/proc/cpuinfo", "r");
+
+    snprintf(env->cpu_model, sizeof(env->cpu_model), "unknown");
+    while (f && fgets(line, sizeof(line), f)) {
+        char *colon = strchr(line, ':');
+        if (strncmp(line, "model name", 10) == 0 && colon) {
+            colon += strspn(colon + 1, " \t") + 1;
+            colon[strcspn(colon, "\n")] = '\0';
+            snprintf(env->cpu_model, sizeof(env->cpu_model), "%s", colon);
+            break;
+        }
+    }
+    if (f) fclose(f);
+
+    if (uname(&u) == 0)
+        snprintf(env->guest_kernel, sizeof(env->guest_kernel), "%s %s", u.release, u.version);
+    else
+        snprintf(env->guest_kernel, sizeof(env->guest_kernel), "unknown");
+    results_getenv(env->host_kernel, sizeof(env->host_kernel), RESULTS_ENV_HOST_KERNEL);
+    results_getenv(env->qemu, sizeof(env->qemu), RESULTS_ENV_QEMU);
+    env->tsc_hz = tsc_hz;
+}
+
+static inline void results_json_str(FILE *f, const char *s)
+{
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') fprintf(f, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20) fprintf(f, "\\u%04x", *s);
+        else fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+static inline void results_csv_str(FILE *f, const char *s)
+{
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"') fputc('"', f);
+        fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+/* Open path for writing and record the environment
+ * Returns 0, or -1 if the file cannot be created.
+ */
+static inline int results_open(results_t *r, const char *path, double tsc_hz)
+{
+    size_t len = strlen(path);
+
+    memset(r, 0, sizeof(*r));
+    r->csv = len >= 4 && strcmp(path + len - 4, ".csv") == 0;
+    r->f = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+    if (!r->f) return -1;
+    results_env_collect(&r->env, tsc_hz);
+
+    if (r->csv) {
+        fprintf(r->f, "label,exit,instruction,path,context,cpu_model,guest_kernel,host_kernel,"
+                      "qemu,timing,tsc_hz,count,stored,min,max,mean,stddev");
+        for (int i = 0; i < RESULTS_NPCTS; i++) fprintf(r->f, ",%s", results_pct_names[i]);
+        fprintf(r->f, ",mean_ns");
+        for (int i = 0; i < RESULTS_NPCTS; i++) fprintf(r->f, ",%s_ns", results_pct_names[i]);
+        fprintf(r->f, "\n");
+        return 0;
+    }
+    fprintf(r->f, "{\n  \"env\": {\n    \"cpu_model\": ");
+    results_json_str(r->f, r->env.cpu_model);
+    fprintf(r->f, ",\n    \"guest_kernel\": ");
+    results_json_str(r->f, r->env.guest_kernel);
+    fprintf(r->f, ",\n    \"host_kernel\": ");
+    results_json_str(r->f, r->env.host_kernel);
+    fprintf(r->f, ",\n    \"qemu\": ");
+    results_json_str(r->f, r->env.qemu);
+    fprintf(r->f, ",\n    \"timing\": \"%s\",\n    \"tsc_hz\": %.0f\n  },\n  \"series\": [",
+            TIMING_NAME, tsc_hz);
+    return 0;
+}
+
+/* Append one series. context: where it ran, e.g. "user", "kernel".
+ * Reorders the stored samples like stats_percentiles.
+ */
+static inline void results_add(results_t *r, stats_t *s, const char *label,
+                               const exit_desc_t *e, const char *context)
+{
+    double p[RESULTS_NPCTS];
+    double ns = r->env.tsc_hz > 0.0 ? 1e9 / r->env.tsc_hz : 0.0;
+    FILE *f = r->f;
+
+    if (!f || s->total == 0) return;
+    if (s->count == 0 || stats_percentiles(s, results_pcts, p, RESULTS_NPCTS) < 0)
+        memset(p, 0, sizeof(p));
+
+    if (r->csv) {
+        results_csv_str(f, label);
+        fprintf(f, ",%s,", e->name);
+        results_csv_str(f, e->label);
+        fprintf(f, ",%s,%s,", e->path, context);
+        results_csv_str(f, r->env.cpu_model);
+        fputc(',', f);
+        results_csv_str(f, r->env.guest_kernel);
+        fputc(',', f);
+        results_csv_str(f, r->env.host_kernel);
+        fputc(',', f);
+        results_csv_str(f, r->env.qemu);
+        fprintf(f, ",%s,%.0f,%lu,%zu,%lu,%lu,%.2f,%.2f", TIMING_NAME, r->env.tsc_hz,
+                s->total, s->count, stats_min(s), stats_max(s), stats_mean(s), stats_stddev(s));
+        for (int i = 0; i < RESULTS_NPCTS; i++) fprintf(f, ",%.2f", p[i]);
+        fprintf(f, ",%.2f", stats_mean(s) * ns);
+        for (int i = 0; i < RESULTS_NPCTS; i++) fprintf(f, ",%.2f", p[i] * ns);
+        fprintf(f, "\n");
+    } else {
+        fprintf(f, "%s\n    {\n      \"label\": ", r->nseries ? "," : "");
+        results_json_str(f, label);
+        fprintf(f, ",\n      \"exit\": \"%s\",\n      \"instruction\": ", e->name);
+        results_json_str(f, e->label);
+        fprintf(f, ",\n      \"path\": \"%s\",\n      \"context\": \"%s\",\n", e->path, context);
+        fprintf(f, "      \"count\": %lu,\n      \"stored\": %zu,\n", s->total, s->count);
+        fprintf(f, "      \"cycles\": { \"min\": %lu, \"max\": %lu, \"mean\": %.2f, \"stddev\": %.2f",
+                stats_min(s), stats_max(s), stats_mean(s), stats_stddev(s));
+        for (int i = 0; i < RESULTS_NPCTS; i++)
+            fprintf(f, ", \"%s\": %.2f", results_pct_names[i], p[i]);
+        fprintf(f, " }");
+        if (ns > 0.0) {
+            fprintf(f, ",\n      \"ns\": { \"min\": %.2f, \"max\": %.2f, \"mean\": %.2f, \"stddev\": %.2f",
+                    stats_min(s) * ns, stats_max(s) * ns, stats_mean(s) * ns, stats_stddev(s) * ns);
+            for (int i = 0; i < RESULTS_NPCTS; i++)
+                fprintf(f, ", \"%s\": %.2f", results_pct_names[i], p[i] * ns);
+            fprintf(f, " }");
+        }
+        fprintf(f, "\n    }");
+    }
+    r->nseries++;
+}
+
+/* Finish the document. Returns 0, or -1 on a write error. */
+static inline int results_close(results_t *r)
+{
+    int ret = 0;
+
+    if (!r->f) return 0;
+    if (!r->csv) fprintf(r->f, "\n  ]\n}\n");
+    if (fflush(r->f) != 0) ret = -1;
+    if (r->f != stdout && fclose(r->f) != 0) ret = -1;
+    r->f = NULL;
+    return ret;
+}
+
+#endif /* RESULTS_H */
@@ -1,64 +1,69 @@
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "stats.h"
+#include "stats_dump.h"
+#include "timing.h"
+#include "tsc.h"
 
 static inline void measured_function(uint64_t *var)
 {
    
 }
 
-static inline uint64_t measure_start(void)
-{
-    unsigned cycles_low, cycles_high;
-    asm volatile(
-        "CPUID\n\t"
-        "RDTSC\n\t"
-        "mov %%edx, %0\n\t"
-        "mov %%eax, %1\n\t" : "=r"(cycles_high), "=r"(cycles_low)::"%rax", "%rbx", "%rcx", "%rdx");
-    return (((uint64_t)cycles_high << 32) | cycles_low);
-}
-
-static inline uint64_t measure_end(void)
-{
-    unsigned cycles_low, cycles_high;
-    asm volatile("RDTSCP\n\t"
-                 "mov %%edx, %0\n\t"
-                 "mov %%eax, %1\n\t"
-                 "CPUID\n\t" : "=r"(cycles_high), "=r"(cycles_low)::"%rax", "%rbx", "%rcx", "%rdx");
-    return (((uint64_t)cycles_high << 32) | cycles_low);
-}
-
 #define MEASURE_COUNT 1000000
 
-int main(void)
+// Usage: rtdsc [-o dump.bin]
+// Without -o every measurement is printed as text; with -o the samples are
+// written as a binary dump (stats_dump.h) for host-side analysis instead.
+int main(int argc, char **argv)
 {
     uint64_t start, end;
     uint64_t variable = 0;
-    uint64_t measurements[MEASURE_COUNT];
+    const char *dump_path = NULL;
+    int opt;
 
-    for (int i = 0; i < MEASURE_COUNT; i++)
+    while ((opt = getopt(argc, argv, "o:")) != -1)
     {
-        start = measure_start();
-        measured_function(&variable);
-        end = measure_end();
-        measurements[i] = end - start;
+        if (opt == 'o')
+            dump_path = optarg;
+        else
+        {
+            printf("Usage: %s [-o dump.bin]\n", argv[0]);
+            return 1;
+        }
     }
 
-    uint64_t total = 0;
+    uint64_t *measurements = malloc(MEASURE_COUNT * sizeof(uint64_t));
+    stats_t stats;
+    stats_init(&stats, measurements, MEASURE_COUNT);
+
     for (int i = 0; i < MEASURE_COUNT; i++)
     {
-        total += measurements[i];
+        start = rdtsc_serialized_start();
+        measured_function(&variable);
+        end = rdtsc_serialized_end();
+        stats_add_sample(&stats, end - start);
     }
-    double average = (double)total / MEASURE_COUNT;
-    printf("Average cycles for measured_function: %.2f\n", average);
-    printf("All measurements:\n");
-    for (int i = 0; i < MEASURE_COUNT; i++)
+
+    printf("Average cycles for measured_function: %.2f\n", stats_mean(&stats));
+    if (dump_path)
     {
-        printf("%lu", measurements[i]);
-        if (i < MEASURE_COUNT - 1)
-            printf(", ");
-        if ((i + 1) % 10 == 0)
-            printf("\n");  
+        FILE *f = stats_dump_open(dump_path);
+        tsc_info_t tsc;
+        tsc_probe(&tsc);
+        if (!f || stats_dump_write(&stats, f, "measured_function", (uint64_t)tsc.sample_hz, -1) < 0)
+        {
+            perror(dump_path);
+            return 1;
+        }
+        if (f != stdout)
+            fclose(f);
+        return 0;
     }
+    printf("All measurements:\n");
+    stats_print_samples(&stats, "measured_function", 10);
 
     return 0;
-}
\ No newline at end of file
+}
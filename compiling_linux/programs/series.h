@@ -0,0 +1,146 @@
+#ifndef SERIES_H
+#define SERIES_H
+
+/* Sample series of the user-space harnesses.
+ *
+ * A series records either raw samples (stats_t) or a constant-memory
+ * histogram (hist_t, -H), so N is not bounded by memory in histogram mode.
+ * In isolation mode (-I) samples pass through chunks first, and only
+ * chunks without interrupts/migrations/SMIs reach the series.
+ * With -P the series also carries the PMU counter deltas (pmu.h).
+ * Storage comes from a prefaulted arena (arena.h); faults counts the page
+ * faults taken while the series ran, to show there were none.
+ *
+ * Every series of a run records the same way: the harness fills in
+ * series_mode from its command line before the first series_init.
+ *
+ * Usage:
+ *   series_init(&s, n);
+ *   series_start(&s);
+ *   for (...) series_add(&s, t1 - t0);
+ *   series_stop(&s);
+ *   series_dump(&s, f, label, tsc.sample_hz);  // before reports reorder
+ *   series_print(&s, label);
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>             /* sched_getcpu, with _GNU_SOURCE */
+#include "stats.h"
+#include "hist.h"
+#include "stats_dump.h"
+#include "timing.h"
+#include "isolate.h"
+#include "pmu.h"
+#include "arena.h"
+
+typedef struct {
+    stats_t stats;
+    hist_t hist;
+    isolate_t iso;
+    pmu_series_t pmu;
+    faults_t faults;
+    uint64_t executed;          /* samples run, including dropped ones (marker.h) */
+} series_t;
+
+typedef struct {
+    int hist;                   /* -H: histograms instead of raw samples */
+    int isolating;              /* -I: samples pass through isolation chunks */
+    size_t iso_chunk;           /* -c: samples per isolation chunk */
+    int raw_only;               /* -R: no baseline-corrected report */
+    arena_t *arena;             /* where series_init takes the storage from */
+    pmu_t *pmu;                 /* -P: counters reported with every series */
+    const timing_calib_t *calib;    /* baseline of the corrected report */
+} series_mode_t;
+
+static series_mode_t series_mode;
+
+/* Bytes of sample storage a series of n samples takes from the arena */
+static inline size_t series_bytes(size_t n)
+{
+    return (series_mode.hist ? HIST_BUCKETS(HIST_DEFAULT_PRECISION) : n) * sizeof(uint64_t);
+}
+
+/* Take bytes from the arena; running out is a sizing bug, so it exits */
+static inline void *series_alloc(size_t bytes)
+{
+    arena_t *a = series_mode.arena;
+    void *p = arena_alloc(a, bytes);
+    if (!p) {
+        fprintf(stderr, "Sample arena exhausted (%zu of %zu bytes used, %zu more needed)\n",
+                a->used, a->size, bytes);
+        exit(1);
+    }
+    return p;
+}
+
+static inline void series_init(series_t *s, size_t n)
+{
+    if (series_mode.hist) {
+        size_t nb = HIST_BUCKETS(HIST_DEFAULT_PRECISION);
+        hist_init(&s->hist, series_alloc(series_bytes(n)), nb, HIST_DEFAULT_PRECISION);
+    } else {
+        stats_init(&s->stats, series_alloc(series_bytes(n)), n);
+    }
+    if (series_mode.isolating) isolate_init(&s->iso, series_mode.iso_chunk);
+    pmu_series_init(&s->pmu);
+    memset(&s->faults, 0, sizeof(s->faults));
+    s->executed = 0;
+}
+
+static inline void series_record(series_t *s, uint64_t v)
+{
+    if (series_mode.hist) hist_record(&s->hist, v);
+    else stats_add_sample(&s->stats, v);
+}
+
+/* Close the pending chunk; contaminated chunks are dropped */
+static inline void series_flush(series_t *s)
+{
+    if (isolate_end_chunk(&s->iso) == 0)
+        for (size_t i = 0; i < s->iso.npending; i++)
+            series_record(s, s->iso.pending[i]);
+    s->iso.npending = 0;
+}
+
+static inline void series_add(series_t *s, uint64_t v)
+{
+    if (!series_mode.isolating) series_record(s, v);
+    else if (isolate_add(&s->iso, v)) series_flush(s);
+}
+
+/* Bracket each measurement loop so chunk boundaries match the loop */
+static inline void series_start(series_t *s)
+{
+    if (series_mode.isolating) isolate_begin(&s->iso);
+}
+
+static inline void series_stop(series_t *s)
+{
+    if (series_mode.isolating) series_flush(s);
+}
+
+static inline void series_print(series_t *s, const char *label)
+{
+    if (series_mode.hist) hist_print_detailed(&s->hist, label);
+    else stats_print_detailed(&s->stats, label);
+    /* The corrected CIs need the raw samples */
+    if (!series_mode.hist && !series_mode.raw_only)
+        timing_print_corrected(&s->stats, series_mode.calib, label);
+    if (series_mode.isolating) isolate_print(&s->iso, label);
+    pmu_print(series_mode.pmu, &s->pmu, label);
+    faults_print(&s->faults, label);
+}
+
+/* Append the raw samples of a series to a binary dump (stats_dump.h)
+ * hz: sample units per second (tsc_info_t.sample_hz)
+ */
+static inline void series_dump(series_t *s, FILE *f, const char *label, double hz)
+{
+    if (stats_dump_write(&s->stats, f, label, (uint64_t)hz, sched_getcpu()) < 0)
+        perror("dump");
+}
+
+#endif /* SERIES_H */
@@ -0,0 +1,240 @@
+// Benchmarks for the stats.h reporting path itself (not for VM exits).
+// The reporting step runs after every harness, and on large runs it can
+// take longer than the measurement, so its cost is tracked here.
+//
+// Usage: stats-bench [mode] [N...]
+//   quantiles  stats_percentiles (selection) vs. qsort + lookups
+//   kernels    every stats_kernels.h variant vs. its scalar version
+//   dump       binary dump encode/decode vs. one printf per sample
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "stats.h"
+#include "stats_dump.h"
+
+static const double pcts[] = { 1.0, 5.0, 25.0, 50.0, 75.0, 95.0, 99.0, 99.9 };
+#define NPCTS (sizeof(pcts) / sizeof(pcts[0]))
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t rng_state = 88172645463325252ULL;
+static inline uint64_t xorshift64(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+// Exit-latency-like data: a narrow body around 1200 cycles with many
+// duplicate values, plus a sparse long tail.
+static void fill_samples(uint64_t *buf, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        uint64_t r = xorshift64();
+        uint64_t v = 1200 + (r & 0xff);
+        if ((r >> 8) % 1000 == 0) v += (r >> 20) % 200000;
+        buf[i] = v;
+    }
+}
+
+static int bench_quantiles(size_t n) {
+    uint64_t *ref = malloc(n * sizeof(uint64_t));
+    uint64_t *buf = malloc(n * sizeof(uint64_t));
+    if (!ref || !buf) {
+        printf("N=%zu: cannot allocate %zu MB, skipped\n", n, 2 * n * sizeof(uint64_t) >> 20);
+        free(ref); free(buf);
+        return 0;
+    }
+    fill_samples(ref, n);
+
+    stats_t stats;
+    double old_p[NPCTS], new_p[NPCTS];
+
+    // Old path: full qsort, then one lookup per percentile
+    memcpy(buf, ref, n * sizeof(uint64_t));
+    stats_init(&stats, buf, n);
+    stats.count = n;
+    double t0 = now_sec();
+    stats_sort(&stats);
+    for (size_t i = 0; i < NPCTS; i++)
+        old_p[i] = stats_percentile(&stats, pcts[i]);
+    double t_qsort = now_sec() - t0;
+
+    // New path: one multi-select call
+    memcpy(buf, ref, n * sizeof(uint64_t));
+    stats_init(&stats, buf, n);
+    stats.count = n;
+    t0 = now_sec();
+    stats_percentiles(&stats, pcts, new_p, NPCTS);
+    double t_select = now_sec() - t0;
+
+    // Appending after a selection must not need a re-sort
+    size_t half = n / 2;
+    memcpy(buf, ref, half * sizeof(uint64_t));
+    stats_init(&stats, buf, n);
+    stats.count = half;
+    stats_percentiles(&stats, pcts, new_p, NPCTS);
+    for (size_t i = half; i < n; i++)
+        stats_add_sample(&stats, ref[i]);
+    t0 = now_sec();
+    stats_percentiles(&stats, pcts, new_p, NPCTS);
+    double t_append = now_sec() - t0;
+
+    int ok = 1;
+    for (size_t i = 0; i < NPCTS; i++)
+        if (old_p[i] != new_p[i]) ok = 0;
+
+    printf("N=%-10zu qsort: %8.3f s  select: %8.3f s  after append: %8.3f s  speedup: %5.1fx  %s\n",
+           n, t_qsort, t_select, t_append, t_qsort / t_select, ok ? "match" : "MISMATCH");
+    free(ref);
+    free(buf);
+    return ok ? 0 : 1;
+}
+
+// Evaluate expr repeatedly for ~0.2 s, return GB/s over n samples
+#define THROUGHPUT(n, expr) ({                                          \
+        size_t reps_ = 0; double t0_ = now_sec(), dt_;                  \
+        do { expr; reps_++; dt_ = now_sec() - t0_; } while (dt_ < 0.2); \
+        (double)(n) * sizeof(uint64_t) * reps_ / dt_ / 1e9; })
+
+static int bench_kernels(size_t n) {
+    uint64_t *buf = malloc(n * sizeof(uint64_t));
+    uint64_t *idx = malloc(n * sizeof(uint64_t));
+    uint64_t *ref_idx = malloc(n * sizeof(uint64_t));
+    if (!buf || !idx || !ref_idx) {
+        printf("N=%zu: cannot allocate, skipped\n", n);
+        free(buf); free(idx); free(ref_idx);
+        return 0;
+    }
+    fill_samples(buf, n);
+
+    const stats_kernels_t *ref = stats_kernels_for(STATS_ISA_SCALAR);
+    uint64_t ref_min, ref_max, ref_sum;
+    ref->minmax_sum(buf, n, &ref_min, &ref_max, &ref_sum);
+    double ref_sq = ref->sumsq_dev(buf, n, ref_min);
+    uint64_t thr = (uint64_t)ref_sum / n + 100;
+    size_t ref_cnt = ref->count_above(buf, n, thr);
+    ref->hist_index(buf, n, HIST_DEFAULT_PRECISION, ref_idx);
+
+    int best = stats_isa_detect();
+    int ret = 0;
+    printf("N=%zu (GB/s)\n", n);
+    printf("  %-8s %12s %12s %12s %12s\n", "isa", "minmax_sum", "sumsq_dev", "count_above", "hist_index");
+    for (int isa = STATS_ISA_SCALAR; isa <= best; isa++) {
+        const stats_kernels_t *k = stats_kernels_for(isa);
+        uint64_t min, max, sum;
+        double sq = 0.0;
+        size_t cnt = 0;
+
+        k->minmax_sum(buf, n, &min, &max, &sum);
+        sq = k->sumsq_dev(buf, n, ref_min);
+        cnt = k->count_above(buf, n, thr);
+        k->hist_index(buf, n, HIST_DEFAULT_PRECISION, idx);
+        int ok = min == ref_min && max == ref_max && sum == ref_sum &&
+                 fabs(sq - ref_sq) <= 1e-9 * ref_sq && cnt == ref_cnt &&
+                 memcmp(idx, ref_idx, n * sizeof(uint64_t)) == 0;
+
+        double g1 = THROUGHPUT(n, k->minmax_sum(buf, n, &min, &max, &sum));
+        double g2 = THROUGHPUT(n, sq += k->sumsq_dev(buf, n, ref_min));
+        double g3 = THROUGHPUT(n, cnt += k->count_above(buf, n, thr));
+        double g4 = THROUGHPUT(n, k->hist_index(buf, n, HIST_DEFAULT_PRECISION, idx));
+        printf("  %-8s %12.2f %12.2f %12.2f %12.2f  %s\n", k->name, g1, g2, g3, g4,
+               ok ? "match" : "MISMATCH");
+        if (!ok) ret = 1;
+    }
+    free(buf);
+    free(idx);
+    free(ref_idx);
+    return ret;
+}
+
+static int bench_dump(size_t n) {
+    uint64_t *buf = malloc(n * sizeof(uint64_t));
+    uint64_t *out = malloc(STATS_DUMP_BLOCK * sizeof(uint64_t));
+    if (!buf || !out) {
+        printf("N=%zu: cannot allocate, skipped\n", n);
+        free(buf); free(out);
+        return 0;
+    }
+    fill_samples(buf, n);
+    stats_t stats;
+    stats_init(&stats, buf, n);
+    stats_add_samples(&stats, buf, n);
+
+    // Text: what stats_print_samples / rtdsc produce
+    char *text = NULL;
+    size_t text_size = 0;
+    FILE *f = open_memstream(&text, &text_size);
+    double t0 = now_sec();
+    for (size_t i = 0; i < n; i++)
+        fprintf(f, "%lu, ", buf[i]);
+    fclose(f);
+    double t_text = now_sec() - t0;
+    free(text);
+
+    char *bin = NULL;
+    size_t bin_size = 0;
+    f = open_memstream(&bin, &bin_size);
+    t0 = now_sec();
+    stats_dump_write(&stats, f, "bench", 0, -1);
+    fclose(f);
+    double t_enc = now_sec() - t0;
+
+    stats_dump_reader_t r;
+    stats_dump_reader_init(&r, bin, bin_size);
+    int ok = stats_dump_next_series(&r) == 1 && r.header.count == n;
+    size_t pos = 0;
+    long got;
+    t0 = now_sec();
+    while (ok && (got = stats_dump_read(&r, out, STATS_DUMP_BLOCK)) > 0) {
+        if (memcmp(out, buf + pos, got * sizeof(uint64_t)) != 0) ok = 0;
+        pos += got;
+    }
+    double t_dec = now_sec() - t0;
+    ok = ok && pos == n && stats_dump_next_series(&r) == 0;
+
+    printf("N=%-10zu text: %6.1f MB %7.1f Ms/s | binary: %6.1f MB (%.2f B/sample) "
+           "encode %7.1f Ms/s, decode %7.1f Ms/s  %s\n",
+           n, text_size / 1e6, n / t_text / 1e6, bin_size / 1e6, (double)bin_size / n,
+           n / t_enc / 1e6, n / t_dec / 1e6, ok ? "match" : "MISMATCH");
+    free(bin);
+    free(buf);
+    free(out);
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+    const char *mode = (argc > 1) ? argv[1] : "quantiles";
+    size_t sizes[16] = { 1000000, 10000000, 100000000 };
+    int nsizes = 3;
+
+    if (argc > 2) {
+        nsizes = 0;
+        for (int i = 2; i < argc && nsizes < 16; i++)
+            sizes[nsizes++] = strtoull(argv[i], NULL, 10);
+    }
+
+    int ret = 0;
+    if (strcmp(mode, "quantiles") == 0) {
+        printf("=== %zu percentiles: qsort vs. multi-select ===\n", NPCTS);
+        for (int i = 0; i < nsizes; i++)
+            ret |= bench_quantiles(sizes[i]);
+    } else if (strcmp(mode, "kernels") == 0) {
+        printf("=== Bulk kernels vs. scalar ===\n");
+        for (int i = 0; i < nsizes; i++)
+            ret |= bench_kernels(sizes[i]);
+    } else if (strcmp(mode, "dump") == 0) {
+        printf("=== Binary dump vs. text ===\n");
+        for (int i = 0; i < nsizes; i++)
+            ret |= bench_dump(sizes[i]);
+    } else {
+        printf("Usage: %s [quantiles|kernels|dump] [N...]\n", argv[0]);
+        return 1;
+    }
+    return ret;
+}
@@ -6,6 +6,9 @@
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include "stats_kernels.h"
+#include "stats_select.h"
+#include "report.h"
 
 /* Statistics data structure */
 typedef struct {
@@ -13,11 +16,28 @@ typedef struct {
     size_t count;
     size_t capacity;
     int is_sorted;  /* Flag to track if samples are sorted */
+    /* Running summary over every sample added, stored in the buffer or not */
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+    double mean;        /* Welford running mean */
+    double m2;          /* Welford sum of squared deviations from the mean */
 } stats_t;
 
+/* Reset the running summary (min/max/count/mean/M2) */
+static inline void stats_reset_summary(stats_t *stats)
+{
+    stats->total = 0;
+    stats->min = UINT64_MAX;
+    stats->max = 0;
+    stats->mean = 0.0;
+    stats->m2 = 0.0;
+}
+
 /* Initialize statistics structure with user-provided buffer
  * buffer: Pre-allocated memory for samples (must be at least capacity * sizeof(uint64_t))
  * capacity: Maximum number of samples the buffer can hold
+ * A NULL buffer with capacity 0 keeps only the running summary.
  */
 static inline void stats_init(stats_t *stats, uint64_t *buffer, size_t capacity)
 {
@@ -25,6 +45,7 @@ static inline void stats_init(stats_t *stats, uint64_t *buffer, size_t capacity)
     stats->count = 0;
     stats->capacity = capacity;
     stats->is_sorted = 0;
+    stats_reset_summary(stats);
 }
 
 /* Free statistics structure - now a no-op since memory is managed by caller */
@@ -34,11 +55,27 @@ static inline void stats_free(stats_t *stats)
     stats->samples = NULL;
     stats->count = 0;
     stats->capacity = 0;
+    stats_reset_summary(stats);
 }
 
-/* Add a single measurement/sample */
+/* Fold one value into the running summary (Welford's algorithm) */
+static inline void stats_update_summary(stats_t *stats, uint64_t value)
+{
+    stats->total++;
+    if (value < stats->min) stats->min = value;
+    if (value > stats->max) stats->max = value;
+    double delta = (double)value - stats->mean;
+    stats->mean += delta / stats->total;
+    stats->m2 += delta * ((double)value - stats->mean);
+}
+
+/* Add a single measurement/sample
+ * The summary always includes the value; returns -1 if the raw buffer is
+ * full (or disabled) and the value could not be stored for percentiles.
+ */
 static inline int stats_add_sample(stats_t *stats, uint64_t value)
 {
+    stats_update_summary(stats, value);
     if (stats->count >= stats->capacity) {
         /* Buffer is full - cannot add more samples */
         return -1;
@@ -48,25 +85,99 @@ static inline int stats_add_sample(stats_t *stats, uint64_t value)
     return 0;
 }
 
+/* Combine a partial summary (n values with the given min/max/mean/M2)
+ * into the running summary (Chan et al. parallel variance)
+ */
+static inline void stats_merge_summary(stats_t *stats, uint64_t n, uint64_t min,
+                                       uint64_t max, double mean, double m2)
+{
+    if (n == 0) return;
+    double n_a = stats->total, n_b = n, n_ab = n_a + n_b;
+    double delta = mean - stats->mean;
+    stats->mean += delta * n_b / n_ab;
+    stats->m2 += m2 + delta * delta * n_a * n_b / n_ab;
+    stats->total += n;
+    if (min < stats->min) stats->min = min;
+    if (max > stats->max) stats->max = max;
+}
+
+/* Fold a whole array into the running summary using the bulk kernels.
+ * Chunks keep the exact integer sum from overflowing.
+ */
+static inline void stats_summarize(stats_t *stats, const uint64_t *values, size_t n)
+{
+    const size_t chunk_max = 1 << 16;
+
+    while (n > 0) {
+        size_t chunk = n < chunk_max ? n : chunk_max;
+        const stats_kernels_t *k = stats_kernels();
+        uint64_t min, max, sum;
+
+        k->minmax_sum(values, chunk, &min, &max, &sum);
+        if (max - min >= (1ULL << 51))
+            k = stats_kernels_for(STATS_ISA_SCALAR);
+        double mean = (double)sum / chunk;
+        double off = mean - (double)min;
+        double m2 = k->sumsq_dev(values, chunk, min) - chunk * off * off;
+        stats_merge_summary(stats, chunk, min, max, mean, m2 > 0.0 ? m2 : 0.0);
+
+        values += chunk;
+        n -= chunk;
+    }
+}
+
 /* Add multiple measurements at once */
 static inline int stats_add_samples(stats_t *stats, uint64_t *values, size_t n)
 {
-    for (size_t i = 0; i < n; i++) {
-        if (stats_add_sample(stats, values[i]) != 0) {
-            return -1;  /* Buffer full */
-        }
+    size_t room = stats->capacity - stats->count;
+    size_t stored = n < room ? n : room;
+
+    stats_summarize(stats, values, n);
+    if (stored > 0) {
+        memcpy(stats->samples + stats->count, values, stored * sizeof(uint64_t));
+        stats->count += stored;
+        stats->is_sorted = 0;
     }
-    return 0;
+    return stored < n ? -1 : 0;  /* -1: buffer full */
 }
 
-/* Comparison function for qsort */
-static int compare_uint64(const void *a, const void *b)
+/* Rebuild the running summary from the stored samples, for buffers that
+ * were filled without stats_add_sample (e.g. loaded from a file)
+ */
+static inline void stats_recompute_summary(stats_t *stats)
 {
-    uint64_t val_a = *(const uint64_t *)a;
-    uint64_t val_b = *(const uint64_t *)b;
-    if (val_a < val_b) return -1;
-    if (val_a > val_b) return 1;
-    return 0;
+    stats_reset_summary(stats);
+    stats_summarize(stats, stats->samples, stats->count);
+}
+
+/* Initialize statistics structure over a buffer that already holds count
+ * samples (e.g. a buffer mapped from a kernel module). The samples are used
+ * in place, without a copy, and the running summary is rebuilt from them.
+ */
+static inline void stats_init_filled(stats_t *stats, uint64_t *buffer, size_t count)
+{
+    stats_init(stats, buffer, count);
+    stats->count = count;
+    stats_recompute_summary(stats);
+}
+
+/* Combine the summary of src into dst and append src's raw samples while
+ * dst has room. Used to fold per-phase or per-thread series without
+ * reprocessing their samples.
+ * Returns -1 if not all raw samples of src fit into dst.
+ */
+static inline int stats_merge(stats_t *dst, const stats_t *src)
+{
+    stats_merge_summary(dst, src->total, src->min, src->max, src->mean, src->m2);
+
+    size_t room = dst->capacity - dst->count;
+    size_t n = src->count < room ? src->count : room;
+    if (n > 0) {
+        memcpy(dst->samples + dst->count, src->samples, n * sizeof(uint64_t));
+        dst->count += n;
+        dst->is_sorted = 0;
+    }
+    return n < src->count ? -1 : 0;
 }
 
 /* Sort samples in place (required for median and percentile calculations) */
@@ -84,140 +195,256 @@ static inline void stats_ensure_sorted(stats_t *stats)
     stats_sort(stats);
 }
 
-/* Calculate minimum value */
-static inline uint64_t stats_min(stats_t *stats)
+/* Calculate several percentiles in one pass
+ * percentiles: values between 0 and 100, in any order
+ * results: receives one value per percentile
+ * n: number of percentiles (at most STATS_MAX_QUANTILES)
+ * Uses the same rank interpolation as stats_percentile. Samples are
+ * reordered in place but not fully sorted, so appending more samples
+ * later does not force a re-sort. Returns -1 if n is too large.
+ */
+static inline int stats_percentiles(stats_t *stats, const double *percentiles,
+                                    double *results, size_t n)
 {
-    if (stats->count == 0) return 0;
-    
-    uint64_t min_val = stats->samples[0];
-    for (size_t i = 1; i < stats->count; i++) {
-        if (stats->samples[i] < min_val) {
-            min_val = stats->samples[i];
+    size_t ranks[2 * STATS_MAX_QUANTILES];
+    size_t nranks = 0;
+
+    if (n > STATS_MAX_QUANTILES) return -1;
+    if (stats->count == 0) {
+        for (size_t i = 0; i < n; i++) results[i] = 0.0;
+        return 0;
+    }
+
+    /* Collect the lower and upper rank used by each percentile */
+    for (size_t i = 0; i < n; i++) {
+        double p = percentiles[i];
+        if (p < 0.0) p = 0.0;
+        if (p > 100.0) p = 100.0;
+        size_t lower_idx = (size_t)((p / 100.0) * (stats->count - 1));
+        ranks[nranks++] = lower_idx;
+        if (lower_idx + 1 < stats->count)
+            ranks[nranks++] = lower_idx + 1;
+    }
+
+    if (!stats->is_sorted)
+        stats_select_ranks(stats->samples, stats->count, ranks, nranks);
+
+    for (size_t i = 0; i < n; i++) {
+        double p = percentiles[i];
+        if (p < 0.0) p = 0.0;
+        if (p > 100.0) p = 100.0;
+        double rank = (p / 100.0) * (stats->count - 1);
+        size_t lower_idx = (size_t)rank;
+        size_t upper_idx = lower_idx + 1;
+        if (upper_idx >= stats->count) {
+            results[i] = stats->samples[stats->count - 1];
+        } else {
+            double fraction = rank - lower_idx;
+            results[i] = stats->samples[lower_idx] + fraction * (stats->samples[upper_idx] - stats->samples[lower_idx]);
         }
     }
-    return min_val;
+    return 0;
+}
+
+/* Calculate percentile
+ * percentile: value between 0 and 100 (e.g., 95 for 95th percentile)
+ */
+static inline double stats_percentile(stats_t *stats, double percentile)
+{
+    double result;
+    stats_percentiles(stats, &percentile, &result, 1);
+    return result;
+}
+
+/* Calculate minimum value */
+static inline uint64_t stats_min(stats_t *stats)
+{
+    return stats->total ? stats->min : 0;
 }
 
 /* Calculate maximum value */
 static inline uint64_t stats_max(stats_t *stats)
 {
-    if (stats->count == 0) return 0;
-    
-    uint64_t max_val = stats->samples[0];
-    for (size_t i = 1; i < stats->count; i++) {
-        if (stats->samples[i] > max_val) {
-            max_val = stats->samples[i];
-        }
-    }
-    return max_val;
+    return stats->max;
 }
 
 /* Calculate mean (average) */
 static inline double stats_mean(stats_t *stats)
 {
-    if (stats->count == 0) return 0.0;
-    
-    uint64_t sum = 0;
-    for (size_t i = 0; i < stats->count; i++) {
-        sum += stats->samples[i];
-    }
-    return (double)sum / stats->count;
+    return stats->mean;
 }
 
-/* Calculate median (requires sorted data) */
+/* Calculate median */
 static inline double stats_median(stats_t *stats)
 {
-    if (stats->count == 0) return 0.0;
-    
-    /* Ensure data is sorted */
-    stats_ensure_sorted(stats);
-    
-    double median;
-    if (stats->count % 2 == 0) {
-        /* Even number of samples - average of two middle values */
-        median = (stats->samples[stats->count / 2 - 1] + stats->samples[stats->count / 2]) / 2.0;
-    } else {
-        /* Odd number of samples - middle value */
-        median = stats->samples[stats->count / 2];
+    return stats_percentile(stats, 50.0);
+}
+
+/* Count stored samples above a threshold (e.g. "how many above p99") */
+static inline size_t stats_count_above(stats_t *stats, uint64_t threshold)
+{
+    return stats_kernels()->count_above(stats->samples, stats->count, threshold);
+}
+
+/* Calculate variance */
+static inline double stats_variance(stats_t *stats)
+{
+    if (stats->total == 0) return 0.0;
+    return stats->m2 / stats->total;
+}
+
+/* Calculate standard deviation */
+static inline double stats_stddev(stats_t *stats)
+{
+    return sqrt(stats_variance(stats));
+}
+
+/* Comparison function for qsort on doubles */
+static int compare_double(const void *a, const void *b)
+{
+    double val_a = *(const double *)a;
+    double val_b = *(const double *)b;
+    if (val_a < val_b) return -1;
+    if (val_a > val_b) return 1;
+    return 0;
+}
+
+/* Bootstrap replicates of several percentiles
+ * Each of the B replicates resamples the stored samples with replacement
+ * and computes every percentile on the resample.
+ * reps: receives n * B values; replicate b of percentiles[i] is reps[i * B + b]
+ * seed: any non-zero value, so runs are reproducible
+ * Returns -1 if there is no data or the scratch buffer cannot be allocated.
+ */
+static inline int stats_bootstrap(stats_t *stats, const double *percentiles, size_t n,
+                                  double *reps, size_t B, uint64_t seed)
+{
+    if (stats->count == 0 || n > STATS_MAX_QUANTILES) return -1;
+    uint64_t *scratch = malloc(stats->count * sizeof(uint64_t));
+    if (!scratch) return -1;
+
+    double vals[STATS_MAX_QUANTILES];
+    uint64_t x = seed ? seed : 1;
+    for (size_t b = 0; b < B; b++) {
+        for (size_t i = 0; i < stats->count; i++) {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            size_t idx = (size_t)(((unsigned __int128)x * stats->count) >> 64);
+            scratch[i] = stats->samples[idx];
+        }
+        stats_t r;
+        stats_init(&r, scratch, stats->count);
+        r.count = stats->count;
+        stats_percentiles(&r, percentiles, vals, n);
+        for (size_t i = 0; i < n; i++)
+            reps[i * B + b] = vals[i];
     }
-    
-    return median;
+    free(scratch);
+    return 0;
 }
 
-/* Calculate percentile (requires sorted data)
- * percentile: value between 0 and 100 (e.g., 95 for 95th percentile)
+/* Percentile confidence interval from B bootstrap replicates
+ * conf: confidence level, e.g. 0.95. Sorts reps in place.
  */
-static inline double stats_percentile(stats_t *stats, double percentile)
+static inline void stats_bootstrap_ci(double *reps, size_t B, double conf, double *lo, double *hi)
 {
-    if (stats->count == 0) return 0.0;
-    if (percentile < 0.0) percentile = 0.0;
-    if (percentile > 100.0) percentile = 100.0;
-    
-    /* Ensure data is sorted */
-    stats_ensure_sorted(stats);
-    
-    double rank = (percentile / 100.0) * (stats->count - 1);
-    size_t lower_idx = (size_t)rank;
-    size_t upper_idx = lower_idx + 1;
-    
-    double result;
-    if (upper_idx >= stats->count) {
-        result = stats->samples[stats->count - 1];
-    } else {
-        double fraction = rank - lower_idx;
-        result = stats->samples[lower_idx] + fraction * (stats->samples[upper_idx] - stats->samples[lower_idx]);
+    qsort(reps, B, sizeof(double), compare_double);
+    size_t l = (size_t)((1.0 - conf) / 2.0 * (B - 1));
+    size_t h = (size_t)((1.0 + conf) / 2.0 * (B - 1) + 0.5);
+    *lo = reps[l];
+    *hi = reps[h < B ? h : B - 1];
+}
+
+/* Distribution-free percentile confidence interval
+ * The bounds are the order statistics at ranks n*q -/+ z*sqrt(n*q*(1-q))
+ * (normal approximation of the binomial rank distribution), so it costs
+ * one selection instead of a bootstrap. z: 1.96 for 95%.
+ * Reorders samples in place like stats_percentiles.
+ */
+static inline void stats_percentile_ci(stats_t *stats, double percentile, double z,
+                                       double *lo, double *hi)
+{
+    size_t n = stats->count;
+    if (n == 0) {
+        *lo = *hi = 0.0;
+        return;
     }
-    
-    return result;
+    double q = percentile / 100.0;
+    double center = q * (n - 1), spread = z * sqrt(n * q * (1.0 - q));
+    size_t ranks[2];
+    ranks[0] = center - spread > 0.0 ? (size_t)(center - spread) : 0;
+    ranks[1] = center + spread + 1.0 < (double)(n - 1) ? (size_t)(center + spread + 1.0) : n - 1;
+    if (!stats->is_sorted)
+        stats_multiselect(stats->samples, 0, n - 1, ranks, ranks[1] > ranks[0] ? 2 : 1);
+    *lo = stats->samples[ranks[0]];
+    *hi = stats->samples[ranks[1]];
 }
 
-/* Calculate standard deviation */
-static inline double stats_stddev(stats_t *stats)
+/* Mann-Whitney U test, one-sided: do b's samples tend to be larger than a's?
+ * Ranks both sets in one merge pass over the sorted samples (sorts both);
+ * ties get mid-ranks and the variance the usual tie correction. p comes
+ * from the normal approximation, which is accurate from a few dozen
+ * samples per set. The opposite direction's p is 1 - p.
+ * prob: P(b > a) + P(b == a) / 2 for one random sample of each
+ * Returns -1 if either set is empty.
+ */
+static inline int stats_mann_whitney(stats_t *a, stats_t *b, double *z, double *p, double *prob)
 {
-    if (stats->count == 0) return 0.0;
-    
-    double mean = stats_mean(stats);
-    double sum_sq_diff = 0.0;
-    
-    for (size_t i = 0; i < stats->count; i++) {
-        double diff = stats->samples[i] - mean;
-        sum_sq_diff += diff * diff;
+    size_t na = a->count, nb = b->count, i = 0, j = 0;
+    double rank = 0.0, rb = 0.0, ties = 0.0;
+
+    if (na == 0 || nb == 0) return -1;
+    stats_sort(a);
+    stats_sort(b);
+    while (i < na || j < nb) {
+        uint64_t v = j == nb || (i < na && a->samples[i] < b->samples[j]) ?
+                     a->samples[i] : b->samples[j];
+        size_t ca = 0, cb = 0;
+        while (i < na && a->samples[i] == v) i++, ca++;
+        while (j < nb && b->samples[j] == v) j++, cb++;
+        double t = (double)(ca + cb);
+        rb += cb * (rank + (t + 1.0) / 2.0);
+        ties += t * t * t - t;
+        rank += t;
     }
-    
-    return sqrt(sum_sq_diff / stats->count);
+
+    double n = (double)(na + nb), nab = (double)na * nb;
+    double u = rb - (double)nb * (nb + 1) / 2.0;
+    double var = nab / 12.0 * ((n + 1.0) - ties / (n * (n - 1.0)));
+    *prob = u / nab;
+    *z = var > 0.0 ? (u - nab / 2.0) / sqrt(var) : 0.0;
+    *p = 0.5 * erfc(*z / sqrt(2.0));
+    return 0;
 }
 
-/* Calculate variance */
-static inline double stats_variance(stats_t *stats)
+/* Print the sample count, noting samples that did not fit the raw buffer */
+static inline void stats_print_count(stats_t *stats)
 {
-    if (stats->count == 0) return 0.0;
-    
-    double mean = stats_mean(stats);
-    double sum_sq_diff = 0.0;
-    
-    for (size_t i = 0; i < stats->count; i++) {
-        double diff = stats->samples[i] - mean;
-        sum_sq_diff += diff * diff;
+    printf("Sample count:   %lu\n", stats->total);
+    if (stats->count < stats->total) {
+        printf("Stored:         %zu (percentiles use stored samples only)\n", stats->count);
     }
-    
-    return sum_sq_diff / stats->count;
 }
 
 /* Print basic statistics summary */
 static inline void stats_print_summary(stats_t *stats, const char *label)
 {
-    if (stats->count == 0) {
+    if (stats->total == 0) {
         printf("%s: No data\n", label);
         return;
     }
     
     printf("\n=== Statistics Summary: %s ===\n", label);
-    printf("Sample count:   %zu\n", stats->count);
-    printf("Min:            %lu\n", stats_min(stats));
-    printf("Max:            %lu\n", stats_max(stats));
-    printf("Mean:           %.2f\n", stats_mean(stats));
-    printf("Median:         %.2f\n", stats_median(stats));
-    printf("Std Dev:        %.2f\n", stats_stddev(stats));
+    stats_print_count(stats);
+    stats_print_header();
+    stats_print_cycles("Min:", stats_min(stats));
+    stats_print_cycles("Max:", stats_max(stats));
+    stats_print_value("Mean:", stats_mean(stats));
+    if (stats->count > 0) {
+        stats_print_value("Median:", stats_median(stats));
+    }
+    stats_print_value("Std Dev:", stats_stddev(stats));
     printf("Variance:       %.2f\n", stats_variance(stats));
     printf("================================\n\n");
 }
@@ -225,27 +452,39 @@ static inline void stats_print_summary(stats_t *stats, const char *label)
 /* Print detailed statistics with percentiles */
 static inline void stats_print_detailed(stats_t *stats, const char *label)
 {
-    if (stats->count == 0) {
+    if (stats->total == 0) {
         printf("%s: No data\n", label);
         return;
     }
     
+    static const double pcts[] = { 1.0, 5.0, 25.0, 50.0, 75.0, 95.0, 99.0 };
+    double p[7];
+    stats_percentiles(stats, pcts, p, 7);
+
     printf("\n=== Detailed Statistics: %s ===\n", label);
-    printf("Sample count:   %zu\n", stats->count);
-    printf("Min:            %lu\n", stats_min(stats));
-    printf("Max:            %lu\n", stats_max(stats));
-    printf("Mean:           %.2f\n", stats_mean(stats));
-    printf("Median (50%%):   %.2f\n", stats_median(stats));
-    printf("Std Dev:        %.2f\n", stats_stddev(stats));
+    stats_print_count(stats);
+    stats_print_header();
+    stats_print_cycles("Min:", stats_min(stats));
+    stats_print_cycles("Max:", stats_max(stats));
+    stats_print_value("Mean:", stats_mean(stats));
+    if (stats->count == 0) {
+        stats_print_value("Std Dev:", stats_stddev(stats));
+        printf("Variance:       %.2f\n", stats_variance(stats));
+        printf("(no raw samples stored, percentiles unavailable)\n");
+        printf("====================================\n\n");
+        return;
+    }
+    stats_print_value("Median (50%):", p[3]);
+    stats_print_value("Std Dev:", stats_stddev(stats));
     printf("Variance:       %.2f\n", stats_variance(stats));
     printf("\nPercentiles:\n");
-    printf("  1st:          %.2f\n", stats_percentile(stats, 1.0));
-    printf("  5th:          %.2f\n", stats_percentile(stats, 5.0));
-    printf("  25th:         %.2f\n", stats_percentile(stats, 25.0));
-    printf("  50th:         %.2f\n", stats_percentile(stats, 50.0));
-    printf("  75th:         %.2f\n", stats_percentile(stats, 75.0));
-    printf("  95th:         %.2f\n", stats_percentile(stats, 95.0));
-    printf("  99th:         %.2f\n", stats_percentile(stats, 99.0));
+    stats_print_value("  1st:", p[0]);
+    stats_print_value("  5th:", p[1]);
+    stats_print_value("  25th:", p[2]);
+    stats_print_value("  50th:", p[3]);
+    stats_print_value("  75th:", p[4]);
+    stats_print_value("  95th:", p[5]);
+    stats_print_value("  99th:", p[6]);
     printf("====================================\n\n");
 }
 
@@ -0,0 +1,213 @@
+#ifndef STATS_DUMP_H
+#define STATS_DUMP_H
+
+/* Compact binary dump of stats_t series.
+ *
+ * A dump file is a sequence of series. Each series is a fixed header, the
+ * label, then the samples in blocks. Samples are stored in buffer order as
+ * zigzag-encoded deltas to the previous sample, written as LEB128 varints,
+ * so a typical exit latency sample takes 1-2 bytes instead of the ~6 of
+ * its decimal text. A block with nbytes == 0 ends the series. Blocks let
+ * the writer stream to a pipe or a serial port without seeking back, and
+ * let the reader decode with constant memory.
+ *
+ * All integers are little endian.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <termios.h>
+#include "stats.h"
+
+#define STATS_DUMP_MAGIC    "KVMSTAT1"
+#define STATS_DUMP_VERSION  1
+#define STATS_DUMP_BLOCK    8192    /* samples per block */
+#define STATS_DUMP_LABEL_MAX 255
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t label_len;     /* label bytes follow the header */
+    uint64_t count;         /* number of samples in the series */
+    uint64_t tsc_hz;        /* TSC frequency, 0 if unknown */
+    int32_t cpu;            /* CPU the series was measured on, -1 if unknown */
+    uint32_t reserved;
+} stats_dump_header_t;
+
+typedef struct {
+    uint32_t nbytes;        /* encoded bytes that follow, 0 = end of series */
+    uint32_t nsamples;
+} stats_dump_block_t;
+
+static inline uint8_t *stats_dump_put_varint(uint8_t *p, uint64_t v)
+{
+    while (v >= 0x80) {
+        *p++ = (uint8_t)v | 0x80;
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+/* Open a dump destination. Serial ports are switched to raw mode so the
+ * tty layer does not rewrite bytes (e.g. '\n' -> "\r\n").
+ */
+static inline FILE *stats_dump_open(const char *path)
+{
+    FILE *f = strcmp(path, "-") == 0 ? stdout : fopen(path, "wb");
+    if (f && isatty(fileno(f))) {
+        struct termios t;
+        if (tcgetattr(fileno(f), &t) == 0) {
+            cfmakeraw(&t);
+            tcsetattr(fileno(f), TCSANOW, &t);
+        }
+    }
+    return f;
+}
+
+/* Write the stored samples of a series
+ * tsc_hz: TSC frequency in Hz, or 0 if unknown
+ * cpu: CPU the samples were taken on, or -1
+ * Returns 0 on success, -1 on write error.
+ */
+static inline int stats_dump_write(stats_t *stats, FILE *f, const char *label,
+                                   uint64_t tsc_hz, int cpu)
+{
+    static uint8_t buf[sizeof(stats_dump_block_t) + STATS_DUMP_BLOCK * 10];
+    stats_dump_header_t h;
+    size_t label_len = strlen(label);
+    uint64_t prev = 0;
+
+    if (label_len > STATS_DUMP_LABEL_MAX) label_len = STATS_DUMP_LABEL_MAX;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, STATS_DUMP_MAGIC, sizeof(h.magic));
+    h.version = STATS_DUMP_VERSION;
+    h.label_len = label_len;
+    h.count = stats->count;
+    h.tsc_hz = tsc_hz;
+    h.cpu = cpu;
+    if (fwrite(&h, sizeof(h), 1, f) != 1 || fwrite(label, 1, label_len, f) != label_len)
+        return -1;
+
+    for (size_t i = 0; i < stats->count; i += STATS_DUMP_BLOCK) {
+        size_t n = stats->count - i < STATS_DUMP_BLOCK ? stats->count - i : STATS_DUMP_BLOCK;
+        uint8_t *p = buf + sizeof(stats_dump_block_t);
+        for (size_t j = 0; j < n; j++) {
+            uint64_t v = stats->samples[i + j];
+            int64_t d = (int64_t)(v - prev);
+            p = stats_dump_put_varint(p, ((uint64_t)d << 1) ^ (uint64_t)(d >> 63));
+            prev = v;
+        }
+        stats_dump_block_t b = { (uint32_t)(p - buf - sizeof(b)), (uint32_t)n };
+        memcpy(buf, &b, sizeof(b));
+        if (fwrite(buf, 1, p - buf, f) != (size_t)(p - buf))
+            return -1;
+    }
+
+    stats_dump_block_t end = { 0, 0 };
+    if (fwrite(&end, sizeof(end), 1, f) != 1)
+        return -1;
+    return fflush(f) == 0 ? 0 : -1;
+}
+
+/* Streaming reader over a dump held in memory (typically mmap'ed) */
+typedef struct {
+    const uint8_t *p;
+    const uint8_t *end;
+    stats_dump_header_t header;     /* header of the current series */
+    char label[STATS_DUMP_LABEL_MAX + 1];
+    const uint8_t *block_end;       /* end of the current block */
+    uint32_t block_left;            /* samples left in the current block */
+    uint64_t prev;
+    int in_series;
+} stats_dump_reader_t;
+
+static inline void stats_dump_reader_init(stats_dump_reader_t *r, const void *data, size_t size)
+{
+    memset(r, 0, sizeof(*r));
+    r->p = data;
+    r->end = r->p + size;
+}
+
+/* Decode up to max samples of the current series into out
+ * Returns the number of samples decoded (0 at end of series), -1 on
+ * corrupt data.
+ */
+static inline long stats_dump_read(stats_dump_reader_t *r, uint64_t *out, size_t max)
+{
+    size_t n = 0;
+
+    while (n < max && r->in_series) {
+        if (r->block_left == 0) {
+            stats_dump_block_t b;
+            if (r->p != r->block_end && r->block_end) return -1;
+            if ((size_t)(r->end - r->p) < sizeof(b)) return -1;
+            memcpy(&b, r->p, sizeof(b));
+            r->p += sizeof(b);
+            if (b.nbytes == 0) {
+                r->in_series = 0;
+                r->block_end = NULL;
+                break;
+            }
+            if ((size_t)(r->end - r->p) < b.nbytes) return -1;
+            r->block_end = r->p + b.nbytes;
+            r->block_left = b.nsamples;
+            continue;
+        }
+
+        const uint8_t *p = r->p, *e = r->block_end;
+        uint64_t prev = r->prev;
+        size_t todo = max - n < r->block_left ? max - n : r->block_left;
+        for (size_t i = 0; i < todo; i++) {
+            uint64_t v = 0;
+            unsigned int shift = 0;
+            do {
+                if (p == e || shift > 63) return -1;
+                v |= (uint64_t)(*p & 0x7f) << shift;
+                shift += 7;
+            } while (*p++ & 0x80);
+            prev += (uint64_t)((int64_t)(v >> 1) ^ -(int64_t)(v & 1));
+            out[n++] = prev;
+        }
+        r->p = p;
+        r->prev = prev;
+        r->block_left -= todo;
+    }
+    return n;
+}
+
+/* Advance to the next series header
+ * Returns 1 if a series was found, 0 at end of data, -1 on corrupt data.
+ */
+static inline int stats_dump_next_series(stats_dump_reader_t *r)
+{
+    uint64_t skip[STATS_DUMP_BLOCK];
+
+    /* Skip whatever is left of the current series */
+    while (r->in_series) {
+        if (stats_dump_read(r, skip, STATS_DUMP_BLOCK) < 0)
+            return -1;
+    }
+
+    if (r->p == r->end) return 0;
+    if ((size_t)(r->end - r->p) < sizeof(r->header)) return -1;
+    memcpy(&r->header, r->p, sizeof(r->header));
+    r->p += sizeof(r->header);
+    if (memcmp(r->header.magic, STATS_DUMP_MAGIC, 8) != 0 ||
+        r->header.version != STATS_DUMP_VERSION ||
+        r->header.label_len > STATS_DUMP_LABEL_MAX ||
+        (size_t)(r->end - r->p) < r->header.label_len) {
+        return -1;
+    }
+    memcpy(r->label, r->p, r->header.label_len);
+    r->label[r->header.label_len] = '\0';
+    r->p += r->header.label_len;
+    r->block_left = 0;
+    r->prev = 0;
+    r->in_series = 1;
+    return 1;
+}
+
+#endif /* STATS_DUMP_H */
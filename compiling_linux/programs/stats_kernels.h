@@ -0,0 +1,306 @@
+#ifndef STATS_KERNELS_H
+#define STATS_KERNELS_H
+
+/* Bulk kernels over raw uint64_t sample arrays, used by stats.h when many
+ * samples are processed at once (stats_add_samples, summaries of dumped
+ * or mapped buffers, threshold counts, histogram binning).
+ *
+ * Every kernel has a scalar, an AVX2 and an AVX-512 version. The best one
+ * the CPU supports is picked at runtime, so the static binaries built by
+ * programs/Makefile stay portable. STATS_ISA=scalar|avx2|avx512 in the
+ * environment overrides the choice.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+#include "hist.h"
+
+typedef struct {
+    const char *name;
+    /* min, max and exact sum of v[0..n-1] (n > 0; caller keeps sum in range) */
+    void (*minmax_sum)(const uint64_t *v, size_t n, uint64_t *min, uint64_t *max, uint64_t *sum);
+    /* sum of (v[i] - shift)^2; requires shift <= v[i] and v[i] - shift < 2^51 */
+    double (*sumsq_dev)(const uint64_t *v, size_t n, uint64_t shift);
+    /* number of v[i] > threshold */
+    size_t (*count_above)(const uint64_t *v, size_t n, uint64_t threshold);
+    /* hist_index(precision, v[i]) for every i */
+    void (*hist_index)(const uint64_t *v, size_t n, unsigned int precision, uint64_t *idx);
+} stats_kernels_t;
+
+enum { STATS_ISA_SCALAR, STATS_ISA_AVX2, STATS_ISA_AVX512, STATS_ISA_COUNT };
+
+/* ---- Scalar reference versions ---- */
+
+static inline void stats_minmax_sum_scalar(const uint64_t *v, size_t n,
+                                           uint64_t *min, uint64_t *max, uint64_t *sum)
+{
+    uint64_t lo = UINT64_MAX, hi = 0, s = 0;
+    for (size_t i = 0; i < n; i++) {
+        lo = v[i] < lo ? v[i] : lo;
+        hi = v[i] > hi ? v[i] : hi;
+        s += v[i];
+    }
+    *min = lo;
+    *max = hi;
+    *sum = s;
+}
+
+static inline double stats_sumsq_dev_scalar(const uint64_t *v, size_t n, uint64_t shift)
+{
+    double s = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        double d = (double)(v[i] - shift);
+        s += d * d;
+    }
+    return s;
+}
+
+static inline size_t stats_count_above_scalar(const uint64_t *v, size_t n, uint64_t threshold)
+{
+    size_t c = 0;
+    for (size_t i = 0; i < n; i++)
+        c += v[i] > threshold;
+    return c;
+}
+
+static inline void stats_hist_index_scalar(const uint64_t *v, size_t n,
+                                           unsigned int precision, uint64_t *idx)
+{
+    for (size_t i = 0; i < n; i++) {
+        unsigned int msb = 63 - __builtin_clzll(v[i] | (1ULL << precision));
+        unsigned int shift = msb - precision;
+        idx[i] = ((uint64_t)shift << precision) + (v[i] >> shift);
+    }
+}
+
+/* ---- AVX2 versions ----
+ * AVX2 has no unsigned 64-bit compare, so values are compared with their
+ * sign bit flipped. It also has no int64->double conversion; differences
+ * below 2^51 are converted exactly with the 1.5*2^52 magic-number trick.
+ */
+
+__attribute__((target("avx2")))
+static inline void stats_minmax_sum_avx2(const uint64_t *v, size_t n,
+                                         uint64_t *min, uint64_t *max, uint64_t *sum)
+{
+    const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+    __m256i vmin = _mm256_set1_epi64x(INT64_MAX);    /* UINT64_MAX, flipped */
+    __m256i vmax = _mm256_set1_epi64x(INT64_MIN);    /* 0, flipped */
+    __m256i vsum = _mm256_setzero_si256();
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(v + i));
+        __m256i xf = _mm256_xor_si256(x, sign);
+        vmin = _mm256_blendv_epi8(vmin, xf, _mm256_cmpgt_epi64(vmin, xf));
+        vmax = _mm256_blendv_epi8(vmax, xf, _mm256_cmpgt_epi64(xf, vmax));
+        vsum = _mm256_add_epi64(vsum, x);
+    }
+
+    uint64_t lo[4], hi[4], s[4];
+    _mm256_storeu_si256((__m256i *)lo, _mm256_xor_si256(vmin, sign));
+    _mm256_storeu_si256((__m256i *)hi, _mm256_xor_si256(vmax, sign));
+    _mm256_storeu_si256((__m256i *)s, vsum);
+
+    uint64_t tmin, tmax, tsum = 0;
+    stats_minmax_sum_scalar(v + i, n - i, &tmin, &tmax, &tsum);
+    for (int k = 0; k < 4; k++) {
+        tmin = lo[k] < tmin ? lo[k] : tmin;
+        tmax = hi[k] > tmax ? hi[k] : tmax;
+        tsum += s[k];
+    }
+    *min = tmin;
+    *max = tmax;
+    *sum = tsum;
+}
+
+__attribute__((target("avx2")))
+static inline double stats_sumsq_dev_avx2(const uint64_t *v, size_t n, uint64_t shift)
+{
+    const __m256i magic_i = _mm256_set1_epi64x(0x4338000000000000LL);
+    const __m256d magic_d = _mm256_castsi256_pd(magic_i);
+    const __m256i vshift = _mm256_set1_epi64x((long long)shift);
+    __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m256i x0 = _mm256_sub_epi64(_mm256_loadu_si256((const __m256i *)(v + i)), vshift);
+        __m256i x1 = _mm256_sub_epi64(_mm256_loadu_si256((const __m256i *)(v + i + 4)), vshift);
+        __m256d d0 = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_add_epi64(x0, magic_i)), magic_d);
+        __m256d d1 = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_add_epi64(x1, magic_i)), magic_d);
+        acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(d0, d0));
+        acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(d1, d1));
+    }
+
+    double a[4];
+    _mm256_storeu_pd(a, _mm256_add_pd(acc0, acc1));
+    return a[0] + a[1] + a[2] + a[3] + stats_sumsq_dev_scalar(v + i, n - i, shift);
+}
+
+__attribute__((target("avx2")))
+static inline size_t stats_count_above_avx2(const uint64_t *v, size_t n, uint64_t threshold)
+{
+    const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+    const __m256i thr = _mm256_set1_epi64x((long long)(threshold ^ (1ULL << 63)));
+    __m256i cnt = _mm256_setzero_si256();
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m256i xf = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(v + i)), sign);
+        cnt = _mm256_sub_epi64(cnt, _mm256_cmpgt_epi64(xf, thr));   /* mask is -1 */
+    }
+
+    uint64_t c[4];
+    _mm256_storeu_si256((__m256i *)c, cnt);
+    return c[0] + c[1] + c[2] + c[3] + stats_count_above_scalar(v + i, n - i, threshold);
+}
+
+/* ---- AVX-512 versions (F + DQ + CD) ---- */
+
+#define STATS_AVX512_TARGET __attribute__((target("avx512f,avx512dq,avx512cd")))
+
+STATS_AVX512_TARGET
+static inline void stats_minmax_sum_avx512(const uint64_t *v, size_t n,
+                                           uint64_t *min, uint64_t *max, uint64_t *sum)
+{
+    __m512i vmin = _mm512_set1_epi64(-1);
+    __m512i vmax = _mm512_setzero_si512();
+    __m512i vsum = _mm512_setzero_si512();
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m512i x = _mm512_loadu_si512((const void *)(v + i));
+        vmin = _mm512_min_epu64(vmin, x);
+        vmax = _mm512_max_epu64(vmax, x);
+        vsum = _mm512_add_epi64(vsum, x);
+    }
+
+    uint64_t tmin, tmax, tsum = 0;
+    stats_minmax_sum_scalar(v + i, n - i, &tmin, &tmax, &tsum);
+    uint64_t lo = _mm512_reduce_min_epu64(vmin);
+    uint64_t hi = _mm512_reduce_max_epu64(vmax);
+    *min = lo < tmin ? lo : tmin;
+    *max = hi > tmax ? hi : tmax;
+    *sum = tsum + (uint64_t)_mm512_reduce_add_epi64(vsum);
+}
+
+STATS_AVX512_TARGET
+static inline double stats_sumsq_dev_avx512(const uint64_t *v, size_t n, uint64_t shift)
+{
+    const __m512i vshift = _mm512_set1_epi64((long long)shift);
+    __m512d acc0 = _mm512_setzero_pd(), acc1 = _mm512_setzero_pd();
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m512d d0 = _mm512_cvtepu64_pd(_mm512_sub_epi64(_mm512_loadu_si512((const void *)(v + i)), vshift));
+        __m512d d1 = _mm512_cvtepu64_pd(_mm512_sub_epi64(_mm512_loadu_si512((const void *)(v + i + 8)), vshift));
+        acc0 = _mm512_add_pd(acc0, _mm512_mul_pd(d0, d0));
+        acc1 = _mm512_add_pd(acc1, _mm512_mul_pd(d1, d1));
+    }
+
+    return _mm512_reduce_add_pd(_mm512_add_pd(acc0, acc1)) +
+           stats_sumsq_dev_scalar(v + i, n - i, shift);
+}
+
+STATS_AVX512_TARGET
+static inline size_t stats_count_above_avx512(const uint64_t *v, size_t n, uint64_t threshold)
+{
+    const __m512i thr = _mm512_set1_epi64((long long)threshold);
+    size_t c = 0;
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __mmask8 m = _mm512_cmpgt_epu64_mask(_mm512_loadu_si512((const void *)(v + i)), thr);
+        c += __builtin_popcount(m);
+    }
+    return c + stats_count_above_scalar(v + i, n - i, threshold);
+}
+
+STATS_AVX512_TARGET
+static inline void stats_hist_index_avx512(const uint64_t *v, size_t n,
+                                           unsigned int precision, uint64_t *idx)
+{
+    const __m512i low = _mm512_set1_epi64(1LL << precision);
+    const __m512i top = _mm512_set1_epi64(63 - precision);
+    const __m128i p = _mm_cvtsi32_si128((int)precision);
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m512i x = _mm512_loadu_si512((const void *)(v + i));
+        __m512i shift = _mm512_sub_epi64(top, _mm512_lzcnt_epi64(_mm512_or_si512(x, low)));
+        __m512i r = _mm512_add_epi64(_mm512_sll_epi64(shift, p), _mm512_srlv_epi64(x, shift));
+        _mm512_storeu_si512((void *)(idx + i), r);
+    }
+    stats_hist_index_scalar(v + i, n - i, precision, idx + i);
+}
+
+/* ---- Dispatch ---- */
+
+static inline const stats_kernels_t *stats_kernels_for(int isa)
+{
+    static const stats_kernels_t table[STATS_ISA_COUNT] = {
+        [STATS_ISA_SCALAR] = { "scalar", stats_minmax_sum_scalar, stats_sumsq_dev_scalar,
+                               stats_count_above_scalar, stats_hist_index_scalar },
+        /* AVX2 has no variable 64-bit lzcnt; the scalar index uses LZCNT/BSR */
+        [STATS_ISA_AVX2]   = { "avx2", stats_minmax_sum_avx2, stats_sumsq_dev_avx2,
+                               stats_count_above_avx2, stats_hist_index_scalar },
+        [STATS_ISA_AVX512] = { "avx512", stats_minmax_sum_avx512, stats_sumsq_dev_avx512,
+                               stats_count_above_avx512, stats_hist_index_avx512 },
+    };
+    return &table[isa];
+}
+
+/* Best ISA supported by this CPU (or forced with STATS_ISA) */
+static inline int stats_isa_detect(void)
+{
+    const char *env = getenv("STATS_ISA");
+    int best = STATS_ISA_SCALAR;
+
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        best = STATS_ISA_AVX2;
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq") &&
+        __builtin_cpu_supports("avx512cd"))
+        best = STATS_ISA_AVX512;
+
+    if (env) {
+        for (int isa = STATS_ISA_SCALAR; isa <= best; isa++)
+            if (strcmp(env, stats_kernels_for(isa)->name) == 0)
+                return isa;
+    }
+    return best;
+}
+
+static inline const stats_kernels_t *stats_kernels(void)
+{
+    static const stats_kernels_t *kernels;
+    if (!kernels)
+        kernels = stats_kernels_for(stats_isa_detect());
+    return kernels;
+}
+
+/* Record many values into a histogram, computing bucket indexes in bulk */
+static inline void hist_record_bulk(hist_t *hist, const uint64_t *values, size_t n)
+{
+    const stats_kernels_t *k = stats_kernels();
+    uint64_t idx[256];
+
+    while (n > 0) {
+        size_t chunk = n < 256 ? n : 256;
+        uint64_t min, max, sum;
+        k->hist_index(values, chunk, hist->precision, idx);
+        for (size_t i = 0; i < chunk; i++)
+            hist->counts[idx[i]]++;
+        k->minmax_sum(values, chunk, &min, &max, &sum);
+        hist->count += chunk;
+        hist->sum += sum;
+        if (min < hist->min) hist->min = min;
+        if (max > hist->max) hist->max = max;
+        values += chunk;
+        n -= chunk;
+    }
+}
+
+#endif /* STATS_KERNELS_H */
@@ -0,0 +1,187 @@
+#ifndef STATS_SELECT_H
+#define STATS_SELECT_H
+
+/* Order statistics over raw sample arrays, shared by stats.h and the
+ * kernel modules so both sides compute percentiles the same way.
+ *
+ * A percentile p sits at rank p/100 * (n - 1) and is interpolated
+ * linearly between the two neighbouring order statistics. The ranks
+ * needed are found by selection (introselect) in place, O(N) per rank
+ * instead of a full sort; the samples end up reordered but not sorted.
+ *
+ * The integer-only part works in basis points (1/100 of a percent,
+ * 9990 = p99.9) and returns values x 100, for callers without floating
+ * point such as the kernel.
+ */
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/sort.h>
+#else
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#endif
+
+/* Comparison function for qsort */
+static int compare_uint64(const void *a, const void *b)
+{
+    uint64_t val_a = *(const uint64_t *)a;
+    uint64_t val_b = *(const uint64_t *)b;
+    if (val_a < val_b) return -1;
+    if (val_a > val_b) return 1;
+    return 0;
+}
+
+#ifdef __KERNEL__
+#define STATS_SORT_U64(v, n) sort((v), (n), sizeof(uint64_t), compare_uint64, NULL)
+#else
+#define STATS_SORT_U64(v, n) qsort((v), (n), sizeof(uint64_t), compare_uint64)
+#endif
+
+/* Maximum number of percentiles per stats_percentiles call */
+#define STATS_MAX_QUANTILES 64
+
+static inline void stats_swap(uint64_t *a, uint64_t *b)
+{
+    uint64_t t = *a;
+    *a = *b;
+    *b = t;
+}
+
+/* Three-way partition of v[lo..hi] around a median-of-three pivot.
+ * On return v[lo..*lt-1] < pivot, v[*lt..*gt] == pivot, v[*gt+1..hi] > pivot.
+ * Cycle counts have many duplicates, so equal keys are grouped together
+ * instead of being split across both sides.
+ */
+static inline void stats_partition(uint64_t *v, size_t lo, size_t hi, size_t *lt, size_t *gt)
+{
+    size_t mid = lo + (hi - lo) / 2;
+    if (v[mid] < v[lo]) stats_swap(&v[mid], &v[lo]);
+    if (v[hi] < v[lo]) stats_swap(&v[hi], &v[lo]);
+    if (v[hi] < v[mid]) stats_swap(&v[hi], &v[mid]);
+    uint64_t pivot = v[mid];
+
+    size_t l = lo, i = lo, g = hi;
+    while (i <= g) {
+        if (v[i] < pivot) {
+            stats_swap(&v[l++], &v[i++]);
+        } else if (v[i] > pivot) {
+            stats_swap(&v[i], &v[g--]);
+        } else {
+            i++;
+        }
+    }
+    *lt = l;
+    *gt = g;
+}
+
+/* Introselect: place the k-th smallest element of v[lo..hi] at v[k], with
+ * everything before it <= v[k] and everything after it >= v[k]. Falls back
+ * to sorting the remaining range if partitioning degenerates.
+ */
+static inline void stats_select(uint64_t *v, size_t lo, size_t hi, size_t k)
+{
+    int depth = 2 * (64 - __builtin_clzll((unsigned long long)(hi - lo + 1)));
+
+    while (lo < hi) {
+        if (depth-- == 0) {
+            STATS_SORT_U64(v + lo, hi - lo + 1);
+            return;
+        }
+        size_t lt, gt;
+        stats_partition(v, lo, hi, &lt, &gt);
+        if (k < lt) hi = lt - 1;
+        else if (k > gt) lo = gt + 1;
+        else return;
+    }
+}
+
+/* Select every rank in ranks[0..n-1] (sorted, unique, within [lo, hi]).
+ * Each selection splits the range and the remaining ranks only look at
+ * the side that contains them, so q ranks cost O(N log q) instead of a
+ * full O(N log N) sort.
+ */
+static inline void stats_multiselect(uint64_t *v, size_t lo, size_t hi,
+                                     const size_t *ranks, size_t n)
+{
+    while (n > 0 && lo < hi) {
+        size_t m = n / 2;
+        size_t k = ranks[m];
+        stats_select(v, lo, hi, k);
+        if (m > 0 && k > lo)
+            stats_multiselect(v, lo, k - 1, ranks, m);
+        ranks += m + 1;
+        n -= m + 1;
+        lo = k + 1;
+    }
+}
+
+/* Sort and dedupe a (small) rank list, then select those ranks in v[0..count-1] */
+static inline void stats_select_ranks(uint64_t *v, size_t count, size_t *ranks, size_t nranks)
+{
+    for (size_t i = 1; i < nranks; i++) {
+        size_t r = ranks[i], j = i;
+        while (j > 0 && ranks[j - 1] > r) {
+            ranks[j] = ranks[j - 1];
+            j--;
+        }
+        ranks[j] = r;
+    }
+    size_t u = 0;
+    for (size_t i = 0; i < nranks; i++) {
+        if (u == 0 || ranks[u - 1] != ranks[i])
+            ranks[u++] = ranks[i];
+    }
+    if (count > 0)
+        stats_multiselect(v, 0, count - 1, ranks, u);
+}
+
+/* Rank of percentile bp (basis points) among count samples:
+ * *lower = floor(bp/10000 * (count - 1)), *frac = the remainder in basis points
+ */
+static inline void stats_rank_bp(size_t count, unsigned int bp, size_t *lower, uint64_t *frac)
+{
+    uint64_t pos = (uint64_t)(bp > 10000 ? 10000 : bp) * (count ? count - 1 : 0);
+    *lower = pos / 10000;
+    *frac = pos % 10000;
+}
+
+/* lo + frac/10000 * (hi - lo), x 100 */
+static inline uint64_t stats_interp_x100(uint64_t lo, uint64_t hi, uint64_t frac)
+{
+    return lo * 100 + (hi - lo) * frac / 100;
+}
+
+/* Percentiles bp[0..n-1] (basis points) of v[0..count-1], x 100, with
+ * the rank interpolation of stats_percentiles. Reorders v.
+ * Returns -1 if n is above STATS_MAX_QUANTILES.
+ */
+static inline int stats_percentiles_bp(uint64_t *v, size_t count, const unsigned int *bp,
+                                       uint64_t *x100, size_t n)
+{
+    size_t ranks[2 * STATS_MAX_QUANTILES];
+    size_t nranks = 0, lower;
+    uint64_t frac;
+
+    if (n > STATS_MAX_QUANTILES) return -1;
+    if (count == 0) {
+        for (size_t i = 0; i < n; i++) x100[i] = 0;
+        return 0;
+    }
+    for (size_t i = 0; i < n; i++) {
+        stats_rank_bp(count, bp[i], &lower, &frac);
+        ranks[nranks++] = lower;
+        if (lower + 1 < count)
+            ranks[nranks++] = lower + 1;
+    }
+    stats_select_ranks(v, count, ranks, nranks);
+    for (size_t i = 0; i < n; i++) {
+        stats_rank_bp(count, bp[i], &lower, &frac);
+        x100[i] = lower + 1 < count ? stats_interp_x100(v[lower], v[lower + 1], frac)
+                                    : v[count - 1] * 100;
+    }
+    return 0;
+}
+
+#endif /* STATS_SELECT_H */
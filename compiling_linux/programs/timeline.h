@@ -0,0 +1,311 @@
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+/* Latency timeline: when each sample ran, and which spikes recur.
+ *
+ * stats_t keeps durations only, so after a run nothing says when a spike
+ * happened. A timeline keeps the start TSC of every sample alongside,
+ * delta-encoded as a 32-bit gap to the previous start (4 bytes per sample
+ * next to the 8 of the duration). Sample i of the timeline and sample i
+ * of the stats buffer belong together, so both have to be filled in the
+ * same order, with nothing dropped in between (no isolation mode).
+ *
+ * timeline_analyze() then looks for:
+ *   - spikes: samples above TIMELINE_SPIKE_FACTOR times the median, their
+ *     share of the measured time, and clusters of spikes closer together
+ *     than TIMELINE_CLUSTER_NS (one interrupt storm, one host preemption)
+ *   - periods: the spike counts are binned over the run and the dominant
+ *     lags of their autocorrelation give the periods of the interference,
+ *     e.g. the guest timer tick, host housekeeping or QEMU's main loop
+ *     timers; periods near a common CONFIG_HZ are pointed out
+ * timeline_write_csv() writes a downsampled timeline (TIMELINE_PLOT_POINTS
+ * rows per series) for plotting.
+ *
+ * Gaps above UINT32_MAX cycles (about 2 s at 2 GHz) are clamped and
+ * counted; the analysis runs on the timestamps as reconstructed.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "stats.h"
+
+#define TIMELINE_SPIKE_FACTOR 4         /* spike: above 4x the median */
+#define TIMELINE_CLUSTER_NS   50000     /* spikes closer than 50 us form one cluster */
+#define TIMELINE_ACF_BINS     4096      /* time bins for the autocorrelation */
+#define TIMELINE_ACF_MIN      0.2       /* weakest autocorrelation reported as a period */
+#define TIMELINE_ACF_MIN_LAG  4         /* shortest period, in bins */
+#define TIMELINE_MAX_PERIODS  3
+#define TIMELINE_PLOT_POINTS  1000
+
+typedef struct {
+    uint32_t *gap;          /* gap[i]: start of sample i - start of sample i-1; gap[0] = 0 */
+    size_t count;
+    size_t capacity;
+    uint64_t first;         /* start TSC of sample 0 */
+    uint64_t last;          /* start TSC of the latest sample */
+    size_t clamped;         /* gaps clamped to UINT32_MAX */
+} timeline_t;
+
+typedef struct {
+    double cycles;          /* period in TSC cycles */
+    double r;               /* autocorrelation of the spike counts at that lag */
+} timeline_period_t;
+
+typedef struct {
+    uint64_t median;
+    uint64_t threshold;     /* spike threshold, cycles */
+    uint64_t span;          /* start of the first to start of the last sample */
+    size_t spikes;
+    double spike_share;     /* share of the summed sample time spent in spikes */
+    size_t clusters;
+    size_t max_cluster;     /* spikes in the largest cluster */
+    uint64_t max_cluster_span;
+    double bin;             /* autocorrelation bin width, cycles */
+    int nperiods;
+    timeline_period_t periods[TIMELINE_MAX_PERIODS];
+} timeline_report_t;
+
+/* Bytes of gap storage for n samples */
+static inline size_t timeline_bytes(size_t n)
+{
+    return n * sizeof(uint32_t);
+}
+
+static inline void timeline_init(timeline_t *t, uint32_t *gap, size_t capacity)
+{
+    memset(t, 0, sizeof(*t));
+    t->gap = gap;
+    t->capacity = capacity;
+}
+
+/* Record the start TSC of the next sample */
+static inline void timeline_add(timeline_t *t, uint64_t start)
+{
+    if (t->count >= t->capacity) return;
+    uint64_t d = t->count ? start - t->last : 0;
+    if (t->count == 0) t->first = start;
+    if (d > UINT32_MAX) {
+        d = UINT32_MAX;
+        t->clamped++;
+    }
+    t->gap[t->count++] = (uint32_t)d;
+    t->last = start;
+}
+
+static inline double timeline_ns_to_cycles(double ns)
+{
+    /* Without a TSC frequency, assume 1 GHz */
+    return stats_tsc_hz > 0.0 ? ns * stats_tsc_hz / 1e9 : ns;
+}
+
+/* Autocorrelation of x[0..n-1] at lags 1..n/2 into r; 0 if x is constant */
+static inline void timeline_acf(const double *x, size_t n, double *r)
+{
+    double mean = 0.0, var = 0.0;
+    for (size_t i = 0; i < n; i++) mean += x[i];
+    mean /= n;
+    for (size_t i = 0; i < n; i++) var += (x[i] - mean) * (x[i] - mean);
+    for (size_t lag = 1; lag <= n / 2; lag++) {
+        double c = 0.0;
+        if (var > 0.0)
+            for (size_t i = 0; i + lag < n; i++) c += (x[i] - mean) * (x[i + lag] - mean);
+        r[lag] = var > 0.0 ? c / var : 0.0;
+    }
+}
+
+/* Pick the autocorrelation peaks: local maxima of at least TIMELINE_ACF_MIN,
+ * shortest lag first, skipping multiples of a lag already taken (a pulse
+ * train correlates at every multiple of its period). The strongest
+ * TIMELINE_MAX_PERIODS remain.
+ */
+static inline void timeline_periods(const double *r, size_t maxlag, double bin,
+                                    timeline_report_t *rep)
+{
+    timeline_period_t found[4 * TIMELINE_MAX_PERIODS];
+    size_t lags[4 * TIMELINE_MAX_PERIODS];
+    int nfound = 0;
+
+    for (size_t lag = TIMELINE_ACF_MIN_LAG; lag < maxlag && nfound < 4 * TIMELINE_MAX_PERIODS; lag++) {
+        if (r[lag] < TIMELINE_ACF_MIN || r[lag] <= r[lag - 1] || r[lag] < r[lag + 1])
+            continue;
+        int harmonic = 0;
+        for (int k = 0; k < nfound && !harmonic; k++) {
+            size_t m = (lag + lags[k] / 2) / lags[k];
+            size_t d = lag > m * lags[k] ? lag - m * lags[k] : m * lags[k] - lag;
+            harmonic = m >= 2 && d <= 1 + lag / 50;
+        }
+        if (harmonic) continue;
+        /* Centroid of the peak: a period between two bins splits across both */
+        double w = 0.0, c = 0.0;
+        for (size_t l = lag - 1; l <= lag + 1; l++) {
+            if (r[l] <= 0.0) continue;
+            w += r[l];
+            c += r[l] * l;
+        }
+        lags[nfound] = lag;
+        found[nfound].cycles = c / w * bin;
+        found[nfound].r = r[lag];
+        nfound++;
+    }
+    /* Strongest first */
+    for (int i = 1; i < nfound; i++) {
+        timeline_period_t p = found[i];
+        int j = i;
+        while (j > 0 && found[j - 1].r < p.r) {
+            found[j] = found[j - 1];
+            j--;
+        }
+        found[j] = p;
+    }
+    rep->nperiods = nfound < TIMELINE_MAX_PERIODS ? nfound : TIMELINE_MAX_PERIODS;
+    memcpy(rep->periods, found, rep->nperiods * sizeof(found[0]));
+}
+
+/* Spikes, clusters and periods of a timeline
+ * v: the durations of the same samples, in recording order (before any
+ * percentile call reorders them)
+ * Returns 0, or -1 with fewer than two samples or out of memory.
+ */
+static inline int timeline_analyze(const timeline_t *t, const uint64_t *v, timeline_report_t *rep)
+{
+    size_t n = t->count, nbins = TIMELINE_ACF_BINS;
+    memset(rep, 0, sizeof(*rep));
+    if (n < 2) return -1;
+
+    uint64_t *sorted = malloc(n * sizeof(uint64_t));
+    double *counts = calloc(nbins, sizeof(double));
+    double *r = calloc(nbins / 2 + 1, sizeof(double));
+    if (!sorted || !counts || !r) {
+        free(sorted);
+        free(counts);
+        free(r);
+        return -1;
+    }
+    memcpy(sorted, v, n * sizeof(uint64_t));
+    stats_select(sorted, 0, n - 1, (n - 1) / 2);
+    rep->median = sorted[(n - 1) / 2];
+    rep->threshold = rep->median * TIMELINE_SPIKE_FACTOR;
+    free(sorted);
+
+    for (size_t i = 1; i < n; i++) rep->span += t->gap[i];
+    rep->bin = (double)(rep->span + 1) / nbins;
+
+    double gap_max = timeline_ns_to_cycles(TIMELINE_CLUSTER_NS), total = 0.0, spiked = 0.0;
+    uint64_t at = 0, spike_end = 0, cluster_start = 0;
+    size_t in_cluster = 0;
+    for (size_t i = 0; i < n; i++) {
+        at += t->gap[i];
+        total += v[i];
+        if (v[i] <= rep->threshold) continue;
+        rep->spikes++;
+        spiked += v[i];
+        counts[(size_t)(at / rep->bin)] += 1.0;
+        if (rep->spikes == 1 || at > spike_end + gap_max) {
+            rep->clusters++;
+            in_cluster = 0;
+            cluster_start = at;
+        }
+        in_cluster++;
+        spike_end = at + v[i];
+        if (in_cluster > rep->max_cluster) {
+            rep->max_cluster = in_cluster;
+            rep->max_cluster_span = spike_end - cluster_start;
+        }
+    }
+    rep->spike_share = total > 0.0 ? spiked / total : 0.0;
+
+    if (rep->spikes >= 2) {
+        timeline_acf(counts, nbins, r);
+        timeline_periods(r, nbins / 2, rep->bin, rep);
+    }
+    free(counts);
+    free(r);
+    return 0;
+}
+
+/* A guest timer tick, if the frequency is within 2% of a common CONFIG_HZ */
+static inline int timeline_tick_hz(double hz)
+{
+    static const int ticks[] = { 100, 250, 300, 1000 };
+    for (size_t i = 0; i < sizeof(ticks) / sizeof(ticks[0]); i++)
+        if (fabs(hz - ticks[i]) <= 0.02 * ticks[i]) return ticks[i];
+    return 0;
+}
+
+static inline void timeline_print(const timeline_t *t, const timeline_report_t *rep,
+                                  const char *label)
+{
+    printf("=== Timeline: %s ===\n", label);
+    if (t->count < 2) {
+        printf("Too few samples\n====================================\n\n");
+        return;
+    }
+    if (stats_tsc_hz > 0.0)
+        printf("Span:            %.3f ms, ", stats_cycles_to_ns(rep->span) / 1e6);
+    else
+        printf("Span:            %lu cycles, ", rep->span);
+    printf("%zu samples, a sample every %.0f cycles\n", t->count, (double)rep->span / (t->count - 1));
+    if (t->clamped)
+        printf("                 %zu gaps above 2^32 cycles clamped, later times are early\n",
+               t->clamped);
+    printf("Spikes:          %zu above %lu cycles (%dx median), %.2f per 10^6 samples, "
+           "%.2f%% of the measured time\n", rep->spikes, rep->threshold, TIMELINE_SPIKE_FACTOR,
+           1e6 * rep->spikes / t->count, 100.0 * rep->spike_share);
+    if (rep->spikes)
+        printf("Clusters:        %zu (spikes within %d us), largest %zu spikes over %.1f us\n",
+               rep->clusters, TIMELINE_CLUSTER_NS / 1000, rep->max_cluster,
+               stats_cycles_to_ns(rep->max_cluster_span) / 1e3);
+    if (rep->nperiods == 0)
+        printf("Periods:         none (no autocorrelation of the spikes above %.1f)\n",
+               TIMELINE_ACF_MIN);
+    for (int i = 0; i < rep->nperiods; i++) {
+        const timeline_period_t *p = &rep->periods[i];
+        double ns = stats_cycles_to_ns(p->cycles);
+        printf("%-17s%.0f cycles", i == 0 ? "Periods:" : "", p->cycles);
+        if (ns > 0.0) {
+            int tick = timeline_tick_hz(1e9 / ns);
+            printf(" = %.3f ms (%.1f Hz)", ns / 1e6, 1e9 / ns);
+            if (tick) printf(", timer tick at HZ=%d?", tick);
+        }
+        printf(", autocorrelation %.2f\n", p->r);
+    }
+    printf("====================================\n\n");
+}
+
+/* Append a downsampled timeline to a CSV file (header on an empty file):
+ * per time bucket the sample count, min/mean/max cycles and spikes
+ */
+static inline void timeline_write_csv(FILE *f, const timeline_t *t, const uint64_t *v,
+                                      const timeline_report_t *rep, const char *label)
+{
+    size_t n = t->count, points = n < TIMELINE_PLOT_POINTS ? n : TIMELINE_PLOT_POINTS;
+    double width = (double)(rep->span + 1) / (points ? points : 1);
+    uint64_t at = 0;
+    size_t i = 0;
+
+    if (ftell(f) == 0)
+        fprintf(f, "series,t_us,samples,min,mean,max,spikes\n");
+    for (size_t b = 0; b < points; b++) {
+        uint64_t lo = UINT64_MAX, hi = 0;
+        double sum = 0.0;
+        size_t count = 0, spikes = 0;
+        for (; i < n; i++) {
+            if (at + t->gap[i] >= (b + 1) * width && b + 1 < points) break;
+            at += t->gap[i];
+            if (v[i] < lo) lo = v[i];
+            if (v[i] > hi) hi = v[i];
+            sum += v[i];
+            count++;
+            spikes += v[i] > rep->threshold;
+        }
+        if (count == 0) continue;
+        fprintf(f, "\"%s\",%.3f,%zu,%lu,%.1f,%lu,%zu\n", label,
+                stats_tsc_hz > 0.0 ? stats_cycles_to_ns(b * width) / 1e3 : b * width / 1e3,
+                count, lo, sum / count, hi, spikes);
+    }
+}
+
+#endif /* TIMELINE_H */
@@ -0,0 +1,119 @@
+// Compares the timing.h strategies: the overhead of an empty start/end
+// pair, and how steady each one measures a short fixed workload. Run it
+// inside the guest; the CPUID pair shows what an exiting timer costs.
+//
+// Usage: timing-selftest [N]
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <cpuid.h>
+#include "stats.h"
+#include "timing.h"
+
+#define WORK_STEPS 64
+
+// A dependent multiply-add chain the compiler cannot fold away
+static inline void work(void) {
+    uint64_t x = 1;
+    for (int i = 0; i < WORK_STEPS; i++) {
+        x = x * 3 + 1;
+        asm volatile("" : "+r"(x));
+    }
+}
+
+// One measuring function per strategy, so each pair is inlined exactly as
+// it is in the harnesses
+#define SELFTEST(s)                                                     \
+static void run_##s(stats_t *empty, stats_t *body, size_t n) {          \
+    for (size_t i = 0; i < n; i++) {                                    \
+        uint64_t t0 = timing_##s##_start();                             \
+        uint64_t t1 = timing_##s##_end();                               \
+        stats_add_sample(empty, t1 - t0);                               \
+    }                                                                   \
+    for (size_t i = 0; i < n; i++) {                                    \
+        uint64_t t0 = timing_##s##_start();                             \
+        work();                                                         \
+        uint64_t t1 = timing_##s##_end();                               \
+        stats_add_sample(body, t1 - t0);                                \
+    }                                                                   \
+}
+
+SELFTEST(lfence)
+SELFTEST(rdtscp)
+SELFTEST(mfence)
+SELFTEST(rdpru)
+SELFTEST(cpuid)
+
+static int has_rdtscp(void) {
+    unsigned int a, b, c, d;
+    return __get_cpuid(0x80000001, &a, &b, &c, &d) && (d & (1u << 27));
+}
+
+static int has_rdpru(void) {
+    unsigned int a, b, c, d;
+    return __get_cpuid(0x80000008, &a, &b, &c, &d) && (b & (1u << 4));
+}
+
+static int in_guest(void) {
+    unsigned int a, b, c, d;
+    return __get_cpuid(1, &a, &b, &c, &d) && (c & (1u << 31));
+}
+
+int main(int argc, char **argv) {
+    size_t n = (argc > 1) ? strtoull(argv[1], NULL, 10) : 1000000;
+    struct {
+        int id;
+        const char *name;
+        void (*run)(stats_t *, stats_t *, size_t);
+        int ok;
+    } strategies[] = {
+        { TIMING_LFENCE, "lfence", run_lfence, 1 },
+        { TIMING_RDTSCP, "rdtscp", run_rdtscp, has_rdtscp() },
+        { TIMING_MFENCE, "mfence", run_mfence, 1 },
+        { TIMING_RDPRU,  "rdpru",  run_rdpru,  has_rdpru() },
+        { TIMING_CPUID,  "cpuid",  run_cpuid,  has_rdtscp() },
+    };
+    static const double pcts[] = { 50.0, 99.0 };
+
+    if (n == 0) {
+        printf("Usage: %s [N]\n", argv[0]);
+        return 1;
+    }
+    uint64_t *buf = malloc(2 * n * sizeof(uint64_t));
+    if (!buf) {
+        perror("malloc");
+        return 1;
+    }
+
+    printf("=== Timing strategy self-test ===\n");
+    printf("Samples per series: %zu, running in a guest: %s, compiled default: %s\n",
+           n, in_guest() ? "yes" : "no", TIMING_NAME);
+    printf("Overhead: empty start/end pair. Workload: %d dependent steps, median\n"
+           "overhead subtracted; p99-p50 is its jitter, stddev includes outliers.\n",
+           WORK_STEPS);
+    printf("rdpru counts APERF cycles, all others TSC ticks.\n\n");
+    printf("%-8s | %9s %9s %9s %9s | %9s %9s %9s\n", "strategy",
+           "ovh min", "median", "p99", "stddev", "work med", "p99-p50", "stddev");
+
+    for (size_t i = 0; i < sizeof(strategies) / sizeof(strategies[0]); i++) {
+        if (!strategies[i].ok) {
+            printf("%-8s | not supported on this CPU\n", strategies[i].name);
+            continue;
+        }
+        stats_t empty, body;
+        double e[2], w[2];
+        stats_init(&empty, buf, n);
+        stats_init(&body, buf + n, n);
+        strategies[i].run(&empty, &body, n);
+        stats_percentiles(&empty, pcts, e, 2);
+        stats_percentiles(&body, pcts, w, 2);
+        double work_med = w[0] - e[0];
+        printf("%-8s | %9lu %9.1f %9.1f %9.2f | %9.1f %9.1f %9.2f%s\n", strategies[i].name,
+               stats_min(&empty), e[0], e[1], stats_stddev(&empty),
+               work_med, w[1] - w[0], stats_stddev(&body),
+               strategies[i].id == TIMING_STRATEGY ? "  (default)" : "");
+    }
+
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,346 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+/* Serialized cycle counter reads for user space and kernel modules, and
+ * (user space only) timer overhead calibration.
+ *
+ * The classic CPUID;RDTSC start is unusable inside a guest: CPUID always
+ * exits to KVM, so every sample would contain extra exits, and a CPUID
+ * baseline would be measuring the thing under test. The strategies below
+ * order the counter read with fences only. Pick one at compile time with
+ * -DTIMING_STRATEGY=<n>; all of them stay available by name so
+ * timing-selftest can compare them.
+ *
+ *   TIMING_LFENCE  LFENCE;RDTSC;LFENCE / LFENCE;RDTSC (default; Intel, and
+ *                  AMD with LFENCE made dispatch-serializing, which Linux
+ *                  does on every CPU that needs it)
+ *   TIMING_RDTSCP  RDTSCP;LFENCE on both ends; also returns TSC_AUX
+ *   TIMING_MFENCE  MFENCE;RDTSC;LFENCE, AMD's recommended ordering when
+ *                  LFENCE is not serializing; also drains stores
+ *   TIMING_RDPRU   LFENCE;RDPRU(APERF);LFENCE (AMD Zen2+). Counts actual
+ *                  core cycles rather than TSC ticks and is unaffected by
+ *                  TSC scaling/offsetting, but must be exposed to the guest
+ *   TIMING_CPUID   CPUID;RDTSC / RDTSCP;LFENCE, the old pair; exits in a
+ *                  guest, kept for comparison only
+ *
+ * With TIMING_RDPRU samples are APERF cycles, which run at the core clock,
+ * not the TSC rate: TIMING_COUNTS_TSC is 0, the reports drop their ns
+ * columns (tsc.h) and the module its ns summary. Anything that waits for
+ * or paces by wall time (load.h, tiny-vmm's simulated device work) reads
+ * the TSC through timing_tsc_start/timing_tsc_end whatever the strategy.
+ *
+ * Calibration: every sample is t1 - t0 around the measured instruction,
+ * so it also contains the cost of the start/end pair itself. Calibration
+ * measures that pair around an empty body; its median is subtracted to
+ * give baseline-corrected statistics. Bootstrap replicates of the
+ * baseline median are kept, so the corrected confidence intervals include
+ * the uncertainty of the baseline as well. The series themselves get
+ * order-statistic intervals (stats_percentile_ci), which cost a selection
+ * rather than a bootstrap; -DTIMING_FULL_BOOTSTRAP=1 bootstraps them too,
+ * at TIMING_BOOTSTRAP selections over every sample per report.
+ * Calibrations are cached in
+ * TIMING_CALIB_DIR, keyed by strategy, context and boot id, so repeated
+ * runs within one boot skip the calibration phase.
+ */
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "stats.h"
+#endif
+
+#define TIMING_LFENCE   1
+#define TIMING_RDTSCP   2
+#define TIMING_MFENCE   3
+#define TIMING_RDPRU    4
+#define TIMING_CPUID    5
+
+#ifndef TIMING_STRATEGY
+#define TIMING_STRATEGY TIMING_LFENCE
+#endif
+
+static inline uint64_t timing_lfence_start(void) {
+    unsigned int a, d;
+    asm volatile("lfence\n\trdtsc\n\tlfence" : "=a"(a), "=d"(d) :: "memory");
+    return ((uint64_t)d<<32) | a;
+}
+static inline uint64_t timing_lfence_end(void) {
+    unsigned int a, d;
+    asm volatile("lfence\n\trdtsc" : "=a"(a), "=d"(d) :: "memory");
+    return ((uint64_t)d<<32) | a;
+}
+
+/* RDTSCP waits for all earlier instructions; the LFENCE keeps later ones
+ * from starting before the read. aux receives IA32_TSC_AUX (the CPU
+ * number on Linux) and may be NULL.
+ */
+static inline uint64_t timing_rdtscp(uint32_t *aux) {
+    unsigned int a, d, c;
+    asm volatile("rdtscp\n\tlfence" : "=a"(a), "=d"(d), "=c"(c) :: "memory");
+    if (aux) *aux = c;
+    return ((uint64_t)d<<32) | a;
+}
+static inline uint64_t timing_rdtscp_start(void) { return timing_rdtscp(NULL); }
+static inline uint64_t timing_rdtscp_end(void) { return timing_rdtscp(NULL); }
+
+static inline uint64_t timing_mfence_start(void) {
+    unsigned int a, d;
+    asm volatile("mfence\n\trdtsc\n\tlfence" : "=a"(a), "=d"(d) :: "memory");
+    return ((uint64_t)d<<32) | a;
+}
+static inline uint64_t timing_mfence_end(void) {
+    unsigned int a, d;
+    asm volatile("mfence\n\trdtsc" : "=a"(a), "=d"(d) :: "memory");
+    return ((uint64_t)d<<32) | a;
+}
+
+/* RDPRU with ECX=1 reads APERF. Spelled as bytes for older assemblers. */
+static inline uint64_t timing_rdpru_start(void) {
+    unsigned int a, d;
+    asm volatile("lfence\n\t.byte 0x0f, 0x01, 0xfd\n\tlfence"
+                 : "=a"(a), "=d"(d) : "c"(1) : "memory");
+    return ((uint64_t)d<<32) | a;
+}
+static inline uint64_t timing_rdpru_end(void) {
+    unsigned int a, d;
+    asm volatile("lfence\n\t.byte 0x0f, 0x01, 0xfd"
+                 : "=a"(a), "=d"(d) : "c"(1) : "memory");
+    return ((uint64_t)d<<32) | a;
+}
+
+static inline uint64_t timing_cpuid_start(void) {
+    unsigned int a, d;
+    // CPUID;RDTSC is nicely serialized, but CPUID exits under KVM
+    asm volatile("cpuid" : : "a"(0) : "rbx","rcx","rdx");
+    asm volatile("rdtsc" : "=a"(a), "=d"(d));
+    return ((uint64_t)d<<32) | a;
+}
+static inline uint64_t timing_cpuid_end(void) { return timing_rdtscp(NULL); }
+
+/* TSC reads for pacing and spinning, independent of the strategy */
+#define timing_tsc_start timing_lfence_start
+#define timing_tsc_end   timing_lfence_end
+
+#if TIMING_STRATEGY == TIMING_RDPRU
+#define TIMING_COUNTS_TSC 0
+#else
+#define TIMING_COUNTS_TSC 1
+#endif
+
+#if TIMING_STRATEGY == TIMING_LFENCE
+#define TIMING_NAME "lfence"
+#define rdtsc_serialized_start timing_lfence_start
+#define rdtsc_serialized_end   timing_lfence_end
+#elif TIMING_STRATEGY == TIMING_RDTSCP
+#define TIMING_NAME "rdtscp"
+#define rdtsc_serialized_start timing_rdtscp_start
+#define rdtsc_serialized_end   timing_rdtscp_end
+#elif TIMING_STRATEGY == TIMING_MFENCE
+#define TIMING_NAME "mfence"
+#define rdtsc_serialized_start timing_mfence_start
+#define rdtsc_serialized_end   timing_mfence_end
+#elif TIMING_STRATEGY == TIMING_RDPRU
+#define TIMING_NAME "rdpru"
+#define rdtsc_serialized_start timing_rdpru_start
+#define rdtsc_serialized_end   timing_rdpru_end
+#elif TIMING_STRATEGY == TIMING_CPUID
+#define TIMING_NAME "cpuid"
+#define rdtsc_serialized_start timing_cpuid_start
+#define rdtsc_serialized_end   timing_cpuid_end
+#else
+#error "unknown TIMING_STRATEGY"
+#endif
+
+#ifndef __KERNEL__
+
+#ifndef TIMING_FULL_BOOTSTRAP
+#define TIMING_FULL_BOOTSTRAP 0
+#endif
+
+#define TIMING_CALIB_SAMPLES 200000
+#define TIMING_BOOTSTRAP     200        /* bootstrap replicates per statistic */
+#define TIMING_CONFIDENCE    0.95
+#define TIMING_Z             1.96       /* normal quantile for TIMING_CONFIDENCE */
+#define TIMING_CALIB_DIR     "/tmp"
+
+typedef struct {
+    char name[32];              /* timer pair / context that was calibrated */
+    uint64_t samples;
+    double median;              /* overhead subtracted from every series */
+    double p99;
+    int cached;                 /* loaded from the per-boot cache */
+    double reps[TIMING_BOOTSTRAP];  /* bootstrap replicates of the median */
+} timing_calib_t;
+
+static inline void timing_boot_id(char *buf, size_t len)
+{
+    FILE *f = fopen("/proc/sys/kernel/random/boot_id", "r");
+    buf[0] = '\0';
+    if (f) {
+        if (fgets(buf, len, f))
+            buf[strcspn(buf, "\n")] = '\0';
+        fclose(f);
+    }
+}
+
+static inline void timing_calib_path(char *buf, size_t len, const char *name)
+{
+    snprintf(buf, len, "%s/kvm-microbench-calib-%s", TIMING_CALIB_DIR, name);
+}
+
+/* Load a calibration made earlier in this boot
+ * Returns 0 on success, -1 if there is none (or it is from another boot).
+ */
+static inline int timing_calib_load(timing_calib_t *c, const char *name)
+{
+    char path[256], boot[64], line[64];
+    timing_calib_path(path, sizeof(path), name);
+    timing_boot_id(boot, sizeof(boot));
+    if (boot[0] == '\0') return -1;
+
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    int ok = fgets(line, sizeof(line), f) != NULL;
+    line[strcspn(line, "\n")] = '\0';
+    ok = ok && strcmp(line, boot) == 0;
+    ok = ok && fscanf(f, "%lu %lf %lf", &c->samples, &c->median, &c->p99) == 3;
+    for (size_t b = 0; ok && b < TIMING_BOOTSTRAP; b++)
+        ok = fscanf(f, "%lf", &c->reps[b]) == 1;
+    fclose(f);
+    if (!ok) return -1;
+
+    snprintf(c->name, sizeof(c->name), "%s", name);
+    c->cached = 1;
+    return 0;
+}
+
+static inline void timing_calib_save(const timing_calib_t *c)
+{
+    char path[256], boot[64];
+    timing_calib_path(path, sizeof(path), c->name);
+    timing_boot_id(boot, sizeof(boot));
+    if (boot[0] == '\0') return;
+
+    mkdir(TIMING_CALIB_DIR, 01777);     /* missing in a bare initramfs */
+    FILE *f = fopen(path, "w");
+    if (!f) return;
+    fprintf(f, "%s\n%lu %.17g %.17g\n", boot, c->samples, c->median, c->p99);
+    for (size_t b = 0; b < TIMING_BOOTSTRAP; b++)
+        fprintf(f, "%.17g\n", c->reps[b]);
+    fclose(f);
+}
+
+/* Build a calibration from a baseline series (empty measured body) */
+static inline int timing_calib_from_stats(timing_calib_t *c, const char *name, stats_t *baseline)
+{
+    static const double pcts[] = { 50.0, 99.0 };
+    double p[2];
+
+    memset(c, 0, sizeof(*c));
+    snprintf(c->name, sizeof(c->name), "%s", name);
+    c->samples = baseline->count;
+    stats_percentiles(baseline, pcts, p, 2);
+    c->median = p[0];
+    c->p99 = p[1];
+    return stats_bootstrap(baseline, pcts, 1, c->reps, TIMING_BOOTSTRAP, 0x5eed);
+}
+
+/* Calibrate the rdtsc_serialized_start/end pair, using the per-boot cache */
+static inline int timing_calibrate(timing_calib_t *c)
+{
+    const char *name = "user-" TIMING_NAME;
+    if (timing_calib_load(c, name) == 0) return 0;
+
+    uint64_t *buf = malloc(TIMING_CALIB_SAMPLES * sizeof(uint64_t));
+    if (!buf) return -1;
+    stats_t baseline;
+    stats_init(&baseline, buf, TIMING_CALIB_SAMPLES);
+    for (int i = 0; i < TIMING_CALIB_SAMPLES; i++) {
+        uint64_t t0 = rdtsc_serialized_start();
+        uint64_t t1 = rdtsc_serialized_end();
+        stats_add_sample(&baseline, t1 - t0);
+    }
+    int ret = timing_calib_from_stats(c, name, &baseline);
+    free(buf);
+    if (ret == 0) timing_calib_save(c);
+    return ret;
+}
+
+/* Raw and baseline-corrected confidence intervals of the percentiles
+ * The raw ones are order statistics; the corrected ones add the baseline
+ * median's bootstrap half-widths in quadrature (the two are independent),
+ * the baseline's upper half widening the corrected lower bound.
+ */
+static inline void timing_corrected_ci(stats_t *stats, const double *pcts, const double *raw,
+                                       const timing_calib_t *c, double *lo, double *hi,
+                                       double *clo, double *chi)
+{
+    double base[TIMING_BOOTSTRAP], blo, bhi;
+    memcpy(base, c->reps, sizeof(base));
+    stats_bootstrap_ci(base, TIMING_BOOTSTRAP, TIMING_CONFIDENCE, &blo, &bhi);
+    for (int i = 0; i < 3; i++) {
+        double corr = raw[i] - c->median;
+        stats_percentile_ci(stats, pcts[i], TIMING_Z, &lo[i], &hi[i]);
+        clo[i] = corr - sqrt((raw[i] - lo[i]) * (raw[i] - lo[i]) + (bhi - c->median) * (bhi - c->median));
+        chi[i] = corr + sqrt((hi[i] - raw[i]) * (hi[i] - raw[i]) + (c->median - blo) * (c->median - blo));
+    }
+}
+
+#if TIMING_FULL_BOOTSTRAP
+/* Same, bootstrapping the series against the baseline replicates */
+static inline int timing_bootstrap_ci(stats_t *stats, const double *pcts, const timing_calib_t *c,
+                                      double *lo, double *hi, double *clo, double *chi)
+{
+    double reps[3 * TIMING_BOOTSTRAP], corr[TIMING_BOOTSTRAP];
+    if (stats_bootstrap(stats, pcts, 3, reps, TIMING_BOOTSTRAP, 0xb007) < 0) return -1;
+    for (int i = 0; i < 3; i++) {
+        double *r = reps + i * TIMING_BOOTSTRAP;
+        for (int b = 0; b < TIMING_BOOTSTRAP; b++)
+            corr[b] = r[b] - c->reps[b];
+        stats_bootstrap_ci(r, TIMING_BOOTSTRAP, TIMING_CONFIDENCE, &lo[i], &hi[i]);
+        stats_bootstrap_ci(corr, TIMING_BOOTSTRAP, TIMING_CONFIDENCE, &clo[i], &chi[i]);
+    }
+    return 0;
+}
+#endif
+
+/* Print raw and baseline-corrected median/p90/p99 with confidence intervals */
+static inline void timing_print_corrected(stats_t *stats, const timing_calib_t *c, const char *label)
+{
+    static const double pcts[] = { 50.0, 90.0, 99.0 };
+    static const char *names[] = { "Median", "90th", "99th" };
+    double raw[3], lo[3], hi[3], clo[3], chi[3];
+
+    if (stats->count == 0) return;
+    stats_percentiles(stats, pcts, raw, 3);
+#if TIMING_FULL_BOOTSTRAP
+    if (timing_bootstrap_ci(stats, pcts, c, lo, hi, clo, chi) < 0) return;
+#else
+    timing_corrected_ci(stats, pcts, raw, c, lo, hi, clo, chi);
+#endif
+
+    printf("=== Baseline-corrected: %s ===\n", label);
+    printf("Timer overhead: median %.2f, p99 %.2f cycles (%s, %lu samples%s)\n",
+           c->median, c->p99, c->name, c->samples, c->cached ? ", cached" : "");
+    printf("              raw  %2.0f%% CI                  corrected  %2.0f%% CI%s\n",
+           TIMING_CONFIDENCE * 100, TIMING_CONFIDENCE * 100,
+           stats_tsc_hz > 0.0 ? "              corrected ns" : "");
+    for (int i = 0; i < 3; i++) {
+        printf("%-8s %9.2f  [%9.2f, %9.2f]  %9.2f  [%9.2f, %9.2f]", names[i],
+               raw[i], lo[i], hi[i], raw[i] - c->median, clo[i], chi[i]);
+        if (stats_tsc_hz > 0.0)
+            printf("  %9.2f  [%9.2f, %9.2f]", stats_cycles_to_ns(raw[i] - c->median),
+                   stats_cycles_to_ns(clo[i]), stats_cycles_to_ns(chi[i]));
+        printf("\n");
+    }
+    printf("====================================\n\n");
+}
+
+#endif /* !__KERNEL__ */
+
+#endif /* TIMING_H */
@@ -0,0 +1,234 @@
+#ifndef TSC_H
+#define TSC_H
+
+/* TSC frequency and timing sanity checks (user space).
+ *
+ * Cycle counts only compare across hosts once they are converted to time,
+ * and only mean anything if the TSC ticks at a constant rate and reading
+ * it does not itself exit to the hypervisor. tsc_probe() gathers:
+ *
+ *   frequency  CPUID 0x15 (crystal clock * TSC/crystal ratio), else the
+ *              hypervisor timing leaf 0x40000010, else CPUID 0x16 (base
+ *              frequency), else calibrated against CLOCK_MONOTONIC_RAW.
+ *              A CPUID value is always cross-checked with a short
+ *              calibration and replaced if they disagree.
+ *   invariant  CPUID 0x80000007 EDX[8]: constant rate across P-, C- and
+ *              T-states. Without it cycles are not time.
+ *   exits      whether a bare RDTSC traps (RDTSC exiting, or TSC
+ *              emulation by the hypervisor): back-to-back reads then cost
+ *              a VM exit each, which swamps anything measured with them.
+ *   clocksource the kernel's current clocksource; anything but "tsc" means
+ *              the kernel itself did not trust the TSC.
+ *
+ * The first two problems make cycle results meaningless, so the harnesses
+ * refuse to run on such hosts unless forced (-U); the others are flagged.
+ * tsc_probe() also sets the frequency used by the reports (stats_set_tsc_hz),
+ * unless the timing strategy counts something other than TSC ticks
+ * (TIMING_RDPRU, timing.h): then the reports stay in cycles.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <cpuid.h>
+#include "stats.h"
+#include "timing.h"
+
+#define TSC_CALIB_NS         10000000   /* per calibration window */
+#define TSC_CALIB_WINDOWS    3
+#define TSC_CALIB_TOLERANCE  0.02       /* CPUID vs calibrated, relative */
+#define TSC_EXIT_CYCLES      400        /* native back-to-back RDTSC is ~20-100 */
+#define TSC_EXIT_SAMPLES     1000
+
+#define TSC_UNSAFE_VARIANT   0x1
+#define TSC_UNSAFE_EXITS     0x2
+#define TSC_FLAG_CLOCKSOURCE 0x4
+#define TSC_FLAG_MISMATCH    0x8
+
+#define TSC_UNSAFE (TSC_UNSAFE_VARIANT | TSC_UNSAFE_EXITS)
+
+typedef struct {
+    double hz;                  /* TSC ticks per second */
+    double sample_hz;           /* sample units per second: hz, or 0 with TIMING_RDPRU */
+    const char *source;         /* where hz came from */
+    double cpuid_hz;            /* CPUID value, 0 if none */
+    double calib_hz;            /* CLOCK_MONOTONIC_RAW calibration */
+    int invariant;
+    uint64_t rdtsc_cycles;      /* minimum back-to-back bare RDTSC */
+    char clocksource[32];
+    unsigned int problems;      /* TSC_UNSAFE_* | TSC_FLAG_* */
+} tsc_info_t;
+
+static inline uint64_t tsc_read(void)
+{
+    unsigned int a, d;
+    asm volatile("rdtsc" : "=a"(a), "=d"(d));
+    return ((uint64_t)d << 32) | a;
+}
+
+static inline uint64_t tsc_clock_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Frequency from CPUID, 0 if not enumerated. *source names the leaf. */
+static inline double tsc_cpuid_hz(const char **source)
+{
+    unsigned int a, b, c, d, max = __get_cpuid_max(0, NULL);
+
+    if (max >= 0x15) {
+        __cpuid(0x15, a, b, c, d);
+        if (a && b && c) {
+            *source = "cpuid 0x15";
+            return (double)c * b / a;
+        }
+    }
+    __cpuid(1, a, b, c, d);
+    if (c & (1u << 31)) {
+        __cpuid(0x40000000, a, b, c, d);
+        if (a >= 0x40000010) {
+            __cpuid(0x40000010, a, b, c, d);
+            if (a) {
+                *source = "hypervisor 0x40000010";
+                return a * 1e3;
+            }
+        }
+    }
+    if (max >= 0x16) {
+        __cpuid(0x16, a, b, c, d);
+        if (a & 0xffff) {
+            *source = "cpuid 0x16";
+            return (a & 0xffff) * 1e6;
+        }
+    }
+    return 0.0;
+}
+
+/* One clock/TSC pair, taking the tightest of a few clock reads around the TSC */
+static inline void tsc_clock_pair(uint64_t *ns, uint64_t *tsc)
+{
+    uint64_t best = UINT64_MAX;
+    *ns = *tsc = 0;
+    for (int i = 0; i < 5; i++) {
+        uint64_t n0 = tsc_clock_ns(), t = tsc_read(), n1 = tsc_clock_ns();
+        if (n1 - n0 < best) {
+            best = n1 - n0;
+            *ns = n0 + (n1 - n0) / 2;
+            *tsc = t;
+        }
+    }
+}
+
+/* Median TSC rate over a few windows against CLOCK_MONOTONIC_RAW */
+static inline double tsc_calibrate_hz(void)
+{
+    double hz[TSC_CALIB_WINDOWS];
+    for (int w = 0; w < TSC_CALIB_WINDOWS; w++) {
+        uint64_t n0, t0, n1, t1;
+        tsc_clock_pair(&n0, &t0);
+        do tsc_clock_pair(&n1, &t1); while (n1 - n0 < TSC_CALIB_NS);
+        hz[w] = (double)(t1 - t0) * 1e9 / (n1 - n0);
+    }
+    qsort(hz, TSC_CALIB_WINDOWS, sizeof(double), compare_double);
+    return hz[TSC_CALIB_WINDOWS / 2];
+}
+
+static inline int tsc_invariant(void)
+{
+    unsigned int a, b, c, d;
+    if (__get_cpuid_max(0x80000000, NULL) < 0x80000007) return 0;
+    __cpuid(0x80000007, a, b, c, d);
+    return (d >> 8) & 1;
+}
+
+/* Minimum cost of back-to-back bare RDTSC; a VM exit per read shows up as
+ * thousands of cycles even in the best case.
+ */
+static inline uint64_t tsc_rdtsc_cycles(void)
+{
+    uint64_t best = UINT64_MAX;
+    for (int i = 0; i < TSC_EXIT_SAMPLES; i++) {
+        uint64_t t0 = tsc_read(), t1 = tsc_read();
+        if (t1 - t0 < best) best = t1 - t0;
+    }
+    return best;
+}
+
+static inline void tsc_clocksource(char *buf, size_t len)
+{
+    FILE *f = fopen("/sys/devices/system/clocksource/clocksource0/current_clocksource", "r");
+    snprintf(buf, len, "unknown");
+    if (f) {
+        if (fgets(buf, len, f))
+            buf[strcspn(buf, "\n")] = '\0';
+        fclose(f);
+    }
+}
+
+/* Probe frequency and sanity, and make the reports print nanoseconds.
+ * Returns the problem flags (also in info->problems).
+ */
+static inline unsigned int tsc_probe(tsc_info_t *info)
+{
+    memset(info, 0, sizeof(*info));
+    info->cpuid_hz = tsc_cpuid_hz(&info->source);
+    info->calib_hz = tsc_calibrate_hz();
+    info->invariant = tsc_invariant();
+    info->rdtsc_cycles = tsc_rdtsc_cycles();
+    tsc_clocksource(info->clocksource, sizeof(info->clocksource));
+
+    info->hz = info->cpuid_hz;
+    if (info->cpuid_hz == 0.0) {
+        info->hz = info->calib_hz;
+        info->source = "CLOCK_MONOTONIC_RAW";
+    } else if (fabs(info->calib_hz / info->cpuid_hz - 1.0) > TSC_CALIB_TOLERANCE) {
+        info->problems |= TSC_FLAG_MISMATCH;
+        info->hz = info->calib_hz;
+    }
+    if (!info->invariant) info->problems |= TSC_UNSAFE_VARIANT;
+    if (info->rdtsc_cycles > TSC_EXIT_CYCLES) info->problems |= TSC_UNSAFE_EXITS;
+    if (strcmp(info->clocksource, "tsc") != 0) info->problems |= TSC_FLAG_CLOCKSOURCE;
+
+    info->sample_hz = TIMING_COUNTS_TSC ? info->hz : 0.0;
+    stats_set_tsc_hz(info->sample_hz);
+    return info->problems;
+}
+
+static inline void tsc_print(const tsc_info_t *info)
+{
+    printf("TSC: %.3f MHz (%s", info->hz / 1e6,
+           info->problems & TSC_FLAG_MISMATCH ? "calibrated" : info->source);
+    if (info->cpuid_hz != 0.0)
+        printf(", calibrated %.3f MHz", info->calib_hz / 1e6);
+    printf("), %s, bare RDTSC %lu cycles, clocksource %s\n",
+           info->invariant ? "invariant" : "NOT invariant", info->rdtsc_cycles, info->clocksource);
+    if (!TIMING_COUNTS_TSC)
+        printf("Timer %s counts core cycles, not TSC ticks: reports stay in cycles\n", TIMING_NAME);
+    if (info->problems & TSC_UNSAFE_VARIANT)
+        printf("WARNING: TSC is not invariant; cycles do not map to time\n");
+    if (info->problems & TSC_UNSAFE_EXITS)
+        printf("WARNING: RDTSC appears to exit to the hypervisor (> %d cycles per read)\n",
+               TSC_EXIT_CYCLES);
+    if (info->problems & TSC_FLAG_CLOCKSOURCE)
+        printf("WARNING: kernel clocksource is %s, not tsc\n", info->clocksource);
+    if (info->problems & TSC_FLAG_MISMATCH)
+        printf("WARNING: %s says %.3f MHz, calibration disagrees by more than %.0f%%\n",
+               info->source, info->cpuid_hz / 1e6, TSC_CALIB_TOLERANCE * 100);
+}
+
+/* Probe, print, and decide: returns 0 to go ahead, -1 to refuse */
+static inline int tsc_check(tsc_info_t *info, int force)
+{
+    tsc_probe(info);
+    tsc_print(info);
+    if ((info->problems & TSC_UNSAFE) && !force) {
+        fprintf(stderr, "Refusing to run on an unsafe timing setup (use -U to run anyway)\n");
+        return -1;
+    }
+    return 0;
+}
+
+#endif /* TSC_H */
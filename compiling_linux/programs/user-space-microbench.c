@@ -6,60 +6,516 @@
 #include <sys/mman.h>
 #include <unistd.h>
 #include <sys/io.h>
+#include <pthread.h>
 #include "stats.h"
+#include "hist.h"
+#include "stats_dump.h"
+#include "timing.h"
+#include "tsc.h"
+#include "isolate.h"
+#include "exits.h"
+#include "adaptive.h"
+#include "cold.h"
+#include "results.h"
+#include "pmu.h"
+#include "arena.h"
+#include "series.h"
+#include "marker.h"
+#include "load.h"
+#include "timeline.h"
 
-static inline uint64_t rdtsc_serialized_start(void) {
-    unsigned int a, d;
-    // CPUID;RDTSC is nicely serialized
-    asm volatile("cpuid" : : "a"(0) : "rbx","rcx","rdx");
-    asm volatile("rdtsc" : "=a"(a), "=d"(d));
-    return ((uint64_t)d<<32) | a;
-}
-static inline uint64_t rdtsc_serialized_end(void) {
-    unsigned int a, d, c;
-    asm volatile("rdtscp" : "=a"(a), "=d"(d), "=c"(c));
-    asm volatile("lfence");
-    return ((uint64_t)d<<32) | a;
-}
+#define MAX_THREADS 256
 
-static void pin_cpu0(void) {
-    cpu_set_t set; CPU_ZERO(&set); CPU_SET(0, &set);
+// Pins the calling thread
+static void pin_cpu(int cpu) {
+    cpu_set_t set; CPU_ZERO(&set); CPU_SET(cpu, &set);
     sched_setaffinity(0, sizeof(set), &set);
 }
 
 static void lock_mem(void) { mlockall(MCL_CURRENT|MCL_FUTURE); }
 
+static pmu_t pmu;
+static arena_t arena;
+static timing_calib_t calib;
+static tsc_info_t tsc;
+static results_t results;     // -r; results_add is a no-op without it
+
+// Timeline mode (-T): the start time of every sample, one timeline per
+// series (timeline.h)
+static int use_timeline;
+static timeline_t timelines[EXIT_COUNT];
+static timeline_t *stamp_tl;    // timeline of the series being measured
+
+// One specialised loop per catalog entry (exits.h); the operation is
+// inlined into its own timed loop.
+#define SERIES_ADD(v) series_add(s, v)
+#define USER_LOOP(name, label, path, priv, flags, setup, body)    \
+static void loop_##name(series_t *s, long n) {                    \
+    series_start(s);                                            \
+    EXIT_TIMED_LOOP(n, setup, body, SERIES_ADD);                \
+    series_stop(s);                                             \
+}
+EXIT_CATALOG(USER_LOOP)
+#undef USER_LOOP
+
+typedef void (*loop_fn)(series_t *, long);
+
+// Timeline mode (-T): the same loops, also keeping each sample's start
+#define SERIES_STAMP(t0, v) (timeline_add(stamp_tl, t0), stats_add_sample(&s->stats, v))
+#define STAMP_LOOP(name, label, path, priv, flags, setup, body)   \
+static void stamp_loop_##name(series_t *s, long n) {              \
+    EXIT_STAMPED_LOOP(n, setup, body, SERIES_STAMP);            \
+}
+EXIT_CATALOG(STAMP_LOOP)
+#undef STAMP_LOOP
+
+// Run n samples of a loop; with -P in chunks, reading the counters around each
+static void run_loop(loop_fn loop, series_t *s, long n) {
+    faults_t f0;
+    faults_read(&f0);
+    for (long left = n, c; left > 0; left -= c) {
+        pmu_snapshot_t t0;
+        c = pmu_chunk(&pmu, left);
+        pmu_begin(&pmu, &t0);
+        loop(s, c);
+        pmu_end(&pmu, &t0, &s->pmu, c);
+    }
+    faults_add_since(&s->faults, &f0);
+    s->executed += n;
+}
+
+static const loop_fn user_loops[EXIT_COUNT] = {
+#define USER_LOOP_PTR(name, ...) loop_##name,
+    EXIT_CATALOG(USER_LOOP_PTR)
+#undef USER_LOOP_PTR
+};
+
+static const loop_fn stamp_loops[EXIT_COUNT] = {
+#define STAMP_LOOP_PTR(name, ...) stamp_loop_##name,
+    EXIT_CATALOG(STAMP_LOOP_PTR)
+#undef STAMP_LOOP_PTR
+};
+
+// Cold mode (-C): the same loops, disturbing caches and TLB before every
+// sample (cold.h). Separate loops keep the warm ones untouched.
+static cold_t cold;
+
+#define COLD_LOOP(name, label, path, priv, flags, setup, body)    \
+static void cold_loop_##name(series_t *s, long n) {               \
+    series_start(s);                                            \
+    EXIT_COLD_LOOP(n, setup, body, SERIES_ADD, cold_disturb(&cold)); \
+    series_stop(s);                                             \
+}
+EXIT_CATALOG(COLD_LOOP)
+#undef COLD_LOOP
+
+static const loop_fn cold_loops[EXIT_COUNT] = {
+#define COLD_LOOP_PTR(name, ...) cold_loop_##name,
+    EXIT_CATALOG(COLD_LOOP_PTR)
+#undef COLD_LOOP_PTR
+};
+
+// Throughput mode (-L): paced and back-to-back loops per entry for
+// load_curve (load.h); samples go straight into s, without a series
+#define LOAD_ADD(v) stats_add_sample(s, v)
+#define LOAD_LOOP(name, label, path, priv, flags, setup, body)                  \
+static uint64_t load_loop_##name(void *ctx, uint64_t interval, size_t n, stats_t *s) { \
+    uint64_t start = timing_tsc_start(), due = start;                           \
+    (void)ctx;                                                                  \
+    if (s) EXIT_PACED_LOOP(n, setup, body, LOAD_ADD, interval, due);            \
+    else EXIT_RATE_LOOP(n, setup, body);                                        \
+    return timing_tsc_end() - start;                                            \
+}
+EXIT_CATALOG(LOAD_LOOP)
+#undef LOAD_LOOP
+
+static const load_run_fn load_loops[EXIT_COUNT] = {
+#define LOAD_LOOP_PTR(name, ...) load_loop_##name,
+    EXIT_CATALOG(LOAD_LOOP_PTR)
+#undef LOAD_LOOP_PTR
+};
+
+// Adaptive mode (-A): N only caps the samples of a series
+static int adaptive;
+static adaptive_t adapt;
+
+// Measure one series between its console markers; nothing is printed
+// before the end marker, console output exits too
+static void run_marked(loop_fn loop, series_t *s, long n, const exit_desc_t *e, const char *label) {
+    adaptive_run_t run;
+    size_t chunk;
+    marker_begin(e, label);
+    if (!adaptive) {
+        run_loop(loop, s, n);
+        marker_end(e, s->executed);
+        return;
+    }
+    adaptive_begin(&run);
+    while ((chunk = adaptive_next(&adapt, &s->stats, &run)) > 0)
+        run_loop(loop, s, chunk);
+    marker_end(e, s->executed);
+    adaptive_print(&run, &adapt, label);
+}
+
+// Scaling mode (-S): the same entry on 1, 2, 4 ... N pinned threads at
+// once. Each thread records into its own series; the workers are cache
+// line aligned so no two threads write the same line. A round only
+// reaches the barrier once all of its threads exist: until then run_scaling
+// holds the start lock, and if a thread cannot be created it calls the
+// round off instead.
+typedef struct {
+    series_t s;
+    pthread_t thread;
+    pthread_barrier_t *barrier;
+    pthread_mutex_t *start_lock;
+    const int *called_off;
+    int id, cpu;
+    long n;
+    double start, end;
+} __attribute__((aligned(64))) worker_t;
+
+static void *worker_main(void *arg) {
+    worker_t *w = arg;
+    pin_cpu(w->cpu);
+    pthread_mutex_lock(w->start_lock);
+    pthread_mutex_unlock(w->start_lock);
+    if (*w->called_off) return NULL;
+    pthread_barrier_wait(w->barrier);
+    faults_t f0;
+    faults_read(&f0);
+    w->start = adaptive_now();
+    user_loops[w->id](&w->s, w->n);
+    w->end = adaptive_now();
+    faults_add_since(&w->s.faults, &f0);
+    return NULL;
+}
+
+// "0-3,6" or "all" -> CPU ids; returns the count, 0 on a bad list
+static int parse_cpu_list(const char *spec, int *cpus, int max) {
+    int n = 0;
+    if (strcmp(spec, "all") == 0) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        for (int c = 0; c < ncpu && n < max; c++) cpus[n++] = c;
+        return n;
+    }
+    while (*spec) {
+        char *end;
+        long lo = strtol(spec, &end, 10), hi = lo;
+        if (end == spec || lo < 0) return 0;
+        if (*end == '-') hi = strtol(end + 1, &end, 10);
+        for (long c = lo; c <= hi && n < max; c++) cpus[n++] = c;
+        spec = end;
+        if (*spec == ',') spec++;
+        else if (*spec) return 0;
+    }
+    return n;
+}
+
+static int run_scaling(int id, const int *cpus, int ncpus, long n, const char *label) {
+    static const double pcts[] = { 50.0, 99.0, 99.9 };
+    worker_t *w = aligned_alloc(64, ncpus * sizeof(worker_t));
+    uint64_t *merged = malloc(ncpus * n * sizeof(uint64_t));
+    if (!w || !merged) {
+        perror("malloc");
+        free(merged);
+        free(w);
+        return -1;
+    }
+
+    printf("=== Scaling: %s, %ld samples per thread ===\n", label, n);
+    printf("%7s %10s %10s %10s %10s %10s %14s %14s %7s\n", "threads", "median", "p99", "p99.9", "max",
+           "median ns", "exits/s", "per thread", "faults");
+    for (int t = 1; ; t *= 2) {
+        if (t > ncpus) t = ncpus;
+        char rlabel[96];
+        snprintf(rlabel, sizeof(rlabel), "%s x%d threads", label, t);
+        marker_begin(&exit_catalog[id], rlabel);
+        pthread_barrier_t barrier;
+        pthread_mutex_t start_lock = PTHREAD_MUTEX_INITIALIZER;
+        int started, called_off = 0;
+        pthread_barrier_init(&barrier, NULL, t);
+        pthread_mutex_lock(&start_lock);
+        arena_reset(&arena);
+        for (int i = 0; i < t; i++) {
+            memset(&w[i], 0, sizeof(w[i]));
+            series_init(&w[i].s, n);
+            w[i].barrier = &barrier;
+            w[i].start_lock = &start_lock;
+            w[i].called_off = &called_off;
+            w[i].id = id;
+            w[i].cpu = cpus[i];
+            w[i].n = n;
+        }
+        for (started = 0; started < t; started++) {
+            int err = pthread_create(&w[started].thread, NULL, worker_main, &w[started]);
+            if (err) {
+                fprintf(stderr, "pthread_create: %s\n", strerror(err));
+                called_off = 1;
+                break;
+            }
+        }
+        pthread_mutex_unlock(&start_lock);
+        if (called_off) {
+            for (int i = 0; i < started; i++)
+                pthread_join(w[i].thread, NULL);
+            pthread_barrier_destroy(&barrier);
+            marker_end(&exit_catalog[id], 0);
+            free(merged);
+            free(w);
+            return -1;
+        }
+        stats_t all;
+        stats_init(&all, merged, t * n);
+        double start = 0, end = 0;
+        long faults = 0;
+        for (int i = 0; i < t; i++) {
+            pthread_join(w[i].thread, NULL);
+            if (i == 0 || w[i].start < start) start = w[i].start;
+            if (w[i].end > end) end = w[i].end;
+            stats_merge(&all, &w[i].s.stats);
+            faults += w[i].s.faults.minflt + w[i].s.faults.majflt;
+        }
+        pthread_barrier_destroy(&barrier);
+        marker_end(&exit_catalog[id], (uint64_t)t * n);
+
+        double p[3];
+        stats_percentiles(&all, pcts, p, 3);
+        double rate = all.total / (end - start);
+        printf("%7d %10.1f %10.1f %10.1f %10lu %10.1f %14.0f %14.0f %7ld\n", t, p[0], p[1], p[2],
+               stats_max(&all), stats_cycles_to_ns(p[0]), rate, rate / t, faults);
+        results_add(&results, &all, rlabel, &exit_catalog[id], "user");
+        if (t == ncpus) break;
+    }
+    printf("====================================\n\n");
+    free(merged);
+    free(w);
+    return 0;
+}
+
+static void usage(const char *prog) {
+    printf("Usage: %s [-H] [-R] [-I [-c chunk]] [-e exit,...] [-l] [-o dump.bin] [-r results]\n"
+           "          [-A [-w pct] [-t sec]] [-S cpus] [-C cold] [-L] [-T timeline.csv] [-P]\n"
+           "          [-M 2M|1G] [-U] [N]\n", prog);
+    printf("  -H  record into a log-linear histogram instead of raw samples\n");
+    printf("  -R  raw statistics only (no timer calibration / baseline correction)\n");
+    printf("  -I  isolation mode: pin to CPU 0, lock memory, drop chunks hit by interference\n");
+    printf("  -c  samples per isolation chunk (default: %d)\n", ISOLATE_DEFAULT_CHUNK);
+    printf("  -e  catalog entries to measure (default: CPUID_0,OUT_E9)\n");
+    printf("  -l  list the exit catalog\n");
+    printf("  -o  also write raw samples as a binary dump (file, or e.g. /dev/ttyS1)\n");
+    printf("  -r  also write a summary of every series as JSON, or CSV for a .csv file\n");
+    printf("  -A  adaptive: sample until the median and p99 95%% CIs are narrow enough\n");
+    printf("  -w  with -A, target CI width in %% of the estimate (default: 1)\n");
+    printf("  -t  with -A, time budget per series in seconds (default: 10)\n");
+    printf("  -S  scaling: run on 1, 2, 4 ... of these CPUs at once (\"0-7\" or \"all\")\n");
+    printf("  -C  also measure cold: sweep[=size],code,stack,tlb disturbed before each sample\n");
+    printf("      (sweep default %u MB); prints warm and cold side by side\n", COLD_DEFAULT_SWEEP >> 20);
+    printf("  -L  throughput: max exit rate, then latency from the intended start at rising\n");
+    printf("      offered load (open loop) up to the knee; N exits per point\n");
+    printf("  -T  keep the start time of every sample: report spike clusters and periodic\n");
+    printf("      interference, and write a downsampled timeline as CSV for plotting\n");
+    printf("  -P  read PMU counters (instructions, LLC and branch misses, ...) every %d samples\n",
+           PMU_CHUNK);
+    printf("  -M  back the sample arena with 2 MB or 1 GB hugetlb pages\n");
+    printf("  -U  run even if the TSC is not invariant or RDTSC exits\n");
+    printf("  N   number of samples per series (default: 500000; the cap with -A,\n");
+    printf("      per thread with -S)\n");
+}
+
 int main(int argc, char **argv) {
-    const int N = (argc>1)?atoi(argv[1]):500000;
-    //pin_cpu0(); lock_mem();
+    int opt;
+    const char *dump_path = NULL, *results_path = NULL, *timeline_path = NULL;
+    int ids[EXIT_COUNT] = { EXIT_CPUID_0, EXIT_OUT_E9 };
+    int nids = 2, force = 0, counters = 0, load = 0;
+    int scale_cpus[MAX_THREADS], nscale = 0;
+    double width = 0.01, budget = 10.0;
+    const char *cold_spec = NULL;
+    unsigned int cold_flags = 0;
+    size_t cold_sweep = 0, huge = 0;
+    while ((opt = getopt(argc, argv, "HRIc:e:lo:r:Aw:t:S:C:LT:PM:U")) != -1) {
+        switch (opt) {
+        case 'H': series_mode.hist = 1; break;
+        case 'R': series_mode.raw_only = 1; break;
+        case 'I': series_mode.isolating = 1; break;
+        case 'c': series_mode.iso_chunk = atol(optarg); break;
+        case 'e':
+            nids = exit_parse_list(optarg, ids, EXIT_COUNT);
+            if (nids < 0) return 1;
+            break;
+        case 'l': exit_print_catalog(); return 0;
+        case 'o': dump_path = optarg; break;
+        case 'r': results_path = optarg; break;
+        case 'A': adaptive = 1; break;
+        case 'w': width = atof(optarg) / 100.0; break;
+        case 't': budget = atof(optarg); break;
+        case 'S':
+            nscale = parse_cpu_list(optarg, scale_cpus, MAX_THREADS);
+            if (!nscale) { usage(argv[0]); return 1; }
+            break;
+        case 'C':
+            cold_spec = optarg;
+            if (cold_parse(optarg, &cold_flags, &cold_sweep) < 0) { usage(argv[0]); return 1; }
+            break;
+        case 'L': load = 1; break;
+        case 'T': timeline_path = optarg; use_timeline = 1; break;
+        case 'P': counters = 1; break;
+        case 'M':
+            if (arena_parse_huge(optarg, &huge) < 0) { usage(argv[0]); return 1; }
+            break;
+        case 'U': force = 1; break;
+        default: usage(argv[0]); return 1;
+        }
+    }
+    series_mode.arena = &arena;
+    series_mode.pmu = &pmu;
+    series_mode.calib = &calib;
+    const long N = (optind<argc)?atol(argv[optind]):500000;
+    // Both need raw samples; isolation and scaling would share one CPU's counters
+    if ((adaptive || nscale) && series_mode.hist) {
+        fprintf(stderr, "-A and -S need raw samples, not -H\n");
+        return 1;
+    }
+    // Counters are opened for the main thread only
+    if (nscale && (series_mode.isolating || adaptive || cold_spec || counters)) {
+        fprintf(stderr, "-S cannot be combined with -I, -A, -C or -P\n");
+        return 1;
+    }
+    if ((cold_spec || results_path || dump_path) && series_mode.hist) {
+        fprintf(stderr, "-C, -r and -o need raw samples, not -H\n");
+        return 1;
+    }
+    // The dump keeps the samples in time order; -A reorders them between chunks
+    if (dump_path && adaptive) {
+        fprintf(stderr, "-o cannot be combined with -A\n");
+        return 1;
+    }
+    if (load && (series_mode.hist || series_mode.isolating || adaptive || nscale || cold_spec ||
+                 counters || dump_path)) {
+        fprintf(stderr, "-L cannot be combined with -H, -I, -A, -S, -C, -P or -o\n");
+        return 1;
+    }
+    // The timeline pairs sample i with start i: nothing may be dropped, and
+    // -A reorders the samples between chunks (percentile CIs)
+    if (use_timeline && (series_mode.hist || series_mode.isolating || adaptive || nscale ||
+                         cold_spec || load)) {
+        fprintf(stderr, "-T cannot be combined with -H, -I, -A, -S, -C or -L\n");
+        return 1;
+    }
+    adaptive_init(&adapt, width, budget);
+    if (series_mode.isolating) { pin_cpu(0); lock_mem(); }
+    if (tsc_check(&tsc, force) < 0) return 1;
+    if (counters) {
+        pmu_open(&pmu, 0);
+        pmu_print_status(&pmu);
+    }
+    if (results_path && results_open(&results, results_path, tsc.sample_hz) < 0) {
+        perror(results_path);
+        return 1;
+    }
+    if (cold_spec && cold_init(&cold, cold_flags, cold_sweep) < 0) {
+        perror("cold buffers");
+        return 1;
+    }
+
+    int need_ioperm = 0;
+    for (int k = 0; k < nids; k++) {
+        const exit_desc_t *e = &exit_catalog[ids[k]];
+        if (e->priv == EXIT_KERNEL) {
+            fprintf(stderr, "%s needs CPL 0, use kernel-space-microbench\n", e->name);
+            return 1;
+        }
+        if (e->priv == EXIT_IOPORT) need_ioperm = 1;
+    }
+
+    // All sample storage up front: per worker with -S, else per series
+    size_t arena_size = nscale ? arena_bytes(nscale, series_bytes(N)) :
+                        load ? arena_bytes(1, series_bytes(N)) :
+                        arena_bytes(nids * (cold.flags ? 2 : 1), series_bytes(N)) +
+                        (use_timeline ? arena_bytes(nids, timeline_bytes(N)) : 0);
+    if (arena_init(&arena, arena_size, huge) < 0) {
+        perror("sample arena");
+        return 1;
+    }
+    arena_print(&arena);
+
+    series_t series[EXIT_COUNT], cold_series[EXIT_COUNT];
+    char labels[EXIT_COUNT][64], cold_labels[EXIT_COUNT][72];
+    for (int k = 0; k < nids; k++) {
+        const exit_desc_t *e = &exit_catalog[ids[k]];
+        if (!nscale && !load) series_init(&series[k], N);
+        if (use_timeline) timeline_init(&timelines[k], series_alloc(timeline_bytes(N)), N);
+        if (cold.flags) series_init(&cold_series[k], N);
+        snprintf(labels[k], sizeof(labels[k]), "%s(user, %s)", e->label, e->path);
+        snprintf(cold_labels[k], sizeof(cold_labels[k]), "%s cold", labels[k]);
+    }
+
+    // Timer overhead baseline (cached per boot)
+    if (!series_mode.hist && !series_mode.raw_only && !nscale && !load &&
+        timing_calibrate(&calib) < 0)
+        series_mode.raw_only = 1;
+
+    // Port I/O (e.g. OUT 0xE9, handled in QEMU userspace) needs ioperm
+    if (need_ioperm && ioperm(0, EXIT_IOPORT_MAX + 1, 1)) { perror("ioperm"); return 1; }
+
+    if (nscale) {
+        for (int k = 0; k < nids; k++)
+            if (run_scaling(ids[k], scale_cpus, nscale, N, labels[k]) < 0) return 1;
+        return results_close(&results) < 0 ? 1 : 0;
+    }
+    if (load) {
+        uint64_t *buf = series_alloc(series_bytes(N));
+        for (int k = 0; k < nids; k++)
+            if (load_curve(load_loops[ids[k]], NULL, N, buf, tsc.hz, &results, &exit_catalog[ids[k]],
+                           "user", labels[k]) < 0) {
+                fprintf(stderr, "-L needs the TSC frequency\n");
+                return 1;
+            }
+        return results_close(&results) < 0 ? 1 : 0;
+    }
 
-    uint64_t *s1 = aligned_alloc(64, N*sizeof(uint64_t));
-    uint64_t *s2 = aligned_alloc(64, N*sizeof(uint64_t));
+    for (int k = 0; k < nids; k++) {
+        const exit_desc_t *e = &exit_catalog[ids[k]];
+        stamp_tl = &timelines[k];
+        run_marked(use_timeline ? stamp_loops[ids[k]] : user_loops[ids[k]], &series[k], N, e,
+                   labels[k]);
+        if (cold.flags) run_marked(cold_loops[ids[k]], &cold_series[k], N, e, cold_labels[k]);
+    }
 
-    stats_t stats1, stats2;
-    stats_init(&stats1, s1, N);
-    stats_init(&stats2, s2, N);
+    // Dump in recording order, before the reports reorder the samples
+    if (dump_path) {
+        FILE *f = stats_dump_open(dump_path);
+        if (!f) { perror(dump_path); return 1; }
+        for (int k = 0; k < nids; k++) {
+            series_dump(&series[k], f, labels[k], tsc.sample_hz);
+            if (cold.flags) series_dump(&cold_series[k], f, cold_labels[k], tsc.sample_hz);
+        }
+        if (f != stdout) fclose(f);
+    }
 
-    // FAST PATH: CPUID (handled in KVM kernel)
-    for (int i=0;i<N;i++) {
-        uint64_t t0 = rdtsc_serialized_start();
-        int ax=0x0, bx, cx, dx;
-        asm volatile("cpuid":"+a"(ax), "=b"(bx), "=c"(cx), "=d"(dx));
-        uint64_t t1 = rdtsc_serialized_end();
-        stats_add_sample(&stats1, t1 - t0);
+    // Before the reports: percentiles reorder the samples
+    if (use_timeline) {
+        FILE *f = fopen(timeline_path, "w");
+        if (!f) { perror(timeline_path); return 1; }
+        for (int k = 0; k < nids; k++) {
+            timeline_report_t rep;
+            if (timeline_analyze(&timelines[k], series[k].stats.samples, &rep) < 0) continue;
+            timeline_print(&timelines[k], &rep, labels[k]);
+            timeline_write_csv(f, &timelines[k], series[k].stats.samples, &rep, labels[k]);
+        }
+        if (fclose(f) != 0) { perror(timeline_path); return 1; }
     }
 
-    // SLOW PATH: outb to port 0xE9 (handled in QEMU userspace)
-    if (ioperm(0xE9, 1, 1)) { perror("ioperm"); return 1; }
-    for (int i=0;i<N;i++) {
-        uint64_t t0 = rdtsc_serialized_start();
-        __asm__ __volatile__ (
-	        "outb %b0, %w1":: "a"('T'), "Nd"(0xe9) : "memory");
-        uint64_t t1 = rdtsc_serialized_end();
-        stats_add_sample(&stats2, t1 - t0);
+    char how[128];
+    cold_describe(cold.flags, cold.sweep_bytes, how, sizeof(how));
+    for (int k = 0; k < nids; k++) {
+        series_print(&series[k], labels[k]);
+        results_add(&results, &series[k].stats, labels[k], &exit_catalog[ids[k]], "user");
+        if (!cold.flags) continue;
+        series_print(&cold_series[k], cold_labels[k]);
+        results_add(&results, &cold_series[k].stats, cold_labels[k], &exit_catalog[ids[k]], "user");
+        cold_print_compare(&series[k].stats, &cold_series[k].stats, labels[k], how);
     }
 
-    stats_print_detailed(&stats1, "CPUID(user, fast)");
-    stats_print_detailed(&stats2, "OUT 0xE9(user, slow)");
+    if (results_close(&results) < 0) { perror(results_path); return 1; }
     return 0;
 }
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <fcntl.h>
@@ -5,46 +6,267 @@
 #include <sys/ioctl.h>
 #include <errno.h>
 #include <string.h>
+#include <sched.h>
+#include <sys/mman.h>
 #include "stats.h"
+#include "hist.h"
+#include "stats_dump.h"
+#include "timing.h"
+#include "tsc.h"
+#include "isolate.h"
+#include "exits.h"
+#include "adaptive.h"
+#include "results.h"
+#include "pmu.h"
+#include "arena.h"
+#include "series.h"
+#include "marker.h"
+#include "load.h"
+#include "modules/kvm-fake-ring.h"
 
-static inline uint64_t rdtsc_serialized_start(void) {
-    unsigned int a, d;
-    // CPUID;RDTSC is nicely serialized
-    asm volatile("cpuid" : : "a"(0) : "rbx","rcx","rdx");
-    asm volatile("rdtsc" : "=a"(a), "=d"(d));
-    return ((uint64_t)d<<32) | a;
+// The module also keeps the legacy commands 1-3 (VMCALL, CPUID, OUTB);
+// this harness drives it with EXIT_IOCTL(id) from exits.h
+
+#define DEVICE_PATH "/dev/kvm-fake"
+
+static void pin_cpu0(void) {
+    cpu_set_t set; CPU_ZERO(&set); CPU_SET(0, &set);
+    sched_setaffinity(0, sizeof(set), &set);
 }
-static inline uint64_t rdtsc_serialized_end(void) {
-    unsigned int a, d, c;
-    asm volatile("rdtscp" : "=a"(a), "=d"(d), "=c"(c));
-    asm volatile("lfence");
-    return ((uint64_t)d<<32) | a;
+
+static void lock_mem(void) { mlockall(MCL_CURRENT|MCL_FUTURE); }
+
+static pmu_t pmu;
+static arena_t arena;
+static timing_calib_t calib;
+static tsc_info_t tsc;
+
+// Ring mode (-b): queue `batch` exits per IOCTL_RUN_RING in the module's
+// shared submission ring. The module times the exits itself, so no
+// syscall entry/exit is included. With per_batch the module times the
+// whole batch and the series records the per-exit average of each batch.
+static int run_ring_series(int fd, struct kvm_fake_ring *ring, __u32 op, __u32 arg,
+                           long n, long batch, int per_batch, series_t *s) {
+    for (long left = n; left > 0; ) {
+        __u32 reps = left < batch ? left : batch;
+        struct kvm_fake_sqe *sqe = &ring->sq[ring->sq_tail & (KVM_FAKE_SQ_ENTRIES - 1)];
+        sqe->op = op;
+        sqe->arg = arg;
+        sqe->repeat = reps;
+        sqe->flags = per_batch ? 0 : KVM_FAKE_TIME_EACH;
+        __atomic_store_n(&ring->sq_tail, ring->sq_tail + 1, __ATOMIC_RELEASE);
+
+        if (ioctl(fd, IOCTL_RUN_RING) != 1)
+            return -1;
+
+        __u32 tail = __atomic_load_n(&ring->cq_tail, __ATOMIC_ACQUIRE);
+        for (__u32 h = ring->cq_head; h != tail; h++) {
+            uint64_t v = ring->cq[h & (KVM_FAKE_CQ_ENTRIES - 1)];
+            series_add(s, per_batch ? v / reps : v);
+        }
+        __atomic_store_n(&ring->cq_head, tail, __ATOMIC_RELEASE);
+        left -= reps;
+    }
+    return 0;
 }
 
-// Define the IOCTL commands (must match the kernel module)
-#define IOCTL_RUN_VMCALL   _IOW('v', 1, unsigned long)  // does vmcall
-#define IOCTL_RUN_CPUID     _IOW('v', 2, unsigned long)  // does cpuid (fast path)
-#define IOCTL_RUN_OUTB     _IOW('v', 3, unsigned long)  // does out 0xE9 from kernel
+// One syscall per exit: the module executes catalog entry id once per
+// ioctl, so every sample includes the syscall entry/exit.
+static int run_ioctl_series(int fd, int id, long n, series_t *s) {
+    series_start(s);
+    for (long i=0;i<n;i++) {
+        uint64_t t0 = rdtsc_serialized_start();
+        int ret = ioctl(fd, EXIT_IOCTL(id), 0);
+        uint64_t t1 = rdtsc_serialized_end();
+        if (ret < 0)
+            return -1;
+        series_add(s, t1 - t0);
+    }
+    series_stop(s);
+    return 0;
+}
 
-#define DEVICE_PATH "/dev/kvm-fake"
+// Run n samples either way; with -P in chunks, reading the counters around
+// each (they count in the kernel too, so they include the module's work)
+static int run_series(int fd, struct kvm_fake_ring *ring, int id, long n, long batch,
+                      int per_batch, series_t *s) {
+    faults_t f0;
+    faults_read(&f0);
+    for (long left = n, c; left > 0; left -= c) {
+        pmu_snapshot_t t0;
+        int ret;
+        c = pmu_chunk(&pmu, left);
+        pmu_begin(&pmu, &t0);
+        if (ring) ret = run_ring_series(fd, ring, KVM_FAKE_OP_EXIT(id), 0, c, batch, per_batch, s);
+        else ret = run_ioctl_series(fd, id, c, s);
+        if (ret < 0) return ret;
+        pmu_end(&pmu, &t0, &s->pmu, c);
+        s->executed += c;
+    }
+    faults_add_since(&s->faults, &f0);
+    return 0;
+}
+
+// Timer overhead of the module's own TSC pair, from an empty ring op
+static int ring_calibrate(int fd, struct kvm_fake_ring *ring, long batch, int per_batch) {
+    char name[32];
+    if (per_batch) snprintf(name, sizeof(name), "fake-ring-%s-batch%ld", TIMING_NAME, batch);
+    else snprintf(name, sizeof(name), "fake-ring-%s-each", TIMING_NAME);
+    if (timing_calib_load(&calib, name) == 0) return 0;
+
+    series_t base;
+    int saved_hist = series_mode.hist;
+    series_mode.hist = 0;
+    series_init(&base, TIMING_CALIB_SAMPLES);
+    series_mode.hist = saved_hist;
+    int ret = run_ring_series(fd, ring, KVM_FAKE_OP_EXIT(EXIT_NOP), 0, TIMING_CALIB_SAMPLES, batch, per_batch, &base);
+    if (ret == 0) ret = timing_calib_from_stats(&calib, name, &base.stats);
+    if (ret == 0) timing_calib_save(&calib);
+    return ret;
+}
+
+// Adaptive mode (-A): N only caps the samples of a series
+static int adaptive;
+static adaptive_t adapt;
+
+// Throughput mode (-L): one ioctl per exit as in run_ioctl_series, paced
+// by load_curve (load.h)
+typedef struct {
+    int fd, id, failed;
+} load_ctx_t;
+
+#define LOAD_ADD(v) stats_add_sample(s, v)
+static uint64_t load_ioctl(void *ctx, uint64_t interval, size_t n, stats_t *s) {
+    load_ctx_t *c = ctx;
+    uint64_t start = timing_tsc_start(), due = start;
+    if (s) EXIT_PACED_LOOP(n, 0, c->failed |= ioctl(c->fd, EXIT_IOCTL(c->id), 0) < 0, LOAD_ADD,
+                           interval, due);
+    else EXIT_RATE_LOOP(n, 0, c->failed |= ioctl(c->fd, EXIT_IOCTL(c->id), 0) < 0);
+    return c->failed ? 0 : timing_tsc_end() - start;
+}
+
+static void usage(const char *prog) {
+    printf("Usage: %s [-H] [-R] [-I [-c chunk]] [-e exit,...] [-l] [-o dump.bin] [-r results]\n"
+           "          [-b batch [-B]] [-A [-w pct] [-t sec]] [-L] [-P] [-M 2M|1G] [-U] [N]\n", prog);
+    printf("  -H  record into a log-linear histogram instead of raw samples\n");
+    printf("  -R  raw statistics only (no timer calibration / baseline correction)\n");
+    printf("  -I  isolation mode: pin to CPU 0, lock memory, drop chunks hit by interference\n");
+    printf("  -c  samples per isolation chunk (default: %d)\n", ISOLATE_DEFAULT_CHUNK);
+    printf("  -e  catalog entries to measure (default: CPUID_0,HC_INVALID,OUT_E9)\n");
+    printf("  -l  list the exit catalog\n");
+    printf("  -o  also write raw samples as a binary dump (file, or e.g. /dev/ttyS1)\n");
+    printf("  -r  also write a summary of every series as JSON, or CSV for a .csv file\n");
+    printf("  -b  submit batch exits per syscall through the shared ring (max %d)\n", KVM_FAKE_MAX_REPEAT);
+    printf("  -B  with -b, time whole batches and record the per-exit average\n");
+    printf("  -A  adaptive: sample until the median and p99 95%% CIs are narrow enough\n");
+    printf("  -w  with -A, target CI width in %% of the estimate (default: 1)\n");
+    printf("  -t  with -A, time budget per series in seconds (default: 10)\n");
+    printf("  -L  throughput: max exit rate, then latency from the intended start at rising\n");
+    printf("      offered load (open loop) up to the knee; N exits per point\n");
+    printf("  -P  read PMU counters (instructions, LLC and branch misses, ...) every %d samples\n",
+           PMU_CHUNK);
+    printf("  -M  back the sample arena with 2 MB or 1 GB hugetlb pages\n");
+    printf("  -U  run even if the TSC is not invariant or RDTSC exits\n");
+    printf("  N   number of samples per series (default: 200000; the cap with -A)\n");
+}
 
 int main(int argc, char *argv[]) {
     int fd;
-    int ret;
+    int opt;
 
-    const int N = (argc>1)?atoi(argv[1]):200000;
+    const char *dump_path = NULL, *results_path = NULL;
+    results_t results = { 0 };
+    long batch = 0;
+    int per_batch = 0;
+    int ids[EXIT_COUNT] = { EXIT_CPUID_0, EXIT_HC_INVALID, EXIT_OUT_E9 };
+    int nids = 3, force = 0, counters = 0, load = 0;
+    double width = 0.01, budget = 10.0;
+    size_t huge = 0;
+    while ((opt = getopt(argc, argv, "HRIc:e:lo:r:b:BAw:t:LPM:U")) != -1) {
+        switch (opt) {
+        case 'H': series_mode.hist = 1; break;
+        case 'R': series_mode.raw_only = 1; break;
+        case 'I': series_mode.isolating = 1; break;
+        case 'c': series_mode.iso_chunk = atol(optarg); break;
+        case 'e':
+            nids = exit_parse_list(optarg, ids, EXIT_COUNT);
+            if (nids < 0) return 1;
+            break;
+        case 'l': exit_print_catalog(); return 0;
+        case 'o': dump_path = optarg; break;
+        case 'r': results_path = optarg; break;
+        case 'b': batch = atol(optarg); break;
+        case 'B': per_batch = 1; break;
+        case 'A': adaptive = 1; break;
+        case 'w': width = atof(optarg) / 100.0; break;
+        case 't': budget = atof(optarg); break;
+        case 'L': load = 1; break;
+        case 'P': counters = 1; break;
+        case 'M':
+            if (arena_parse_huge(optarg, &huge) < 0) { usage(argv[0]); return 1; }
+            break;
+        case 'U': force = 1; break;
+        default: usage(argv[0]); return 1;
+        }
+    }
+    series_mode.arena = &arena;
+    series_mode.pmu = &pmu;
+    series_mode.calib = &calib;
+    const long N = (optind<argc)?atol(argv[optind]):200000;
+    if ((adaptive || results_path || dump_path) && series_mode.hist) {
+        fprintf(stderr, "-A, -r and -o need raw samples, not -H\n");
+        return 1;
+    }
+    // The dump keeps the samples in time order; -A reorders them between chunks
+    if (dump_path && adaptive) {
+        fprintf(stderr, "-o cannot be combined with -A\n");
+        return 1;
+    }
+    if (load && (series_mode.hist || series_mode.isolating || adaptive || batch || counters || dump_path)) {
+        fprintf(stderr, "-L cannot be combined with -H, -I, -A, -b, -P or -o\n");
+        return 1;
+    }
+    adaptive_init(&adapt, width, budget);
+    if (batch < 0 || batch > KVM_FAKE_MAX_REPEAT) { usage(argv[0]); return 1; }
+    if (series_mode.isolating && batch > 0) {
+        // Ring samples are timed inside the module, not around user-space chunks
+        printf("Note: -I only applies to the per-ioctl loops, ignored in ring mode\n");
+        series_mode.isolating = 0;
+    }
+    if (series_mode.isolating) { pin_cpu0(); lock_mem(); }
+    if (tsc_check(&tsc, force) < 0) return 1;
+    if (counters) {
+        pmu_open(&pmu, 1);
+        pmu_print_status(&pmu);
+    }
+    if (results_path && results_open(&results, results_path, tsc.sample_hz) < 0) {
+        perror(results_path);
+        return 1;
+    }
 
-    uint64_t *s1 = aligned_alloc(64, N*sizeof(uint64_t));
-    uint64_t *s2 = aligned_alloc(64, N*sizeof(uint64_t));
-    uint64_t *s3 = aligned_alloc(64, N*sizeof(uint64_t));
+    // All sample storage up front, plus the ring mode calibration series
+    size_t arena_size = arena_bytes(nids, series_bytes(N)) +
+                        (batch > 0 ? arena_bytes(1, TIMING_CALIB_SAMPLES * sizeof(uint64_t)) : 0);
+    if (arena_init(&arena, arena_size, huge) < 0) {
+        perror("sample arena");
+        return 1;
+    }
+    arena_print(&arena);
 
-    stats_t stats1, stats2, stats3;
-    stats_init(&stats1, s1, N);
-    stats_init(&stats2, s2, N);
-    stats_init(&stats3, s3, N);
+    series_t series[EXIT_COUNT];
+    char labels[EXIT_COUNT][64];
+    for (int k = 0; k < nids; k++) {
+        const exit_desc_t *e = &exit_catalog[ids[k]];
+        if (batch > 0 && (e->flags & EXIT_F_IRQS_OFF)) {
+            fprintf(stderr, "%s needs interrupts off, use kernel-space-microbench\n", e->name);
+            return 1;
+        }
+        series_init(&series[k], N);
+        snprintf(labels[k], sizeof(labels[k]), "%s(user-kernel, %s)", e->label, e->path);
+    }
 
     printf("=== User to Kernel Microbenchmark ===\n");
-    printf("Number of iterations: %d\n\n", N);
+    printf("Number of iterations: %ld\n\n", N);
 
     // Open the device
     fd = open(DEVICE_PATH, O_RDWR);
@@ -58,55 +280,96 @@ int main(int argc, char *argv[]) {
 
     printf("Device opened successfully.\n\n");
 
-    // Test 1: CPUID (Fast Path)
-    printf("Running Test 1: CPUID instruction (fast path)...\n");
-    for (int i=0;i<N;i++) {
-        uint64_t t0 = rdtsc_serialized_start();
-        ret = ioctl(fd, IOCTL_RUN_CPUID, N);
-        uint64_t t1 = rdtsc_serialized_end();
-        if (ret < 0) {
-            fprintf(stderr, "Error: IOCTL_RUN_CPUID failed: %s\n", strerror(errno));
-            close(fd);
-            return 1;
+    if (load) {
+        for (int k = 0; k < nids; k++) {
+            load_ctx_t ctx = { fd, ids[k], 0 };
+            if (load_curve(load_ioctl, &ctx, N, series[k].stats.samples, tsc.hz, &results,
+                           &exit_catalog[ids[k]], "user-kernel", labels[k]) < 0) {
+                fprintf(stderr, "Error: %s\n", ctx.failed ? strerror(errno) :
+                        "-L needs the TSC frequency");
+                close(fd);
+                return 1;
+            }
         }
-        stats_add_sample(&stats1, t1 - t0);
+        close(fd);
+        return results_close(&results) < 0 ? 1 : 0;
     }
-    printf("  ✓ Completed\n\n");
 
-    // Test 2: VMCALL
-    printf("Running Test 2: VMCALL instruction...\n");
-    for (int i=0;i<N;i++) {
-        uint64_t t0 = rdtsc_serialized_start();
-        ret = ioctl(fd, IOCTL_RUN_VMCALL, N);
-        uint64_t t1 = rdtsc_serialized_end();
-        if (ret < 0) {
-            fprintf(stderr, "Error: IOCTL_RUN_VMCALL failed: %s\n", strerror(errno));
+    if (batch > 0) {
+        struct kvm_fake_ring *ring = mmap(NULL, sizeof(*ring), PROT_READ | PROT_WRITE,
+                                          MAP_SHARED, fd, 0);
+        if (ring == MAP_FAILED) {
+            fprintf(stderr, "Error: mmap of the submission ring failed: %s\n", strerror(errno));
             close(fd);
             return 1;
         }
-        stats_add_sample(&stats2, t1 - t0);
-    }
-    printf("  ✓ Completed\n\n");
+        printf("Ring mode: %ld exits per syscall, %s timing\n\n", batch,
+               per_batch ? "per-batch" : "per-exit");
+        if (!series_mode.hist && !series_mode.raw_only &&
+            ring_calibrate(fd, ring, batch, per_batch) < 0)
+            series_mode.raw_only = 1;
+        for (int k = 0; k < nids; k++) {
+            adaptive_run_t run;
+            long n = N;
+            int ret = 0;
+            printf("Running %s...\n", labels[k]);
+            marker_begin(&exit_catalog[ids[k]], labels[k]);
+            adaptive_begin(&run);
+            while (ret == 0 && (!adaptive || (n = adaptive_next(&adapt, &series[k].stats, &run)) > 0)) {
+                ret = run_series(fd, ring, ids[k], n, batch, per_batch, &series[k]);
+                if (!adaptive) break;
+            }
+            marker_end(&exit_catalog[ids[k]], series[k].executed);
+            if (ret < 0) {
+                fprintf(stderr, "Error: IOCTL_RUN_RING failed: %s\n", strerror(errno));
+                close(fd);
+                return 1;
+            }
+            if (adaptive) adaptive_print(&run, &adapt, labels[k]);
+        }
+        munmap(ring, sizeof(*ring));
+    } else {
+        if (!series_mode.hist && !series_mode.raw_only && timing_calibrate(&calib) < 0)
+            series_mode.raw_only = 1;
 
-    // Test 3: OUT instruction (Slow Path)
-    printf("Running Test 3: OUT instruction to port 0xE9 (slow path)...\n");
-    for (int i=0;i<N;i++) {
-        uint64_t t0 = rdtsc_serialized_start();
-        ret = ioctl(fd, IOCTL_RUN_OUTB, N);
-        uint64_t t1 = rdtsc_serialized_end();
-        if (ret < 0) {
-            fprintf(stderr, "Error: IOCTL_RUN_OUTB failed: %s\n", strerror(errno));
-            close(fd);
-            return 1;
+        for (int k = 0; k < nids; k++) {
+            adaptive_run_t run;
+            long n = N;
+            int ret = 0;
+            printf("Running Test %d: %s...\n", k + 1, labels[k]);
+            marker_begin(&exit_catalog[ids[k]], labels[k]);
+            adaptive_begin(&run);
+            while (ret == 0 && (!adaptive || (n = adaptive_next(&adapt, &series[k].stats, &run)) > 0)) {
+                ret = run_series(fd, NULL, ids[k], n, 0, 0, &series[k]);
+                if (!adaptive) break;
+            }
+            marker_end(&exit_catalog[ids[k]], series[k].executed);
+            if (ret < 0) {
+                fprintf(stderr, "Error: %s ioctl failed: %s\n", exit_catalog[ids[k]].name,
+                        strerror(errno));
+                close(fd);
+                return 1;
+            }
+            printf("  ✓ Completed\n\n");
+            if (adaptive) adaptive_print(&run, &adapt, labels[k]);
         }
-        stats_add_sample(&stats3, t1 - t0);
     }
-    printf("  ✓ Completed\n\n");
 
-    stats_print_detailed(&stats1, "CPUID(user-kernel, fast)");
-    stats_print_detailed(&stats2, "VMCALL(user-kernel, medium)");
-    stats_print_detailed(&stats3, "OUT 0xE9(user-kernel, slow)");
+    // Dump in recording order, before the reports reorder the samples
+    if (dump_path) {
+        FILE *f = stats_dump_open(dump_path);
+        if (!f) { perror(dump_path); close(fd); return 1; }
+        for (int k = 0; k < nids; k++)
+            series_dump(&series[k], f, labels[k], tsc.sample_hz);
+        if (f != stdout) fclose(f);
+    }
+
+    for (int k = 0; k < nids; k++) {
+        series_print(&series[k], labels[k]);
+        results_add(&results, &series[k].stats, labels[k], &exit_catalog[ids[k]], "user-kernel");
+    }
 
     close(fd);
+    if (results_close(&results) < 0) { perror(results_path); return 1; }
     return 0;
 }
@@ -20,11 +20,29 @@ echo "INITRD_IMAGE: $INITRD_IMAGE"
 # QEMU options
 QEMU_OPTS=()
 QEMU_OPTS+=("-enable-kvm")
-QEMU_OPTS+=("-cpu" "host")
+# +invtsc: -cpu host is migratable and hides the invariant TSC flag
+# (CPUID 0x80000007 EDX[8]), which the benchmarks require (tsc.h)
+QEMU_OPTS+=("-cpu" "host,+invtsc")
 QEMU_OPTS+=("-smp" "2")
 QEMU_OPTS+=("-debugcon" "file:debugcon.log" "-global" "isa-debugcon.iobase=0xe9")
 
+# Optional second serial port (guest /dev/ttyS1) that captures binary sample
+# dumps into a host file, e.g. DUMP_FILE=samples.bin ./qemu.sh
+if [ -n "${DUMP_FILE:-}" ]; then
+    QEMU_OPTS+=("-chardev" "file,id=dump,path=$DUMP_FILE" "-device" "isa-serial,chardev=dump")
+fi
 
+# Host kernel and QEMU versions for the guest's result files (-r, results.h):
+# unknown kernel parameters reach the guest's init, and every process it
+# starts, as environment variables
+HOST_KERNEL="$(uname -r)"
+QEMU_VERSION="$(qemu-system-x86_64 --version | sed -n 's/^QEMU emulator version \([^ ]*\).*/\1/p')"
+KERNEL_APPEND="console=ttyS0 acpi.debug_level=ACPI_DEBUG smp.debug_level=SMP_DEBUG ignore_loglevel"
+KERNEL_APPEND+=" KVM_MB_HOST_KERNEL=$HOST_KERNEL KVM_MB_QEMU=${QEMU_VERSION:-unknown}"
+# Series markers on the console for programs/host/kvm-exit-stats (marker.h)
+if [ -n "${KVM_MB_MARKERS:-}" ]; then
+    KERNEL_APPEND+=" KVM_MB_MARKERS=$KVM_MB_MARKERS"
+fi
 
 # Launch QEMU
 echo "Launching QEMU: Command:"
@@ -33,7 +51,7 @@ ${TASKSET_CMD[@]}
 qemu-system-x86_64
     -kernel $KERNEL_IMAGE
     -initrd $INITRD_IMAGE
-    -append "console=ttyS0"
+    -append "$KERNEL_APPEND"
     -nographic
     ${QEMU_OPTS[@]}
     $@
@@ -43,7 +61,7 @@ EOF
 qemu-system-x86_64 \
     -kernel "$KERNEL_IMAGE" \
     -initrd "$INITRD_IMAGE" \
-    -append "console=ttyS0 acpi.debug_level=ACPI_DEBUG smp.debug_level=SMP_DEBUG ignore_loglevel" \
+    -append "$KERNEL_APPEND" \
     -nographic \
     "${QEMU_OPTS[@]}" \
     "$@"